@@ -0,0 +1,21 @@
+-- Used by "complexity bots". Every bot walks the path in a loop and now and then uses a terminal
+-- to run the next command (every bot starts at a different one).
+return {
+    speed = 2.0, -- meters per second
+    -- Offsets from the spawn point in meters. Bots walk through walls, so this doesn't have to
+    -- fit the level.
+    path = {
+        { 0.0, 0.0, 0.0 },
+        { 3.0, 0.0, 0.0 },
+        { 3.0, 0.0, 3.0 },
+        { 0.0, 0.0, 3.0 },
+    },
+    terminalInterval = 10.0, -- seconds
+    commands = {
+        { system = "reactor", command = "power-output show" },
+        { system = "engine", command = "throttle show" },
+        { system = "nav", command = "manual" },
+        { system = "shields", command = "sensor list" },
+        { system = "o2", command = "manual" },
+    },
+}
@@ -0,0 +1,684 @@
+#include "analysis.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include "compression.hpp"
+#include "serialization.hpp"
+#include "util.hpp"
+
+namespace {
+constexpr uint32_t pcapMagic = 0xa1b2c3d4; // microsecond timestamps
+constexpr uint32_t pcapMagicNano = 0xa1b23c4d; // nanosecond timestamps
+constexpr size_t pcapHeaderSize = 24;
+constexpr size_t pcapRecordHeaderSize = 16;
+
+enum class LinkType : uint32_t {
+    Null = 0,
+    Ethernet = 1,
+    Raw = 101,
+    LinuxSll = 113,
+    LinuxSll2 = 276,
+};
+
+// Bigger messages are certainly garbage
+constexpr uint32_t maxMessageSize = 16 * 1024 * 1024;
+// Records this far from the previous one have a corrupt timestamp. Every second up to them would
+// be added to the per second statistics.
+constexpr double maxRecordGap = 60.0 * 60.0;
+
+std::string escapeJson(const std::string& str)
+{
+    std::string res;
+    res.reserve(str.size());
+    for (const auto c : str) {
+        if (c == '"' || c == '\\') {
+            res.push_back('\\');
+            res.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            res += fmt::format("\\u{:04x}", static_cast<int>(c));
+        } else {
+            res.push_back(c);
+        }
+    }
+    return res;
+}
+
+double getPercentile(const std::vector<double>& sorted, double percentile)
+{
+    const auto index = static_cast<size_t>(std::round(percentile * (sorted.size() - 1)));
+    return sorted[index];
+}
+
+// Reads integers in network byte order
+class Cursor {
+public:
+    Cursor(const uint8_t* data, size_t size)
+        : data_(data)
+        , size_(size)
+    {
+    }
+
+    template <typename T>
+    bool read(T& value)
+    {
+        if (getLeft() < sizeof(T))
+            return false;
+        std::memcpy(&value, data_ + pos_, sizeof(T));
+        value = ntoh(value);
+        pos_ += sizeof(T);
+        return true;
+    }
+
+    bool skip(size_t num)
+    {
+        if (getLeft() < num)
+            return false;
+        pos_ += num;
+        return true;
+    }
+
+    const uint8_t* get() const
+    {
+        return data_ + pos_;
+    }
+
+    size_t getLeft() const
+    {
+        return size_ - pos_;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_ = 0;
+};
+
+// Takes the messages out of ENet's datagrams. This only works, because the game does not use
+// ENet's checksums or compression.
+class EnetDecoder {
+public:
+    EnetDecoder(TrafficAnalysis& analysis)
+        : analysis_(analysis)
+    {
+    }
+
+    // sender and receiver identify the endpoints (address and port)
+    void decode(double time, TrafficAnalysis::Direction direction, const std::string& sender,
+        const std::string& receiver, const uint8_t* data, size_t size)
+    {
+        analysis_.addDatagram(time, direction, size);
+        auto& flow = flows_[sender + receiver];
+        Cursor cursor(data, size);
+
+        uint16_t peerId = 0;
+        if (!cursor.read(peerId) || (peerId & ENET_PROTOCOL_HEADER_FLAG_COMPRESSED)) {
+            analysis_.addUndecodable(direction);
+            return;
+        }
+        if (peerId & ENET_PROTOCOL_HEADER_FLAG_SENT_TIME) {
+            uint16_t sentTime = 0;
+            if (!cursor.read(sentTime)) {
+                analysis_.addUndecodable(direction);
+                return;
+            }
+            // Wrapped around (after about a minute) or a resend of an old sent time
+            const auto [it, inserted] = flow.sentTimes.emplace(sentTime, time);
+            if (!inserted && time - it->second > 1.0)
+                it->second = time;
+        }
+
+        while (cursor.getLeft() > 0) {
+            if (!decodeCommand(time, direction, flow, flows_[receiver + sender], cursor)) {
+                analysis_.addUndecodable(direction);
+                return;
+            }
+        }
+    }
+
+private:
+    struct FragmentedMessage {
+        std::vector<uint8_t> data;
+        std::vector<bool> received;
+        size_t receivedCount = 0;
+    };
+
+    // One direction between two endpoints
+    struct Flow {
+        // Reliable sequence numbers of the last half of the sequence space, to find resends
+        std::array<std::vector<bool>, static_cast<size_t>(Channel::Count)> seenReliable;
+        // By command type, channel and start sequence number
+        std::map<uint32_t, FragmentedMessage> fragments;
+        // Capture times of the datagrams by their sent time, for the acknowledgements
+        std::unordered_map<uint16_t, double> sentTimes;
+        ChunkAssembler chunks;
+    };
+
+    // Chunked messages are counted once they are complete
+    void addMessage(double time, TrafficAnalysis::Direction direction, Flow& flow,
+        uint8_t channelId, const uint8_t* data, size_t size)
+    {
+        const auto channel = static_cast<Channel>(channelId);
+        if (!isChunk(data, size)) {
+            analysis_.addMessage(time, direction, channel, data, size);
+            return;
+        }
+        std::vector<uint8_t> message;
+        if (!flow.chunks.add(channel, data, size, message))
+            analysis_.addUndecodable(direction);
+        else if (!message.empty())
+            analysis_.addMessage(time, direction, channel, message.data(), message.size());
+    }
+
+    bool decodeCommand(double time, TrafficAnalysis::Direction direction, Flow& flow,
+        Flow& reverseFlow, Cursor& cursor)
+    {
+        const auto start = cursor.get();
+        uint8_t command = 0, channelId = 0;
+        uint16_t reliableSequence = 0;
+        if (!cursor.read(command) || !cursor.read(channelId) || !cursor.read(reliableSequence))
+            return false;
+        const auto type = command & ENET_PROTOCOL_COMMAND_MASK;
+        if (type == ENET_PROTOCOL_COMMAND_NONE || type >= ENET_PROTOCOL_COMMAND_COUNT)
+            return false;
+
+        uint16_t dataLength = 0;
+        switch (type) {
+        case ENET_PROTOCOL_COMMAND_ACKNOWLEDGE: {
+            uint16_t receivedReliableSequence = 0, receivedSentTime = 0;
+            if (!cursor.read(receivedReliableSequence) || !cursor.read(receivedSentTime))
+                return false;
+            // The round trip as seen from where the capture was made
+            const auto it = reverseFlow.sentTimes.find(receivedSentTime);
+            if (it != reverseFlow.sentTimes.end()) {
+                analysis_.addRoundTrip(getReverse(direction), time - it->second);
+                reverseFlow.sentTimes.erase(it);
+            }
+            return true;
+        }
+        case ENET_PROTOCOL_COMMAND_SEND_RELIABLE:
+            if (!cursor.read(dataLength))
+                return false;
+            break;
+        case ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE:
+        case ENET_PROTOCOL_COMMAND_SEND_UNSEQUENCED:
+            if (!cursor.skip(2) || !cursor.read(dataLength))
+                return false;
+            break;
+        case ENET_PROTOCOL_COMMAND_SEND_FRAGMENT:
+        case ENET_PROTOCOL_COMMAND_SEND_UNRELIABLE_FRAGMENT:
+            return decodeFragment(
+                time, direction, flow, cursor, start, command, channelId, reliableSequence);
+        default:
+            // Connection management, nothing the game sent
+            return cursor.skip(enet_protocol_command_size(command) - (cursor.get() - start));
+        }
+
+        const auto payload = cursor.get();
+        if (!cursor.skip(dataLength) || channelId >= static_cast<uint8_t>(Channel::Count))
+            return false;
+        if (type == ENET_PROTOCOL_COMMAND_SEND_RELIABLE
+            && isResend(flow, channelId, reliableSequence)) {
+            analysis_.addRetransmit(direction, cursor.get() - start);
+            return true;
+        }
+        addMessage(time, direction, flow, channelId, payload, dataLength);
+        return true;
+    }
+
+    bool decodeFragment(double time, TrafficAnalysis::Direction direction, Flow& flow,
+        Cursor& cursor, const uint8_t* start, uint8_t command, uint8_t channelId,
+        uint16_t reliableSequence)
+    {
+        uint16_t startSequence = 0, dataLength = 0;
+        uint32_t fragmentCount = 0, fragmentNumber = 0, totalLength = 0, fragmentOffset = 0;
+        if (!cursor.read(startSequence) || !cursor.read(dataLength) || !cursor.read(fragmentCount)
+            || !cursor.read(fragmentNumber) || !cursor.read(totalLength)
+            || !cursor.read(fragmentOffset))
+            return false;
+        const auto payload = cursor.get();
+        if (!cursor.skip(dataLength) || channelId >= static_cast<uint8_t>(Channel::Count))
+            return false;
+        // The fragment has to fit without fragmentOffset + dataLength, which can wrap around
+        if (totalLength > maxMessageSize || fragmentNumber >= fragmentCount
+            || fragmentCount > totalLength || fragmentOffset > totalLength
+            || dataLength > totalLength - fragmentOffset)
+            return false;
+
+        const auto type = command & ENET_PROTOCOL_COMMAND_MASK;
+        if (type == ENET_PROTOCOL_COMMAND_SEND_FRAGMENT
+            && isResend(flow, channelId, reliableSequence)) {
+            analysis_.addRetransmit(direction, cursor.get() - start);
+            return true;
+        }
+
+        const auto key = static_cast<uint32_t>(type) << 24 | static_cast<uint32_t>(channelId) << 16
+            | startSequence;
+        auto& message = flow.fragments[key];
+        if (message.data.size() != totalLength || message.received.size() != fragmentCount) {
+            message.data.assign(totalLength, 0);
+            message.received.assign(fragmentCount, false);
+            message.receivedCount = 0;
+        }
+        if (message.received[fragmentNumber])
+            return true;
+        std::copy(payload, payload + dataLength, message.data.begin() + fragmentOffset);
+        message.received[fragmentNumber] = true;
+        message.receivedCount++;
+        if (message.receivedCount == fragmentCount) {
+            addMessage(time, direction, flow, channelId, message.data.data(), message.data.size());
+            flow.fragments.erase(key);
+        }
+        return true;
+    }
+
+    static bool isResend(Flow& flow, uint8_t channelId, uint16_t sequence)
+    {
+        auto& seen = flow.seenReliable[channelId];
+        if (seen.empty())
+            seen.resize(0x10000, false);
+        if (seen[sequence])
+            return true;
+        seen[sequence] = true;
+        // Forget the other half, so the numbers can be used again after wrapping around
+        seen[static_cast<uint16_t>(sequence + 0x8000)] = false;
+        return false;
+    }
+
+    static TrafficAnalysis::Direction getReverse(TrafficAnalysis::Direction direction)
+    {
+        return direction == TrafficAnalysis::Direction::ToServer
+            ? TrafficAnalysis::Direction::ToClient
+            : TrafficAnalysis::Direction::ToServer;
+    }
+
+    TrafficAnalysis& analysis_;
+    std::unordered_map<std::string, Flow> flows_;
+};
+
+struct Datagram {
+    std::string sender;
+    std::string receiver;
+    uint16_t senderPort;
+    uint16_t receiverPort;
+    const uint8_t* data;
+    size_t size;
+};
+
+// Returns nullopt if it's not UDP over IP
+std::optional<Datagram> getDatagram(const uint8_t* data, size_t size, LinkType linkType)
+{
+    Cursor cursor(data, size);
+    uint16_t etherType = 0;
+    switch (linkType) {
+    case LinkType::Null:
+        // The address family is in the byte order of the capturing host, so the IP version is
+        // checked instead
+        if (!cursor.skip(4))
+            return std::nullopt;
+        [[fallthrough]];
+    case LinkType::Raw:
+        if (cursor.getLeft() == 0)
+            return std::nullopt;
+        etherType = (cursor.get()[0] >> 4) == 6 ? 0x86dd : 0x0800;
+        break;
+    case LinkType::Ethernet:
+        if (!cursor.skip(12) || !cursor.read(etherType))
+            return std::nullopt;
+        if (etherType == 0x8100 && (!cursor.skip(2) || !cursor.read(etherType)))
+            return std::nullopt;
+        break;
+    case LinkType::LinuxSll:
+        if (!cursor.skip(14) || !cursor.read(etherType))
+            return std::nullopt;
+        break;
+    case LinkType::LinuxSll2:
+        if (!cursor.read(etherType) || !cursor.skip(18))
+            return std::nullopt;
+        break;
+    }
+
+    const auto ip = cursor.get();
+    Datagram datagram;
+    if (etherType == 0x0800) {
+        if (cursor.getLeft() < 20 || ip[9] != 17) // UDP
+            return std::nullopt;
+        // The game's datagrams are smaller than the MTU, so fragments are not reassembled
+        const auto fragment = (ip[6] << 8 | ip[7]) & 0x3fff;
+        const auto headerSize = static_cast<size_t>(ip[0] & 0x0f) * 4;
+        if (fragment != 0 || headerSize < 20 || !cursor.skip(headerSize))
+            return std::nullopt;
+        datagram.sender.assign(ip + 12, ip + 16);
+        datagram.receiver.assign(ip + 16, ip + 20);
+    } else if (etherType == 0x86dd) {
+        // Extension headers are not supported
+        if (cursor.getLeft() < 40 || ip[6] != 17 || !cursor.skip(40))
+            return std::nullopt;
+        datagram.sender.assign(ip + 8, ip + 24);
+        datagram.receiver.assign(ip + 24, ip + 40);
+    } else {
+        return std::nullopt;
+    }
+
+    uint16_t length = 0;
+    if (!cursor.read(datagram.senderPort) || !cursor.read(datagram.receiverPort)
+        || !cursor.read(length) || !cursor.skip(2) || length < 8 || length - 8u > cursor.getLeft())
+        return std::nullopt;
+    datagram.sender += std::to_string(datagram.senderPort);
+    datagram.receiver += std::to_string(datagram.receiverPort);
+    datagram.data = cursor.get();
+    datagram.size = length - 8u;
+    return datagram;
+}
+
+uint32_t swapBytes(uint32_t value)
+{
+    return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+}
+}
+
+void TrafficAnalysis::Counter::add(size_t count, size_t size, size_t rawSize)
+{
+    messages += count;
+    bytes += size * count;
+    rawBytes += rawSize * count;
+}
+
+void TrafficAnalysis::addMessage(double time, Direction direction, Channel channel,
+    const uint8_t* data, size_t size, size_t recipients)
+{
+    if (recipients == 0)
+        return;
+
+    std::optional<std::vector<uint8_t>> decompressed;
+    if (getChannelProperties(channel).compressed) {
+        CompressionStats compressionStats; // The ones of the server or client are not touched
+        decompressed = decompressMessage(data, size, compressionStats);
+        if (!decompressed) {
+            addUndecodable(direction);
+            return;
+        }
+    }
+    ReadBuffer buffer = decompressed ? ReadBuffer(decompressed->data(), decompressed->size())
+                                     : ReadBuffer(data, size);
+    CommonMessageHeader header;
+    if (!deserialize(buffer, header)) {
+        addUndecodable(direction);
+        return;
+    }
+    const auto type = static_cast<MessageType>(header.messageType);
+    const auto rawSize = decompressed ? decompressed->size() : size;
+
+    auto& stats = getStats(direction);
+    auto& typeStats = stats.types[type];
+    typeStats.counter.add(recipients, size, rawSize);
+    typeStats.histogram[getBucket(size)] += recipients;
+    stats.channels[static_cast<size_t>(channel)].add(recipients, size, rawSize);
+    auto& second = getSecond(time);
+    second.directions[static_cast<size_t>(direction)].add(recipients, size, rawSize);
+
+    const auto bigger = [](const TopMessage& a, const TopMessage& b) { return a.size > b.size; };
+    if (topMessages_.size() == topMessageCount) {
+        if (size <= topMessages_.front().size)
+            return;
+        std::pop_heap(topMessages_.begin(), topMessages_.end(), bigger);
+        topMessages_.pop_back();
+    }
+    topMessages_.push_back(TopMessage { time - startTime_, direction, channel, type, size });
+    std::push_heap(topMessages_.begin(), topMessages_.end(), bigger);
+}
+
+void TrafficAnalysis::addDatagram(double time, Direction direction, size_t size)
+{
+    auto& stats = getStats(direction);
+    stats.datagrams++;
+    stats.datagramBytes += size;
+    getSecond(time);
+}
+
+void TrafficAnalysis::addRetransmit(Direction direction, size_t size)
+{
+    auto& stats = getStats(direction);
+    stats.retransmits++;
+    stats.retransmittedBytes += size;
+}
+
+void TrafficAnalysis::addRoundTrip(Direction direction, double rtt)
+{
+    getStats(direction).roundTrips.push_back(rtt);
+}
+
+void TrafficAnalysis::addUndecodable(Direction direction)
+{
+    getStats(direction).undecodable++;
+}
+
+std::string TrafficAnalysis::toJson(const std::string& source) const
+{
+    const auto counterJson = [](const Counter& counter) {
+        return fmt::format(R"("messages": {}, "bytes": {}, "rawBytes": {})", counter.messages,
+            counter.bytes, counter.rawBytes);
+    };
+
+    std::string json = fmt::format("{{\n  \"source\": \"{}\",\n  \"duration\": {},\n",
+        escapeJson(source), seconds_.size());
+
+    json += "  \"directions\": {";
+    for (size_t d = 0; d < directions_.size(); ++d) {
+        const auto& stats = directions_[d];
+        Counter total;
+        for (const auto& [type, typeStats] : stats.types) {
+            total.messages += typeStats.counter.messages;
+            total.bytes += typeStats.counter.bytes;
+            total.rawBytes += typeStats.counter.rawBytes;
+        }
+        json += fmt::format("{}\n    \"{}\": {{\n      {},\n", d > 0 ? "," : "",
+            asString(static_cast<Direction>(d)), counterJson(total));
+        json += fmt::format(
+            "      \"datagrams\": {}, \"datagramBytes\": {}, \"retransmits\": {}, "
+            "\"retransmittedBytes\": {}, \"undecodable\": {},\n",
+            stats.datagrams, stats.datagramBytes, stats.retransmits, stats.retransmittedBytes,
+            stats.undecodable);
+
+        if (!stats.roundTrips.empty()) {
+            auto sorted = stats.roundTrips;
+            std::sort(sorted.begin(), sorted.end());
+            json += fmt::format(
+                "      \"roundTrip\": {{\"samples\": {}, \"min\": {:.4f}, \"median\": {:.4f}, "
+                "\"p95\": {:.4f}, \"max\": {:.4f}}},\n",
+                sorted.size(), sorted.front(), getPercentile(sorted, 0.5),
+                getPercentile(sorted, 0.95), sorted.back());
+        }
+
+        json += "      \"messageTypes\": {";
+        bool first = true;
+        for (const auto& [type, typeStats] : stats.types) {
+            json += fmt::format("{}\n        \"{}\": {{{}, \"histogram\": {{", first ? "" : ",",
+                asString(type), counterJson(typeStats.counter));
+            first = false;
+            bool firstBucket = true;
+            for (size_t b = 0; b < histogramBuckets; ++b) {
+                if (typeStats.histogram[b] == 0)
+                    continue;
+                const auto label = b + 1 < histogramBuckets ? std::to_string(size_t(16) << b)
+                                                            : std::string("more");
+                json += fmt::format(
+                    "{}\"{}\": {}", firstBucket ? "" : ", ", label, typeStats.histogram[b]);
+                firstBucket = false;
+            }
+            json += "}}";
+        }
+        json += "\n      },\n      \"channels\": {";
+        for (size_t c = 0; c < stats.channels.size(); ++c) {
+            json += fmt::format("{}\n        \"{}\": {{{}}}", c > 0 ? "," : "",
+                asString(static_cast<Channel>(c)), counterJson(stats.channels[c]));
+        }
+        json += "\n      }\n    }";
+    }
+    json += "\n  },\n";
+
+    json += "  \"seconds\": [";
+    for (size_t s = 0; s < seconds_.size(); ++s) {
+        const auto& second = seconds_[s];
+        json += fmt::format("{}\n    {{\"{}\": {{{}}}, \"{}\": {{{}}}}}", s > 0 ? "," : "",
+            asString(Direction::ToServer), counterJson(second.directions[0]),
+            asString(Direction::ToClient), counterJson(second.directions[1]));
+    }
+    json += "\n  ],\n";
+
+    auto top = topMessages_;
+    std::sort(top.begin(), top.end(),
+        [](const TopMessage& a, const TopMessage& b) { return a.size > b.size; });
+    json += "  \"topMessages\": [";
+    for (size_t i = 0; i < top.size(); ++i) {
+        const auto& msg = top[i];
+        json += fmt::format(
+            "{}\n    {{\"time\": {:.3f}, \"direction\": \"{}\", \"channel\": \"{}\", "
+            "\"type\": \"{}\", \"bytes\": {}}}",
+            i > 0 ? "," : "", msg.time, asString(msg.direction), asString(msg.channel),
+            asString(msg.type), msg.size);
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+void TrafficAnalysis::printSummary() const
+{
+    for (size_t d = 0; d < directions_.size(); ++d) {
+        const auto& stats = directions_[d];
+        std::vector<std::pair<MessageType, Counter>> types;
+        size_t totalBytes = 0;
+        for (const auto& [type, typeStats] : stats.types) {
+            types.emplace_back(type, typeStats.counter);
+            totalBytes += typeStats.counter.bytes;
+        }
+        std::sort(types.begin(), types.end(),
+            [](const auto& a, const auto& b) { return a.second.bytes > b.second.bytes; });
+        println("{}: {} bytes in messages", asString(static_cast<Direction>(d)), totalBytes);
+        for (const auto& [type, counter] : types) {
+            println("  {:<28} {:>10} bytes {:>5.1f}% {:>8} messages", asString(type),
+                counter.bytes, 100.0 * counter.bytes / std::max(totalBytes, size_t(1)),
+                counter.messages);
+        }
+    }
+}
+
+size_t TrafficAnalysis::getBucket(size_t size)
+{
+    if (size == 0)
+        return 0;
+    return std::min(bitsRequired((size - 1) >> 4), histogramBuckets - 1);
+}
+
+TrafficAnalysis::DirectionStats& TrafficAnalysis::getStats(Direction direction)
+{
+    return directions_[static_cast<size_t>(direction)];
+}
+
+TrafficAnalysis::Second& TrafficAnalysis::getSecond(double time)
+{
+    if (startTime_ < 0.0)
+        startTime_ = time;
+    const auto index = static_cast<size_t>(std::max(0.0, time - startTime_));
+    if (index >= seconds_.size())
+        seconds_.resize(index + 1);
+    return seconds_[index];
+}
+
+std::string asString(TrafficAnalysis::Direction direction)
+{
+    switch (direction) {
+    case TrafficAnalysis::Direction::ToServer:
+        return "toServer";
+    case TrafficAnalysis::Direction::ToClient:
+        return "toClient";
+    default:
+        return "Unknown";
+    }
+}
+
+bool isPcapFile(const std::string& path)
+{
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    uint32_t magic = 0;
+    const auto read = std::fread(&magic, sizeof(magic), 1, file) == 1;
+    std::fclose(file);
+    return read
+        && (magic == pcapMagic || magic == pcapMagicNano || swapBytes(magic) == pcapMagic
+            || swapBytes(magic) == pcapMagicNano);
+}
+
+bool analyzePcap(const std::string& path, Port serverPort, TrafficAnalysis& analysis)
+{
+    const auto content = readFile(path);
+    if (!content) {
+        printErr("Could not read '{}'", path);
+        return false;
+    }
+    const auto data = reinterpret_cast<const uint8_t*>(content->data());
+    const auto size = content->size();
+    if (size < pcapHeaderSize) {
+        printErr("'{}' is too short to be a pcap file", path);
+        return false;
+    }
+
+    uint32_t magic = 0;
+    std::memcpy(&magic, data, sizeof(magic));
+    const auto swapped = magic != pcapMagic && magic != pcapMagicNano;
+    const auto getInt = [data, swapped](size_t offset) {
+        uint32_t value = 0;
+        std::memcpy(&value, data + offset, sizeof(value));
+        return swapped ? swapBytes(value) : value;
+    };
+    const auto fractionScale = getInt(0) == pcapMagicNano ? 1e-9 : 1e-6;
+    const auto linkType = static_cast<LinkType>(getInt(20));
+    if (linkType != LinkType::Null && linkType != LinkType::Ethernet && linkType != LinkType::Raw
+        && linkType != LinkType::LinuxSll && linkType != LinkType::LinuxSll2) {
+        printErr("Unsupported link type: {}", static_cast<uint32_t>(linkType));
+        return false;
+    }
+
+    EnetDecoder decoder(analysis);
+    size_t offset = pcapHeaderSize, packets = 0, ignored = 0;
+    double lastTime = -1.0;
+    while (offset + pcapRecordHeaderSize <= size) {
+        const auto time = getInt(offset) + getInt(offset + 4) * fractionScale;
+        const auto capturedSize = getInt(offset + 8);
+        offset += pcapRecordHeaderSize;
+        if (capturedSize > size - offset) {
+            printErr("Capture is truncated");
+            break;
+        }
+        packets++;
+
+        const auto datagram = getDatagram(data + offset, capturedSize, linkType);
+        offset += capturedSize;
+        if (!datagram) {
+            ignored++;
+            continue;
+        }
+        if (datagram->receiverPort != serverPort && datagram->senderPort != serverPort) {
+            ignored++;
+            continue;
+        }
+        const auto direction = datagram->receiverPort == serverPort
+            ? TrafficAnalysis::Direction::ToServer
+            : TrafficAnalysis::Direction::ToClient;
+        if (lastTime >= 0.0 && std::abs(time - lastTime) > maxRecordGap) {
+            analysis.addUndecodable(direction);
+            continue;
+        }
+        lastTime = time;
+        decoder.decode(time, direction, datagram->sender, datagram->receiver, datagram->data,
+            datagram->size);
+    }
+    println("Read {} packets ({} of them not to or from port {})", packets, ignored, serverPort);
+    return true;
+}
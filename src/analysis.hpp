@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "net.hpp"
+
+// Collects where the bytes of a session go: per message type, per channel and per second, with
+// size histograms and the largest messages. The messages come either from replaying a recording
+// (see Server::replay) or from a pcap of the ENet traffic (see analyzePcap).
+class TrafficAnalysis {
+public:
+    enum class Direction { ToServer = 0, ToClient, Count };
+
+    // Powers of two from 16 bytes, the last one takes everything bigger
+    static constexpr size_t histogramBuckets = 14;
+    static constexpr size_t topMessageCount = 20;
+
+    // data is the message as it was passed to ENet (so maybe compressed), but not split into
+    // chunks. If it was multicast, it is counted once for every recipient.
+    void addMessage(double time, Direction direction, Channel channel, const uint8_t* data,
+        size_t size, size_t recipients = 1);
+
+    // Only available for captures: whole UDP datagrams (including ENet's headers)
+    void addDatagram(double time, Direction direction, size_t size);
+    void addRetransmit(Direction direction, size_t size);
+    void addRoundTrip(Direction direction, double rtt);
+    void addUndecodable(Direction direction);
+
+    std::string toJson(const std::string& source) const;
+
+    // A few lines for the console
+    void printSummary() const;
+
+private:
+    struct Counter {
+        size_t messages = 0;
+        size_t bytes = 0; // as sent
+        size_t rawBytes = 0; // after decompression
+
+        void add(size_t count, size_t size, size_t rawSize);
+    };
+
+    struct TypeStats {
+        Counter counter;
+        std::array<size_t, histogramBuckets> histogram {};
+    };
+
+    struct TopMessage {
+        double time;
+        Direction direction;
+        Channel channel;
+        MessageType type;
+        size_t size;
+    };
+
+    struct DirectionStats {
+        std::map<MessageType, TypeStats> types;
+        std::array<Counter, static_cast<size_t>(Channel::Count)> channels;
+        size_t datagrams = 0;
+        size_t datagramBytes = 0;
+        size_t retransmits = 0;
+        size_t retransmittedBytes = 0;
+        size_t undecodable = 0;
+        std::vector<double> roundTrips; // seconds
+    };
+
+    struct Second {
+        std::array<Counter, static_cast<size_t>(Direction::Count)> directions;
+    };
+
+    static size_t getBucket(size_t size);
+
+    DirectionStats& getStats(Direction direction);
+    Second& getSecond(double time);
+
+    std::array<DirectionStats, static_cast<size_t>(Direction::Count)> directions_;
+    std::vector<Second> seconds_;
+    std::vector<TopMessage> topMessages_; // a min-heap by size
+    double startTime_ = -1.0;
+};
+
+std::string asString(TrafficAnalysis::Direction direction);
+
+bool isPcapFile(const std::string& path);
+
+// serverPort tells apart which datagrams go to the server
+bool analyzePcap(const std::string& path, Port serverPort, TrafficAnalysis& analysis);
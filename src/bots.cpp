@@ -0,0 +1,381 @@
+#include "bots.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include "random.hpp"
+#include "util.hpp"
+
+namespace {
+constexpr auto connectTimeout = 5.0; // seconds
+// The server does not answer at all, if the terminal is already in use
+constexpr auto terminalTimeout = 2.0; // seconds
+constexpr auto reportInterval = 5.0; // seconds
+
+std::string formatLatencies(std::vector<double> latencies)
+{
+    if (latencies.empty())
+        return "-";
+    std::sort(latencies.begin(), latencies.end());
+    const auto p95 = latencies[static_cast<size_t>(std::round(0.95 * (latencies.size() - 1)))];
+    return fmt::format("{:.1f}/{:.1f}/{:.1f} ms", latencies[latencies.size() / 2] * 1000.0,
+        p95 * 1000.0, latencies.back() * 1000.0);
+}
+}
+
+std::optional<BotScript> BotScript::load(const std::string& path)
+{
+    sol::state lua;
+    const auto result = lua.safe_script_file(path, sol::script_pass_on_error);
+    if (!result.valid()) {
+        const sol::error err = result;
+        printErr("Could not load bot script '{}': {}", path, err.what());
+        return std::nullopt;
+    }
+    if (result.get_type() != sol::type::table) {
+        printErr("Bot script '{}' must return a table", path);
+        return std::nullopt;
+    }
+    const sol::table table = result;
+
+    BotScript script;
+    script.speed = table.get_or("speed", script.speed);
+    script.terminalInterval = table.get_or("terminalInterval", script.terminalInterval);
+    if (const sol::optional<sol::table> points = table["path"]) {
+        for (size_t i = 1; i <= points->size(); ++i) {
+            const sol::table point = (*points)[i];
+            script.path.emplace_back(
+                point[1].get<float>(), point[2].get<float>(), point[3].get<float>());
+        }
+    }
+    if (const sol::optional<sol::table> commands = table["commands"]) {
+        for (size_t i = 1; i <= commands->size(); ++i) {
+            const sol::table command = (*commands)[i];
+            script.commands.push_back(Command {
+                command["system"].get<std::string>(), command["command"].get<std::string>() });
+        }
+    }
+
+    if (script.path.empty())
+        script.path.emplace_back(0.0f);
+    if (script.speed < 0.0f || script.terminalInterval <= 0.0f) {
+        printErr("Speed and terminal interval in the bot script must be positive");
+        return std::nullopt;
+    }
+    return script;
+}
+
+BotSwarm::BotSwarm(const BotScript& script)
+    : script_(script)
+{
+    for (size_t i = 0; i < script_.path.size(); ++i)
+        pathLength_ += glm::distance(script_.path[i], script_.path[(i + 1) % script_.path.size()]);
+}
+
+bool BotSwarm::run(const HostPort& hostPort, uint32_t gameCode, size_t count, float duration)
+{
+    const auto addr = enet::getAddress(hostPort.host, hostPort.port);
+    if (!addr) {
+        printErr("Could not resolve address");
+        return false;
+    }
+
+    const auto start = getSteadyTime();
+    // Bots must never move in memory, their peers point to them
+    bots_.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto& bot = bots_.emplace_back();
+        bot.index = i;
+        bot.host = enet::Host(static_cast<uint8_t>(Channel::Count), 0, 0);
+        if (!bot.host) {
+            printErr("Could not create host for bot {}", i);
+            return false;
+        }
+        bot.peer = bot.host.connect(
+            *addr, static_cast<uint8_t>(Channel::Count), getConnectCode(gameCode));
+        if (!bot.peer) {
+            printErr("Could not connect bot {}", i);
+            return false;
+        }
+        bot.requestTime = start;
+        // So they don't all run the same command
+        bot.nextCommand = i;
+    }
+    println("Connecting {} bots to {}:{}..", count, hostPort.host, hostPort.port);
+
+    constexpr auto dt = 1.0f / tickRate;
+    auto now = start;
+    auto nextTick = start;
+    auto lastReport = start;
+    while (duration <= 0.0f || now - start < duration) {
+        now = getSteadyTime();
+        if (now < nextTick) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(nextTick - now));
+            continue;
+        }
+
+        for (auto& bot : bots_) {
+            processEvents(bot, now);
+            update(bot, now, dt);
+            bot.host.flush();
+        }
+        frameCounter_++;
+        // Don't try to catch up, if this process was stalled
+        nextTick = std::max(nextTick + dt, now - dt);
+
+        if (now - lastReport >= reportInterval) {
+            printStats(stats_, now - lastReport);
+            totalStats_.add(stats_);
+            stats_ = Stats {};
+            lastReport = now;
+        }
+
+        const auto disconnected = std::all_of(bots_.begin(), bots_.end(),
+            [](const Bot& bot) { return bot.state == BotState::Disconnected; });
+        if (disconnected) {
+            printErr("All bots are disconnected");
+            break;
+        }
+    }
+
+    totalStats_.add(stats_);
+    println("Total:");
+    printStats(totalStats_, now - start);
+    printCompressionStats(compressionStats_);
+
+    for (auto& bot : bots_) {
+        if (bot.state != BotState::Disconnected)
+            enet_peer_disconnect_now(bot.peer, 0);
+    }
+    return true;
+}
+
+void BotSwarm::Stats::add(const Stats& other)
+{
+    receivedMessages += other.receivedMessages;
+    receivedBytes += other.receivedBytes;
+    sentMessages += other.sentMessages;
+    sentBytes += other.sentBytes;
+    commands += other.commands;
+    failedTerminalUses += other.failedTerminalUses;
+    terminalLatencies.insert(
+        terminalLatencies.end(), other.terminalLatencies.begin(), other.terminalLatencies.end());
+    commandLatencies.insert(
+        commandLatencies.end(), other.commandLatencies.begin(), other.commandLatencies.end());
+}
+
+void BotSwarm::update(Bot& bot, double now, float dt)
+{
+    if (bot.state == BotState::Connecting && now - bot.requestTime > connectTimeout) {
+        printErr("Bot {} could not connect", bot.index);
+        enet_peer_reset(bot.peer);
+        bot.state = BotState::Disconnected;
+    }
+    if (bot.state == BotState::Connecting || bot.state == BotState::WaitingForHello
+        || bot.state == BotState::Disconnected)
+        return;
+
+    bot.pathDistance += script_.speed * dt;
+    const auto position = getPathPosition(bot.pathDistance);
+    const auto direction = getPathPosition(bot.pathDistance + 0.1f) - position;
+    auto orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    if (glm::length(direction) > 1e-5f) {
+        const auto yaw = std::atan2(-direction.x, -direction.z);
+        orientation = glm::angleAxis(yaw, glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+    send(bot, Channel::Unreliable,
+        Message<MessageType::ClientMoveUpdate> {
+            bot.spawnPosition + position, orientation, bot.snapshotAck });
+
+    if (bot.state == BotState::Walking) {
+        if (!script_.commands.empty() && now >= bot.nextTerminalUse)
+            useTerminal(bot, now);
+    } else if (now - bot.requestTime > terminalTimeout) {
+        finishTerminalUse(bot, now, false);
+    }
+}
+
+void BotSwarm::processEvents(Bot& bot, double now)
+{
+    for (auto event = bot.host.service(); event; event = bot.host.service()) {
+        if (std::holds_alternative<enet::ConnectEvent>(*event)) {
+            bot.state = BotState::WaitingForHello;
+        } else if (std::holds_alternative<enet::DisconnectEvent>(*event)) {
+            printErr("Bot {} was disconnected", bot.index);
+            bot.state = BotState::Disconnected;
+        } else if (const auto recvEvent = std::get_if<enet::ReceiveEvent>(&event.value())) {
+            receive(bot, now, recvEvent->channelId, recvEvent->packet);
+        } else if (const auto errEvent = std::get_if<enet::ServiceFailedEvent>(&event.value())) {
+            printErr("Host service failed for bot {}: {}", bot.index, errEvent->result);
+            return;
+        }
+    }
+}
+
+void BotSwarm::receive(Bot& bot, double now, uint8_t channelId, const enet::Packet& packet)
+{
+    if (channelId >= static_cast<uint8_t>(Channel::Count))
+        return;
+    const auto channel = static_cast<Channel>(channelId);
+    stats_.receivedMessages++;
+    stats_.receivedBytes += packet.getSize();
+    if (!isChunk(packet.getData<uint8_t>(), packet.getSize())) {
+        receiveMessage(bot, now, channel, packet.getData<uint8_t>(), packet.getSize());
+        return;
+    }
+    std::vector<uint8_t> message;
+    if (!bot.chunks.add(channel, packet.getData<uint8_t>(), packet.getSize(), message))
+        printErr("Invalid message chunk");
+    else if (!message.empty())
+        receiveMessage(bot, now, channel, message.data(), message.size());
+}
+
+void BotSwarm::receiveMessage(
+    Bot& bot, double now, Channel channel, const uint8_t* data, size_t size)
+{
+    std::optional<std::vector<uint8_t>> decompressed;
+    if (getChannelProperties(channel).compressed) {
+        decompressed
+            = decompressMessage(data, size, compressionStats_[static_cast<size_t>(channel)]);
+        if (!decompressed) {
+            printErr("Could not decompress message");
+            return;
+        }
+    }
+    ReadBuffer buffer = decompressed ? ReadBuffer(decompressed->data(), decompressed->size())
+                                     : ReadBuffer(data, size);
+    CommonMessageHeader header;
+    if (!deserialize(buffer, header)) {
+        printErr("Could not decode common message header");
+        return;
+    }
+
+    // Bots ignore everything that only matters for what a player sees or hears
+    switch (static_cast<MessageType>(header.messageType)) {
+    case MessageType::ServerHello: {
+        Message<MessageType::ServerHello> message;
+        if (!deserializeMessage(buffer, message))
+            return;
+        bot.id = message.playerId;
+        bot.spawnPosition = message.spawnPosition;
+        bot.systemNames = SymbolTable(message.systems);
+        bot.state = BotState::Walking;
+        // Spread out the terminal uses, so they don't come in waves
+        bot.nextTerminalUse = now + rand<float>() * script_.terminalInterval;
+        break;
+    }
+    case MessageType::ServerPlayerStateUpdate: {
+        Message<MessageType::ServerPlayerStateUpdate> message;
+        if (!deserializeMessage(buffer, message))
+            return;
+        auto snapshot = applyDelta(header.frameNumber, message, bot.snapshots);
+        if (!snapshot)
+            return;
+        bot.snapshots.add(std::move(*snapshot));
+        if (bot.snapshotAck == InvalidFrame || header.frameNumber > bot.snapshotAck)
+            bot.snapshotAck = header.frameNumber;
+        break;
+    }
+    case MessageType::ServerInteractTerminal: {
+        Message<MessageType::ServerInteractTerminal> message;
+        if (!deserializeMessage(buffer, message) || message.terminal != bot.terminal)
+            return;
+        if (bot.state != BotState::WaitingForTerminal) {
+            // Granted after the request timed out
+            if (message.user == bot.id && bot.state == BotState::Walking)
+                send(bot, Channel::Control,
+                    Message<MessageType::ClientInteractTerminal> { SymbolTable::InvalidId });
+            return;
+        }
+        if (message.user == bot.id) {
+            stats_.terminalLatencies.push_back(now - bot.requestTime);
+            bot.state = BotState::WaitingForResponse;
+            bot.requestTime = now;
+            send(bot, Channel::Control, Message<MessageType::ClientExecuteCommand> { bot.command });
+        } else if (message.user != InvalidPlayerId) {
+            finishTerminalUse(bot, now, false);
+        }
+        break;
+    }
+    case MessageType::ServerAddTerminalHistory: {
+        Message<MessageType::ServerAddTerminalHistory> message;
+        if (!deserializeMessage(buffer, message))
+            return;
+        // Only we can add to the history of the terminal we are using
+        const auto& commands = message.commands;
+        if (bot.state == BotState::WaitingForResponse && message.terminal == bot.terminal
+            && std::find(commands.begin(), commands.end(), bot.command) != commands.end()) {
+            stats_.commandLatencies.push_back(now - bot.requestTime);
+            stats_.commands++;
+            finishTerminalUse(bot, now, true);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void BotSwarm::useTerminal(Bot& bot, double now)
+{
+    const auto& command = script_.commands[bot.nextCommand % script_.commands.size()];
+    bot.nextCommand++;
+    const auto terminal = bot.systemNames.getId(command.system);
+    if (terminal == SymbolTable::InvalidId) {
+        printErr("Unknown system in bot script: '{}'", command.system);
+        bot.nextTerminalUse = now + script_.terminalInterval;
+        return;
+    }
+    bot.terminal = terminal;
+    bot.command = command.command;
+    bot.state = BotState::WaitingForTerminal;
+    bot.requestTime = now;
+    send(bot, Channel::Control, Message<MessageType::ClientInteractTerminal> { terminal });
+}
+
+void BotSwarm::finishTerminalUse(Bot& bot, double now, bool success)
+{
+    if (!success)
+        stats_.failedTerminalUses++;
+    // If the request timed out, the terminal might still be granted (see receive)
+    if (bot.state == BotState::WaitingForResponse)
+        send(bot, Channel::Control,
+            Message<MessageType::ClientInteractTerminal> { SymbolTable::InvalidId });
+    bot.state = BotState::Walking;
+    bot.nextTerminalUse = now + script_.terminalInterval;
+}
+
+glm::vec3 BotSwarm::getPathPosition(float distance) const
+{
+    if (pathLength_ <= 0.0f)
+        return script_.path[0];
+    distance = std::fmod(distance, pathLength_);
+    for (size_t i = 0; i < script_.path.size(); ++i) {
+        const auto& from = script_.path[i];
+        const auto& to = script_.path[(i + 1) % script_.path.size()];
+        const auto length = glm::distance(from, to);
+        if (distance <= length)
+            return glm::mix(from, to, length > 0.0f ? distance / length : 0.0f);
+        distance -= length;
+    }
+    return script_.path[0];
+}
+
+void BotSwarm::printStats(const Stats& stats, double duration) const
+{
+    const auto connected = std::count_if(bots_.begin(), bots_.end(), [](const Bot& bot) {
+        return bot.state != BotState::Connecting && bot.state != BotState::Disconnected;
+    });
+    println("{}/{} bots connected, in: {:.1f} KB/s ({:.0f} msg/s), out: {:.1f} KB/s ({:.0f} "
+            "msg/s)",
+        connected, bots_.size(), stats.receivedBytes / duration / 1024.0,
+        stats.receivedMessages / duration, stats.sentBytes / duration / 1024.0,
+        stats.sentMessages / duration);
+    println("  {} commands ({} failed), latency (median/p95/max) terminal: {}, command: {}",
+        stats.commands, stats.failedTerminalUses, formatLatencies(stats.terminalLatencies),
+        formatLatencies(stats.commandLatencies));
+}
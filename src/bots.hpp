@@ -0,0 +1,108 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "enet.hpp"
+#include "net.hpp"
+#include "snapshot.hpp"
+
+// What the bots do, loaded from a Lua file (media/bots.lua)
+struct BotScript {
+    struct Command {
+        std::string system;
+        std::string command;
+    };
+
+    float speed = 2.0f; // meters per second
+    std::vector<glm::vec3> path; // offsets from the spawn point, walked in a loop
+    float terminalInterval = 10.0f; // seconds between terminal uses
+    std::vector<Command> commands; // run one after the other, one per terminal use
+
+    static std::optional<BotScript> load(const std::string& path);
+};
+
+// Simulated players for load tests. They have no graphics, sound or physics, so many of them fit
+// into one process. Every bot has its own host (and socket), like a real client.
+// Bots walk their path and send a ClientMoveUpdate every tick, decode and acknowledge snapshots
+// and now and then grab a terminal to run a command. The time until the server answers is
+// measured and reported with the bandwidth.
+class BotSwarm {
+public:
+    BotSwarm(const BotScript& script);
+
+    // Runs for duration seconds or forever if it's 0
+    bool run(const HostPort& hostPort, uint32_t gameCode, size_t count, float duration);
+
+private:
+    enum class BotState {
+        Connecting,
+        WaitingForHello,
+        Walking,
+        WaitingForTerminal,
+        WaitingForResponse,
+        Disconnected,
+    };
+
+    struct Bot {
+        size_t index;
+        enet::Host host;
+        ENetPeer* peer = nullptr;
+        BotState state = BotState::Connecting;
+        PlayerId id = InvalidPlayerId;
+        glm::vec3 spawnPosition { 0.0f };
+        float pathDistance = 0.0f; // meters walked on the path
+        ChunkAssembler chunks;
+        SnapshotBuffer snapshots;
+        uint32_t snapshotAck = InvalidFrame;
+        SymbolTable systemNames;
+        size_t nextCommand = 0;
+        SystemId terminal = SymbolTable::InvalidId; // of the current or last terminal use
+        std::string command;
+        double nextTerminalUse = 0.0;
+        double requestTime = 0.0; // of the last terminal or command request
+    };
+
+    struct Stats {
+        size_t receivedMessages = 0;
+        size_t receivedBytes = 0;
+        size_t sentMessages = 0;
+        size_t sentBytes = 0;
+        size_t commands = 0;
+        size_t failedTerminalUses = 0;
+        std::vector<double> terminalLatencies; // until ServerInteractTerminal, in seconds
+        std::vector<double> commandLatencies; // until ServerAddTerminalHistory, in seconds
+
+        void add(const Stats& other);
+    };
+
+    void update(Bot& bot, double now, float dt);
+    void processEvents(Bot& bot, double now);
+    void receive(Bot& bot, double now, uint8_t channelId, const enet::Packet& packet);
+    // A whole message (after putting chunks back together)
+    void receiveMessage(Bot& bot, double now, Channel channel, const uint8_t* data, size_t size);
+    void useTerminal(Bot& bot, double now);
+    void finishTerminalUse(Bot& bot, double now, bool success);
+    glm::vec3 getPathPosition(float distance) const;
+    void printStats(const Stats& stats, double duration) const;
+
+    template <MessageType MsgType>
+    void send(Bot& bot, Channel channel, const Message<MsgType>& message)
+    {
+        const auto buffer = serializeMessage(frameCounter_, message);
+        stats_.sentMessages++;
+        stats_.sentBytes += buffer.getSize();
+        sendBuffer(bot.peer, channel, buffer);
+    }
+
+    BotScript script_;
+    float pathLength_ = 0.0f;
+    std::vector<Bot> bots_;
+    Stats stats_; // since the last report
+    Stats totalStats_;
+    LaneCompressionStats compressionStats_;
+    uint32_t frameCounter_ = 1; // the server ignores move updates of frame 0
+};
@@ -1,6 +1,9 @@
 #include "client.hpp"
 
+#include <cfloat>
+#include <functional>
 #include <regex>
+#include <utility>
 
 #include <imgui.h>
 #include <misc/cpp/imgui_stdlib.h>
@@ -25,6 +28,21 @@ namespace {
 static bool debugCollisionGeometry = false;
 static bool debugRaycast = false;
 static bool debugFrustumCulling = false;
+
+// Movement is only sent when it changes and this often otherwise, so the server still gets
+// snapshot acknowledgements (well before the baseline falls out of the snapshot buffer).
+static constexpr auto heartbeatInterval = 0.25f;
+// Without input commands only the latest position matters, so instead of repeating older ones,
+// the last one is repeated this many times after the player stops moving.
+static constexpr size_t redundantMoveUpdates = 4;
+
+// Connecting is retried with exponential backoff, if the server does not answer in time
+static constexpr size_t maxConnectAttempts = 4;
+static constexpr auto connectTimeout = 3.0f; // per attempt, until ServerHello
+static constexpr auto initialRetryDelay = 0.5f; // doubled with every retry
+// How long to wait for the server when there is nothing else to do
+static constexpr uint32_t connectionPollInterval = 10; // ms
+static constexpr auto maxConnectionUpdateGap = 0.1f;
 }
 
 struct Config {
@@ -179,7 +197,8 @@ void Client::showError(const std::string& message)
     }
 }
 
-bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode)
+bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode,
+    const enet::NetworkConditions& networkConditions)
 {
     assert(!started_);
     started_ = true;
@@ -203,10 +222,6 @@ bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode)
 
     initImgui(window_.getSdlWindow(), window_.getSdlGlContext());
 
-    if (!initSound()) {
-        return false;
-    }
-
     InputManager::instance().update(); // Initialize data for first frame
 
 #ifndef NDEBUG
@@ -214,127 +229,50 @@ bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode)
     // glwx::debug::init();
 #endif
 
-    drawImgui(window_.getSdlWindow(), [this]() {
-        ImGui::Begin("Loading..");
-        ImGui::TextUnformatted("Loading..");
-        ImGui::End();
-    });
-    window_.swap();
-
-    skybox_ = std::make_unique<Skybox>();
-    if (!skybox_->load("media/skybox/1.png", "media/skybox/3.png", "media/skybox/5.png",
-            "media/skybox/6.png", "media/skybox/2.png", "media/skybox/4.png")) {
-        printErr("Could not load 'media/skybox'");
-        return false;
-    };
-
-    auto shipGltf = GltfFile::load("media/ship.glb");
-    if (!shipGltf) {
-        printErr("Could not load 'media/ship.glb'");
-        return false;
-    }
-    shipGltf->instantiate(world_);
-
-    auto playerGltf = GltfFile::load("media/player.glb");
-    if (!playerGltf) {
-        printErr("Could not load 'media/player.glb'");
-        return false;
-    }
-
-    static constexpr std::array playerMeshNames
-        = { "alien_mesh.001", "hacker_mesh.001", "muscle_mesh.001", "robot_mesh.001" };
-    for (const auto& name : playerMeshNames) {
-        auto mesh = playerGltf->getMesh(name);
-        if (!mesh) {
-            printErr("Mesh '{}' not found in player.glb", name);
-            return false;
-        }
-        playerMeshes_.push_back(mesh);
-    }
-
-    auto hitMarkerGltf = GltfFile::load("media/marker.glb");
-    if (!hitMarkerGltf) {
-        printErr("Could not load 'media/marker.glb");
-        return false;
-    }
-    hitMarker_ = world_.createEntity();
-    hitMarker_.add<comp::Transform>();
-    hitMarker_.add<comp::Mesh>(hitMarkerGltf->getMesh("Sphere"));
-
-    player_ = world_.createEntity();
-    player_.add<comp::Transform>();
-    player_.add<comp::Velocity>();
-    player_.add<comp::CylinderCollider>(comp::CylinderCollider { playerRadius, cameraOffsetY });
-    player_.add<comp::PlayerInputController>(SDL_SCANCODE_W, SDL_SCANCODE_S, SDL_SCANCODE_A,
-        SDL_SCANCODE_D, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_LSHIFT, MouseButtonInput(1));
-
-    world_.flush();
-
-    // We load everything else before attempting to connect, because we don't want a connection
-    // to time out or something.
-
     if (!hostPort) {
         gameCode = showConnectCodeMenu(hostPort);
         if (!hostPort)
             return true;
     }
-    resized(window_.getSize().x, window_.getSize().y);
 
-    host_ = enet::Host(static_cast<uint8_t>(Channel::Count), 0, 0);
-    if (!host_) {
-        showError("Could not create client host.");
+    // The handshake happens while everything is loading, so being ready to play takes as long as
+    // the slower of both instead of their sum.
+    if (!startConnecting(*hostPort, gameCode, networkConditions)) {
+        showError(connectionError_);
         return false;
     }
 
-    const auto addr = enet::getAddress(hostPort->host, hostPort->port);
-    if (!addr) {
-        showError("Could not resolve address.");
+    if (!load())
         return false;
-    }
-
-    serverPeer_ = host_.connect(*addr, 2, getConnectCode(gameCode));
-    if (!serverPeer_) {
-        showError("Could not connect.");
-        return false;
-    }
-    println("Connecting to {}:{}..", enet::getIp(*addr), addr->port);
-
-    // TODO: MAKE THIS NOT BLOCK
-    const auto event = host_.service(5000);
-    if (event && std::holds_alternative<enet::ConnectEvent>(*event)) {
-        println("Connected.");
-    } else {
-        showError("Connection failed.");
-        enet_peer_reset(serverPeer_);
-        return false;
-    }
+    resized(window_.getSize().x, window_.getSize().y);
 
-    // Aaah, yes. Asscode.
-    const auto waitHelloStart = glwx::getTime();
-    while (glwx::getTime() - waitHelloStart < 2.0f) {
-        std::optional<enet::Event> event;
-        while ((event = host_.service())) {
-            if (const auto recvEvent = std::get_if<enet::ReceiveEvent>(&event.value())) {
-                receive(recvEvent->channelId, recvEvent->packet);
-            } else if (const auto disconnect = std::get_if<enet::DisconnectEvent>(&event.value())) {
-                const auto serverVersion = disconnect->data;
-                if (version != serverVersion) {
-                    showError(fmt::format(
-                        "Mismatching versions (client: {}, server: {}).", version, serverVersion));
-                } else {
-                    showError("Wrong gamecode.");
-                }
-                return false;
+    while (connectionState_ != ConnectionState::Connected
+        && connectionState_ != ConnectionState::Failed) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event) != 0) {
+            ImGui_ImplSDL2_ProcessEvent(&event);
+            if (event.type == SDL_QUIT) {
+                enet_peer_disconnect_now(serverPeer_, 0);
+                deinitImgui();
+                deinitSound();
+                return true;
             }
         }
-        if (playerId_ != InvalidPlayerId)
-            break;
+        updateConnection(connectionPollInterval);
+        drawLoadingScreen("Loading done", 1.0f);
     }
-    if (playerId_ == InvalidPlayerId) {
-        showError("Handshake failed.");
-        enet_peer_disconnect_now(serverPeer_, 0);
+    if (connectionState_ == ConnectionState::Failed) {
+        showError(connectionError_);
         return false;
     }
+
+    // Snapshots are stale by now and the server keeps sending full ones until one is
+    // acknowledged, so only the reliable messages are needed.
+    for (auto& [channelId, packet] : std::exchange(pendingPackets_, {})) {
+        if (static_cast<Channel>(channelId) != Channel::Unreliable)
+            handlePacket(channelId, std::move(packet));
+    }
+    assert(playerId_ != InvalidPlayerId);
     println("Player id: {}", playerId_);
 
     soloud.setLooping(playEntitySound("engineIdle", "engine"), true);
@@ -352,10 +290,11 @@ bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode)
         const auto clockDelta = now - clockTime;
         clockTime = now;
 
-        accumulator += clockDelta;
+        accumulator += clockDelta * alignTicks(accumulator);
         while (accumulator >= dt) {
             processSdlEvents();
             processEnetEvents();
+            telemetry_.update(*serverPeer_, getSteadyTime());
             update(dt);
             sendUpdate();
             accumulator -= dt;
@@ -363,15 +302,17 @@ bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode)
             frameCounter_++;
         }
 
+        interpolateRemotePlayers();
         draw();
 
         fps++;
         if (nextFps < now) {
             const auto stats = glw::State::instance().getStatistics();
             const auto title = fmt::format(
-                "ARBITRARY COMPLEXITY v{} - FPS: {}, draw calls: {}, shader "
+                "ARBITRARY COMPLEXITY v{} - FPS: {}, RTT: {:.0f} ms, draw calls: {}, shader "
                 "binds: {}, texture binds: {}",
-                version, fps, getRenderStats().drawCalls, stats.shaderBinds, stats.textureBinds);
+                version, fps, clockSync_.getRoundTripTime() * 1000.0, getRenderStats().drawCalls,
+                stats.shaderBinds, stats.textureBinds);
             window_.setTitle(title);
             nextFps = now + 1.0f;
             fps = 0;
@@ -380,6 +321,8 @@ bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode)
 
     enet_peer_disconnect_now(serverPeer_, 0);
 
+    printCompressionStats(compressionStats_);
+
     deinitImgui();
 
     deinitSound();
@@ -387,6 +330,236 @@ bool Client::run(std::optional<HostPort> hostPort, uint32_t gameCode)
     return true;
 }
 
+bool Client::load()
+{
+    std::optional<GltfFile> playerGltf;
+    std::optional<GltfFile> hitMarkerGltf;
+    const std::vector<std::pair<std::string, std::function<bool()>>> steps {
+        { "Loading sounds..", []() { return initSound(); } },
+        { "Loading skybox..",
+            [this]() {
+                skybox_ = std::make_unique<Skybox>();
+                if (!skybox_->load("media/skybox/1.png", "media/skybox/3.png",
+                        "media/skybox/5.png", "media/skybox/6.png", "media/skybox/2.png",
+                        "media/skybox/4.png")) {
+                    printErr("Could not load 'media/skybox'");
+                    return false;
+                }
+                return true;
+            } },
+        { "Loading ship..",
+            [this]() {
+                auto shipGltf = GltfFile::load("media/ship.glb");
+                if (!shipGltf) {
+                    printErr("Could not load 'media/ship.glb'");
+                    return false;
+                }
+                shipGltf->instantiate(world_);
+                return true;
+            } },
+        { "Loading players..",
+            [this, &playerGltf]() {
+                playerGltf = GltfFile::load("media/player.glb");
+                if (!playerGltf) {
+                    printErr("Could not load 'media/player.glb'");
+                    return false;
+                }
+                static constexpr std::array playerMeshNames = { "alien_mesh.001",
+                    "hacker_mesh.001", "muscle_mesh.001", "robot_mesh.001" };
+                for (const auto& name : playerMeshNames) {
+                    auto mesh = playerGltf->getMesh(name);
+                    if (!mesh) {
+                        printErr("Mesh '{}' not found in player.glb", name);
+                        return false;
+                    }
+                    playerMeshes_.push_back(mesh);
+                }
+                return true;
+            } },
+        { "Loading markers..",
+            [this, &hitMarkerGltf]() {
+                hitMarkerGltf = GltfFile::load("media/marker.glb");
+                if (!hitMarkerGltf) {
+                    printErr("Could not load 'media/marker.glb");
+                    return false;
+                }
+                hitMarker_ = world_.createEntity();
+                hitMarker_.add<comp::Transform>();
+                hitMarker_.add<comp::Mesh>(hitMarkerGltf->getMesh("Sphere"));
+                return true;
+            } },
+    };
+
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const auto& [name, step] = steps[i];
+        drawLoadingScreen(name, static_cast<float>(i) / steps.size());
+        if (!step())
+            return false;
+        // ENet only makes progress when it is serviced
+        updateConnection();
+        if (connectionState_ == ConnectionState::Failed) {
+            showError(connectionError_);
+            return false;
+        }
+    }
+
+    player_ = world_.createEntity();
+    player_.add<comp::Transform>();
+    player_.add<comp::Velocity>();
+    player_.add<comp::CylinderCollider>(comp::CylinderCollider { playerRadius, cameraOffsetY });
+    player_.add<comp::PlayerInputController>(SDL_SCANCODE_W, SDL_SCANCODE_S, SDL_SCANCODE_A,
+        SDL_SCANCODE_D, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_LSHIFT, MouseButtonInput(1));
+
+    world_.flush();
+    return true;
+}
+
+void Client::drawLoadingScreen(const std::string& step, float progress)
+{
+    drawImgui(window_.getSdlWindow(), [this, &step, progress]() {
+        ImGui::Begin("Loading..");
+        ImGui::TextUnformatted(step.c_str());
+        ImGui::ProgressBar(progress, ImVec2(300.0f, 0.0f));
+        ImGui::TextUnformatted(getConnectionStatus().c_str());
+        ImGui::End();
+    });
+    window_.swap();
+}
+
+bool Client::startConnecting(
+    const HostPort& hostPort, uint32_t gameCode, const enet::NetworkConditions& networkConditions)
+{
+    host_ = enet::Host(static_cast<uint8_t>(Channel::Count), 0, 0);
+    if (!host_) {
+        connectionError_ = "Could not create client host.";
+        return false;
+    }
+    if (!host_.simulate(networkConditions)) {
+        connectionError_ = "Could not start network simulation.";
+        return false;
+    }
+
+    const auto addr = enet::getAddress(hostPort.host, hostPort.port);
+    if (!addr) {
+        connectionError_ = "Could not resolve address.";
+        return false;
+    }
+    serverAddress_ = *addr;
+    serverName_ = fmt::format("{}:{}", enet::getIp(*addr).value_or(hostPort.host), addr->port);
+    connectCode_ = getConnectCode(gameCode);
+    connectAttempt();
+    return connectionState_ != ConnectionState::Failed;
+}
+
+void Client::connectAttempt()
+{
+    connectAttempts_++;
+    pendingPackets_.clear();
+    serverPeer_
+        = host_.connect(serverAddress_, static_cast<uint8_t>(Channel::Count), connectCode_);
+    if (!serverPeer_) {
+        failConnection("Could not connect.");
+        return;
+    }
+    println("Connecting to {} (attempt {}/{})..", serverName_, connectAttempts_,
+        maxConnectAttempts);
+    connectionState_ = ConnectionState::Connecting;
+    connectionStateTime_ = glwx::getTime();
+    lastConnectionUpdate_ = connectionStateTime_;
+}
+
+void Client::retryConnect(const std::string& reason)
+{
+    // This also tells the server to free the slot, if it got that far
+    enet_peer_disconnect_now(serverPeer_, 0);
+    if (connectAttempts_ >= maxConnectAttempts) {
+        failConnection(reason);
+        return;
+    }
+    const auto delay = initialRetryDelay * static_cast<float>(1 << (connectAttempts_ - 1));
+    printErr("{} Retrying in {:.1f}s", reason, delay);
+    connectionState_ = ConnectionState::WaitingForRetry;
+    connectionStateTime_ = glwx::getTime() + delay;
+}
+
+void Client::failConnection(const std::string& error)
+{
+    printErr("{}", error);
+    connectionState_ = ConnectionState::Failed;
+    connectionError_ = error;
+}
+
+void Client::updateConnection(uint32_t timeoutMs)
+{
+    if (connectionState_ == ConnectionState::Failed)
+        return;
+    const auto now = glwx::getTime();
+    if (connectionState_ == ConnectionState::WaitingForRetry) {
+        if (now >= connectionStateTime_)
+            connectAttempt();
+        lastConnectionUpdate_ = now;
+        return;
+    }
+    // Loading blocks between updates and the server can not answer while ENet is not serviced,
+    // so that time does not count towards the timeout.
+    connectionStateTime_ += std::max(now - lastConnectionUpdate_ - maxConnectionUpdateGap, 0.0f);
+    lastConnectionUpdate_ = now;
+
+    // With network simulation service returns early, when it has to release delayed packets
+    for (auto event = host_.service(timeoutMs); event; event = host_.service()) {
+        if (std::holds_alternative<enet::ConnectEvent>(*event)) {
+            println("Connected.");
+            connectionState_ = ConnectionState::WaitingForHello;
+        } else if (const auto disconnect = std::get_if<enet::DisconnectEvent>(&event.value())) {
+            // The server rejects connect codes with its version, a timeout has no data
+            const auto serverVersion = disconnect->data;
+            if (connectionState_ == ConnectionState::Connected) {
+                failConnection("Disconnected by server.");
+            } else if (serverVersion == 0) {
+                retryConnect("Connection failed.");
+            } else if (serverVersion != version) {
+                failConnection(fmt::format(
+                    "Mismatching versions (client: {}, server: {}).", version, serverVersion));
+            } else {
+                failConnection("Wrong gamecode.");
+            }
+            return;
+        } else if (const auto recvEvent = std::get_if<enet::ReceiveEvent>(&event.value())) {
+            // ServerHello is the first message on the control lane. Everything is processed
+            // once loading is done.
+            if (static_cast<Channel>(recvEvent->channelId) == Channel::Control
+                && connectionState_ == ConnectionState::WaitingForHello)
+                connectionState_ = ConnectionState::Connected;
+            pendingPackets_.emplace_back(recvEvent->channelId, std::move(recvEvent->packet));
+        }
+    }
+
+    if (connectionState_ != ConnectionState::Connected
+        && now - connectionStateTime_ > connectTimeout)
+        retryConnect(connectionState_ == ConnectionState::Connecting ? "Connection timed out."
+                                                                     : "Handshake failed.");
+}
+
+std::string Client::getConnectionStatus() const
+{
+    switch (connectionState_) {
+    case ConnectionState::Connecting:
+        return fmt::format("Connecting to {} (attempt {}/{})..", serverName_, connectAttempts_,
+            maxConnectAttempts);
+    case ConnectionState::WaitingForHello:
+        return fmt::format("Waiting for {}..", serverName_);
+    case ConnectionState::WaitingForRetry:
+        return fmt::format("Could not connect to {}, retrying in {:.1f}s..", serverName_,
+            std::max(connectionStateTime_ - glwx::getTime(), 0.0f));
+    case ConnectionState::Connected:
+        return fmt::format("Connected to {}", serverName_);
+    case ConnectionState::Failed:
+        return connectionError_;
+    default:
+        return "";
+    }
+}
+
 void Client::resized(size_t width, size_t height)
 {
     glw::State::instance().setViewport(width, height);
@@ -399,7 +572,8 @@ void Client::stopTerminalInteraction()
     const auto& terminalState = std::get<TerminalState>(state_);
     playEntitySound("terminalInteractEnd", terminalState.terminalEntity);
     state_ = MoveState {};
-    send(Channel::Reliable, Message<MessageType::ClientInteractTerminal> { "" });
+    send(Channel::Control,
+        Message<MessageType::ClientInteractTerminal> { SymbolTable::InvalidId });
 }
 
 void Client::scrollTerminal(float amount)
@@ -460,7 +634,7 @@ void Client::processSdlEvents()
                     break;
                 case SDL_SCANCODE_RETURN:
                     if (termData.inputEnabled) {
-                        send(Channel::Reliable,
+                        send(Channel::Control,
                             Message<MessageType::ClientExecuteCommand> { termData.input });
                         termData.input = "";
                         playEntitySound("terminalExecute", terminalState->terminalEntity);
@@ -476,6 +650,9 @@ void Client::processSdlEvents()
                 }
             }
             switch (event.key.keysym.scancode) {
+            case SDL_SCANCODE_F3:
+                showTelemetry_ = !showTelemetry_;
+                break;
             case SDL_SCANCODE_S:
                 if (event.key.keysym.mod & KMOD_CTRL) {
                     const auto mode = SDL_GetRelativeMouseMode() == SDL_TRUE ? SDL_FALSE : SDL_TRUE;
@@ -535,7 +712,7 @@ void Client::processEnetEvents()
     std::optional<enet::Event> event;
     while ((event = host_.service())) {
         if (const auto recvEvent = std::get_if<enet::ReceiveEvent>(&event.value())) {
-            receive(recvEvent->channelId, recvEvent->packet);
+            handlePacket(recvEvent->channelId, std::move(recvEvent->packet));
         } else if (const auto disconnect = std::get_if<enet::DisconnectEvent>(&event.value())) {
             printErr("Disconnected by server: {}", disconnect->data);
             running_ = false;
@@ -543,6 +720,18 @@ void Client::processEnetEvents()
     }
 }
 
+void Client::handlePacket(uint8_t channelId, enet::Packet&& packet)
+{
+    // Only the control lane is ordered with ServerHello, which the other reliable messages
+    // depend on (e.g. for the symbol tables).
+    const auto channel = static_cast<Channel>(channelId);
+    if (playerId_ == InvalidPlayerId && channel != Channel::Control
+        && channel != Channel::Unreliable)
+        earlyPackets_.emplace_back(channelId, std::move(packet));
+    else
+        receive(channelId, packet);
+}
+
 void Client::handleInteractions()
 {
     world_.forEachEntity<const comp::RenderHighlight>(
@@ -570,35 +759,17 @@ void Client::handleInteractions()
                     == InvalidPlayerId;
             linked->entity.add<comp::RenderHighlight>(comp::RenderHighlight { canInteract });
             if (interactPressed) {
-                if (const auto ladder = hit->entity.getPtr<comp::Ladder>()) {
-                    // Sometimes we use a ladder, when we are too far away from it and end up
-                    // teleporting into a wall.
-                    // So first move closer to the ladder (along the ray, but don't change
-                    // height).
-                    const auto& collider = player_.get<comp::CylinderCollider>();
-                    const auto dir = glm::vec3(rayDir.x, 0.0f, rayDir.z);
-                    while (!findFirstCollision(world_, player_, trafo, collider)) {
-                        trafo.move(dir * 0.05f);
-                    }
-
-                    const auto deltaY = ladder->dir == comp::Ladder::Dir::Up ? 1.0f : -1.0f;
-                    const auto delta = glm::vec3(0.0f, deltaY * floorHeight, 0.0f);
-                    const auto startPos = trafo.getPosition();
-                    const auto targetPos = trafo.getPosition() + delta;
-                    trafo.setPosition(targetPos);
-
-                    // Play sound in the middle of the ladder, so you can hear them equally well
-                    // leaving or coming
-                    const auto soundPos = (startPos + targetPos) * 0.5f;
-                    playNetSound("ladderInteract", soundPos);
-                    play3dSound("ladderInteract", soundPos);
+                // In input command mode ladders are used in simulateInput
+                if (hit->entity.has<comp::Ladder>() && !inputCommands_) {
+                    if (const auto climb = useLadder(world_, player_))
+                        playLadderSound(*climb);
                 }
             }
         }
         if (auto terminal = hit->entity.getPtr<comp::Terminal>()) {
-            if (interactPressed) {
-                send(Channel::Reliable,
-                    Message<MessageType::ClientInteractTerminal> { terminal->systemName });
+            const auto system = systemNames_.getId(terminal->systemName);
+            if (interactPressed && system != SymbolTable::InvalidId) {
+                send(Channel::Control, Message<MessageType::ClientInteractTerminal> { system });
                 hit->entity.get<comp::VisualLink>().entity.remove<comp::RenderHighlight>();
                 playEntitySound("terminalInteract", hit->entity);
             }
@@ -626,7 +797,38 @@ SoLoud::handle Client::playEntitySound(
 
 void Client::playNetSound(const std::string& name, const glm::vec3& position)
 {
-    send(Channel::Reliable, Message<MessageType::ClientPlaySound> { name, position });
+    const auto sound = soundNames_.getId(name);
+    if (sound == SymbolTable::InvalidId) {
+        printErr("Sound '{}' is unknown to the server", name);
+        return;
+    }
+    send(Channel::Event, Message<MessageType::ClientPlaySound> { sound, position });
+}
+
+float Client::alignTicks(float accumulator)
+{
+    if (!clockSync_.isValid())
+        return 1.0f;
+
+    // Ticks should happen a little ahead of the server, so inputs for a frame arrive before the
+    // server simulates it.
+    static constexpr auto tickLead = 2.0; // frames
+    // If the client is further behind than this, it just skips ahead. Going back is not allowed,
+    // because the server drops messages with old frame numbers.
+    static constexpr auto maxFrameError = 30.0;
+    // The tick rate is adjusted by up to this much to catch up or fall back gradually
+    static constexpr auto maxSpeedAdjustment = 0.05;
+
+    const auto serverFrame = clockSync_.getServerFrame(getSteadyTime());
+    const auto target = serverFrame + clockSync_.getRoundTripTime() * 0.5 * tickRate + tickLead;
+    const auto current = frameCounter_ + accumulator * tickRate;
+    const auto error = target - current;
+    if (error > maxFrameError) {
+        frameCounter_ = static_cast<uint32_t>(target);
+        return 1.0f;
+    }
+    return static_cast<float>(
+        1.0 + std::clamp(error * 0.02, -maxSpeedAdjustment, maxSpeedAdjustment));
 }
 
 void Client::update(float dt)
@@ -634,9 +836,15 @@ void Client::update(float dt)
     InputManager::instance().update();
     if (const auto move = std::get_if<MoveState>(&state_)) {
         playerLookSystem(world_, dt);
-        playerControlSystem(world_, dt);
-        integrationSystem(world_, dt);
-        handleInteractions();
+        if (inputCommands_) {
+            handleInteractions();
+            const auto& ctrl = player_.get<comp::PlayerInputController>();
+            predictInput(getMoveInput(ctrl, player_.get<comp::Transform>()), {}, dt);
+        } else {
+            playerControlSystem(world_, dt);
+            integrationSystem(world_, dt);
+            handleInteractions();
+        }
 
         const auto& trafo = player_.get<comp::Transform>();
         auto& velocity = player_.get<comp::Velocity>().value;
@@ -654,27 +862,10 @@ void Client::update(float dt)
         updateListener(player_.get<comp::Transform>(), -player_.get<comp::Velocity>().value);
     } else if (const auto terminal = std::get_if<TerminalState>(&state_)) {
         auto& trafo = player_.get<comp::Transform>();
-        const auto& termTrafo = terminal->terminalEntity.get<comp::Transform>();
-        const auto targetDist = 2.5f;
-        auto targetPos = termTrafo.getPosition() - termTrafo.getForward() * targetDist;
-        targetPos.y = trafo.getPosition().y;
-        const auto delta = targetPos - trafo.getPosition();
-        const auto dist = glm::length(delta) + 1e-5f;
-        const auto dir = delta / dist;
-        const auto moveSpeed = 5.0f;
-        trafo.move(dir * std::min(dist, moveSpeed * dt));
-
-        // Logically this is not very clean at all, but it looks better than the alternatives I have
-        // tried, so it is what I will use.
-        const auto currentLookPos = trafo.getPosition() + trafo.getForward() * targetDist;
-        auto targetLookPos = termTrafo.getPosition();
-        targetLookPos.y = trafo.getPosition().y;
-        const auto lookPosDelta = targetLookPos - currentLookPos;
-        const auto lookPosDist = glm::length(lookPosDelta) + 1e-5f;
-        const auto lookPosDeltaDir = lookPosDelta / lookPosDist;
-        const auto lookAtPos
-            = currentLookPos + lookPosDeltaDir * std::min(lookPosDist, moveSpeed * 2.0f * dt);
-        trafo.lookAt(lookAtPos);
+        if (inputCommands_)
+            predictInput(MoveInput { 0, trafo.getOrientation() }, terminal->terminalEntity, dt);
+        else
+            approachTerminal(trafo, terminal->terminalEntity.get<comp::Transform>(), dt);
 
         auto& ctrl = player_.get<comp::PlayerInputController>();
         ctrl.updateFromOrientation(trafo);
@@ -711,10 +902,120 @@ void Client::update(float dt)
 }
 
 void Client::sendUpdate()
+{
+    const auto now = getSteadyTime();
+    if (clockSync_.isRequestDue(now)) {
+        send(Channel::Unreliable, Message<MessageType::ClientTimeSync> { getTimeSyncStamp(now) });
+        clockSync_.requestSent(now);
+    }
+
+    if (inputCommands_) {
+        sendInputs();
+    } else {
+        sendMoveUpdate();
+    }
+}
+
+void Client::sendInputs()
+{
+    const auto newInput = !predictedInputs_.empty()
+        && (lastSentInput_ == InvalidInputSequence
+            || predictedInputs_.back().sequence > lastSentInput_);
+    if (!newInput && time_ < nextHeartbeat_)
+        return;
+
+    // predictedInputs_ only contains inputs the server has not acknowledged yet
+    Message<MessageType::ClientInputCommand> message { lastSentInput_, {}, snapshotAck_ };
+    const auto count = std::min(predictedInputs_.size(), maxRedundantInputs);
+    for (auto it = predictedInputs_.end() - count; it != predictedInputs_.end(); ++it)
+        message.inputs.push_back({ it->input.buttons, it->input.orientation });
+    if (!predictedInputs_.empty())
+        message.sequence = lastSentInput_ = predictedInputs_.back().sequence;
+    send(Channel::Unreliable, message);
+    nextHeartbeat_ = time_ + heartbeatInterval;
+}
+
+void Client::sendMoveUpdate()
 {
     const auto& trafo = player_.get<comp::Transform>();
+    if (trafo.getPosition() != lastSentPosition_ || trafo.getOrientation() != lastSentOrientation_)
+        moveUpdateRepeats_ = redundantMoveUpdates;
+    else if (moveUpdateRepeats_ == 0 && time_ < nextHeartbeat_)
+        return;
+
     send(Channel::Unreliable,
-        Message<MessageType::ClientMoveUpdate> { trafo.getPosition(), trafo.getOrientation() });
+        Message<MessageType::ClientMoveUpdate> {
+            trafo.getPosition(), trafo.getOrientation(), snapshotAck_ });
+    lastSentPosition_ = trafo.getPosition();
+    lastSentOrientation_ = trafo.getOrientation();
+    if (moveUpdateRepeats_ > 0)
+        moveUpdateRepeats_--;
+    nextHeartbeat_ = time_ + heartbeatInterval;
+}
+
+void Client::playLadderSound(const LadderClimb& climb)
+{
+    // Play sound in the middle of the ladder, so you can hear them equally well leaving or coming
+    const auto soundPos = (climb.start + climb.end) * 0.5f;
+    playNetSound("ladderInteract", soundPos);
+    play3dSound("ladderInteract", soundPos);
+}
+
+void Client::predictInput(const MoveInput& input, ecs::EntityHandle terminal, float dt)
+{
+    // If the server does not acknowledge anything for this long, something is broken anyway
+    static constexpr size_t maxPredictedInputs = tickRate * 2;
+
+    const auto& trafo = player_.get<comp::Transform>();
+    const auto& velocity = player_.get<comp::Velocity>().value;
+    const auto position = trafo.getPosition();
+    const auto orientation = trafo.getOrientation();
+    const auto lastVelocity = velocity;
+
+    predictedInputs_.push_back(PredictedInput { nextInputSequence_, input, terminal });
+    if (const auto climb = simulateInput(predictedInputs_.back(), dt))
+        playLadderSound(*climb);
+
+    // Inputs that do not change anything are neither kept nor sent, so idle players do not send
+    // anything but heartbeats. The server would not have done anything with them either.
+    const auto changed = input.buttons != 0 || input.orientation != lastInputOrientation_
+        || trafo.getPosition() != position || trafo.getOrientation() != orientation
+        || velocity != lastVelocity;
+    if (!changed) {
+        predictedInputs_.pop_back();
+        return;
+    }
+
+    nextInputSequence_++;
+    lastInputOrientation_ = input.orientation;
+    if (predictedInputs_.size() > maxPredictedInputs)
+        predictedInputs_.pop_front();
+}
+
+std::optional<LadderClimb> Client::simulateInput(const PredictedInput& input, float dt)
+{
+    if (input.terminal) {
+        auto terminal = input.terminal;
+        approachTerminal(player_.get<comp::Transform>(), terminal.get<comp::Transform>(), dt);
+        return std::nullopt;
+    }
+    return simulatePlayer(world_, player_, input.input, dt);
+}
+
+void Client::reconcile(const PlayerSnapshot& state, uint32_t inputAck, const glm::vec3& velocity)
+{
+    while (!predictedInputs_.empty() && predictedInputs_.front().sequence <= inputAck)
+        predictedInputs_.pop_front();
+
+    // Replay everything the server has not simulated yet on top of its state. The orientation is
+    // not corrected, because it is entirely up to the client.
+    auto& trafo = player_.get<comp::Transform>();
+    const auto orientation = trafo.getOrientation();
+    trafo.setPosition(state.position);
+    player_.get<comp::Velocity>().value = velocity;
+    for (const auto& input : predictedInputs_)
+        simulateInput(input, 1.0f / tickRate);
+    trafo.setOrientation(orientation);
 }
 
 #define MESSAGE_CASE(Type)                                                                         \
@@ -724,14 +1025,39 @@ void Client::sendUpdate()
 
 void Client::receive(uint8_t channelId, const enet::Packet& packet)
 {
-    ReadBuffer buffer(packet.getData<uint8_t>(), packet.getSize());
+    const auto channel = static_cast<Channel>(channelId);
+    telemetry_.addReceived(channel, packet.getSize());
+    if (!isChunk(packet.getData<uint8_t>(), packet.getSize())) {
+        receiveMessage(channel, packet.getData<uint8_t>(), packet.getSize());
+        return;
+    }
+    std::vector<uint8_t> message;
+    if (!chunks_.add(channel, packet.getData<uint8_t>(), packet.getSize(), message))
+        printErr("Invalid message chunk");
+    else if (!message.empty())
+        receiveMessage(channel, message.data(), message.size());
+}
+
+void Client::receiveMessage(Channel channel, const uint8_t* data, size_t size)
+{
+    std::optional<std::vector<uint8_t>> decompressed;
+    if (getChannelProperties(channel).compressed) {
+        decompressed
+            = decompressMessage(data, size, compressionStats_[static_cast<size_t>(channel)]);
+        if (!decompressed) {
+            printErr("Could not decompress message");
+            return;
+        }
+    }
+    ReadBuffer buffer = decompressed ? ReadBuffer(decompressed->data(), decompressed->size())
+                                     : ReadBuffer(data, size);
     CommonMessageHeader header;
     if (!deserialize(buffer, header)) {
         printErr("Could not decode common message header");
         return; // Ignore message
     }
     const auto messageType = static_cast<MessageType>(header.messageType);
-    if (static_cast<Channel>(channelId) == Channel::Reliable) {
+    if (channel != Channel::Unreliable) {
         // println("[client] Received message: {}", asString(messageType));
     }
     switch (messageType) {
@@ -743,6 +1069,7 @@ void Client::receive(uint8_t channelId, const enet::Packet& packet)
         MESSAGE_CASE(ClientPlaySound);
         MESSAGE_CASE(ServerUpdateInputEnabled);
         MESSAGE_CASE(ServerUpdateShipState);
+        MESSAGE_CASE(ServerTimeSync);
     default:
         printErr("Received unrecognized message: {}", asString(messageType));
     }
@@ -753,68 +1080,109 @@ void Client::processMessage(
 {
     assert(playerId_ == InvalidPlayerId);
     playerId_ = message.playerId;
+    inputCommands_ = message.inputCommands;
+    systemNames_ = SymbolTable(message.systems);
+    soundNames_ = SymbolTable(message.sounds);
     auto& trafo = player_.get<comp::Transform>();
     trafo.setPosition(message.spawnPosition);
     trafo.setOrientation(message.spawnOrientation);
     player_.get<comp::PlayerInputController>().updateFromOrientation(trafo);
+
+    for (const auto& [channelId, packet] : std::exchange(earlyPackets_, {}))
+        receive(channelId, packet);
 }
 
-void Client::addPlayer(PlayerId id)
+Client::RemotePlayer& Client::addPlayer(PlayerId id)
 {
     auto player = world_.createEntity();
     player.add<comp::Hierarchy>();
     player.add<comp::Transform>().setScale(glm::vec3(2.1f));
     player.add<comp::CylinderCollider>(comp::CylinderCollider { playerRadius, cameraOffsetY });
     player.add<comp::Mesh>(playerMeshes_[id % playerMeshes_.size()]);
-    players_.emplace(id, player);
+    return players_.emplace(id, RemotePlayer { player }).first->second;
 }
 
 void Client::processMessage(
     uint32_t frameNumber, const Message<MessageType::ServerPlayerStateUpdate>& message)
 {
-    static uint32_t lastUpdateFrame = 0;
-    if (frameNumber < lastUpdateFrame)
+    const auto snapshot = applyDelta(frameNumber, message, receivedSnapshots_);
+    if (!snapshot) {
+        // The baseline is gone. The server will keep using the last one we acknowledged until
+        // it is too old, at which point it sends a full snapshot.
+        return;
+    }
+    receivedSnapshots_.add(*snapshot);
+    snapshotClock_.addSnapshot(frameNumber, getSteadyTime());
+
+    // Snapshots are unsequenced, so an older one might arrive after a newer one. It can still
+    // provide samples for interpolation, but players are only added and removed by the newest.
+    const auto newest = snapshotAck_ == InvalidFrame || frameNumber > snapshotAck_;
+    if (newest)
+        snapshotAck_ = frameNumber;
+
+    // Players that are not in the message are unchanged and do not need another sample
+    for (const auto& state : message.players) {
+        const auto it = players_.find(state.id);
+        if (it == players_.end())
+            continue;
+        const auto player = snapshot->find(state.id);
+        assert(player);
+        it->second.interpolation.add(frameNumber, player->position, player->orientation);
+    }
+
+    if (!newest)
         return;
 
-    for (const auto& player : message.players) {
+    if (inputCommands_ && message.inputAck != InvalidInputSequence) {
+        if (const auto self = snapshot->find(playerId_))
+            reconcile(*self, message.inputAck, message.velocity);
+    }
+
+    // Every player in the snapshot is stamped with the new generation, so everyone with an
+    // older generation afterwards has left.
+    snapshotGeneration_++;
+    for (const auto& player : snapshot->players) {
         if (player.id == playerId_)
             continue;
         auto it = players_.find(player.id);
         if (it == players_.end()) {
-            addPlayer(player.id);
-            it = players_.find(player.id);
+            auto& remote = addPlayer(player.id);
+            remote.interpolation.add(frameNumber, player.position, player.orientation);
             println("Player (id = {}) connected", player.id);
+            remote.generation = snapshotGeneration_;
+        } else {
+            it->second.generation = snapshotGeneration_;
         }
-
-        auto& trafo = it->second.get<comp::Transform>();
-        const auto lookDir = player.orientation * glm::vec3(0.0f, 0.0f, 1.0f);
-        trafo.lookAtPos(player.position, player.position + glm::vec3(lookDir.x, 0.0f, lookDir.z));
     }
 
-    std::vector<PlayerId> playersToRemove;
-    for (const auto& [id, entity] : players_) {
-        bool found = false;
-        for (const auto& msgPlayer : message.players) {
-            if (msgPlayer.id == id) {
-                found = true;
-                break;
-            }
-        }
-        if (!found) {
-            playersToRemove.push_back(id);
+    for (auto it = players_.begin(); it != players_.end();) {
+        if (it->second.generation != snapshotGeneration_) {
+            it->second.entity.destroy();
+            println("Player (id = {}) disconnected", it->first);
+            it = players_.erase(it);
+        } else {
+            ++it;
         }
     }
 
-    for (const auto id : playersToRemove) {
-        auto& player = players_.at(id);
-        player.destroy();
-        players_.erase(id);
-        println("Player (id = {}) disconnected", id);
-    }
-
     world_.flush();
+}
+
+void Client::interpolateRemotePlayers()
+{
+    if (!snapshotClock_.isValid())
+        return;
 
-    lastUpdateFrame = frameNumber;
+    const auto renderFrame = snapshotClock_.getRenderFrame(getSteadyTime());
+    for (auto& [id, player] : players_) {
+        if (player.interpolation.empty())
+            continue;
+        auto& trafo = player.entity.get<comp::Transform>();
+        const auto sample = player.interpolation.get(
+            renderFrame - player.interpolation.getDelay(), snapshotClock_.getNewestFrame());
+        const auto lookDir = sample.orientation * glm::vec3(0.0f, 0.0f, 1.0f);
+        trafo.lookAtPos(sample.position, sample.position + glm::vec3(lookDir.x, 0.0f, lookDir.z));
+    }
 }
 
 ecs::EntityHandle Client::findTerminal(const std::string& system)
@@ -833,21 +1201,27 @@ ecs::EntityHandle Client::findTerminal(const std::string& system)
 void Client::processMessage(
     uint32_t /*frameNumber*/, const Message<MessageType::ServerInteractTerminal>& message)
 {
-    terminalData_[message.terminal].currentUser = message.user;
+    if (!systemNames_.isValid(message.terminal))
+        return;
+    const auto& system = systemNames_.getName(message.terminal);
+    terminalData_[system].currentUser = message.user;
     if (message.user == playerId_) {
-        state_ = TerminalState { findTerminal(message.terminal), message.terminal };
-        send(Channel::Reliable, Message<MessageType::ClientUpdateTerminalInput> { "" });
+        state_ = TerminalState { findTerminal(system), system };
+        send(Channel::Control, Message<MessageType::ClientUpdateTerminalInput> { "" });
     }
 }
 
 void Client::processMessage(
     uint32_t /*frameNumber*/, const Message<MessageType::ServerUpdateTerminalOutput>& message)
 {
-    auto& termData = terminalData_[message.terminal];
+    if (!systemNames_.isValid(message.terminal))
+        return;
+    const auto& system = systemNames_.getName(message.terminal);
+    auto& termData = terminalData_[system];
     termData.output.append(message.text);
     termData.scroll = HUGE_VALF; // scroll to end
     if (const auto terminalState = std::get_if<TerminalState>(&state_)) {
-        if (terminalState->systemName == message.terminal)
+        if (terminalState->systemName == system)
             playEntitySound("terminalOutput", terminalState->terminalEntity);
     }
 }
@@ -855,7 +1229,9 @@ void Client::processMessage(
 void Client::processMessage(
     uint32_t /*frameNumber*/, const Message<MessageType::ServerAddTerminalHistory>& message)
 {
-    auto& termData = terminalData_[message.terminal];
+    if (!systemNames_.isValid(message.terminal))
+        return;
+    auto& termData = terminalData_[systemNames_.getName(message.terminal)];
     for (const auto& command : message.commands) {
         termData.history.push_front(command);
     }
@@ -867,15 +1243,19 @@ void Client::processMessage(
 void Client::processMessage(
     uint32_t /*frameNumber*/, const Message<MessageType::ClientPlaySound>& message)
 {
-    play3dSound(message.name, message.position);
+    if (soundNames_.isValid(message.sound))
+        play3dSound(soundNames_.getName(message.sound), message.position);
 }
 
 void Client::processMessage(
     uint32_t /*frameNumber*/, const Message<MessageType::ServerUpdateInputEnabled>& message)
 {
-    auto& termData = terminalData_[message.terminal];
+    if (!systemNames_.isValid(message.terminal))
+        return;
+    const auto& system = systemNames_.getName(message.terminal);
+    auto& termData = terminalData_[system];
     if (const auto ts = std::get_if<TerminalState>(&state_)) {
-        if (ts->systemName == message.terminal && !termData.inputEnabled && message.enabled) {
+        if (ts->systemName == system && !termData.inputEnabled && message.enabled) {
             playEntitySound("terminalExecuteDone", ts->terminalEntity);
         }
     }
@@ -889,6 +1269,15 @@ void Client::processMessage(
     shipState_.reactorPower = message.reactorPower;
 }
 
+void Client::processMessage(
+    uint32_t /*frameNumber*/, const Message<MessageType::ServerTimeSync>& message)
+{
+    const auto now = getSteadyTime();
+    const auto requestTime = now - getTimeSyncStampAge(message.clientTime, now);
+    clockSync_.addSample(requestTime, now,
+        static_cast<double>(message.serverFrame) + message.serverFrameFraction);
+}
+
 void Client::draw()
 {
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -914,5 +1303,58 @@ void Client::draw()
         skybox_->draw(frustum_, cameraTransform);
     }
 
+    if (showTelemetry_)
+        drawTelemetry();
+
     window_.swap();
 }
+
+void Client::drawTelemetry()
+{
+    drawImgui(window_.getSdlWindow(), [this]() {
+        ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f));
+        ImGui::SetNextWindowBgAlpha(0.6f);
+        ImGui::Begin("Telemetry", nullptr,
+            ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove
+                | ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoSavedSettings
+                | ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoInputs);
+        if (!telemetry_.hasSamples()) {
+            ImGui::TextUnformatted("Collecting..");
+            ImGui::End();
+            return;
+        }
+
+        const auto& sample = telemetry_.getLatest();
+        ImGui::Text("RTT: %.0f ms (+- %.0f ms)", sample.roundTripTime,
+            sample.roundTripTimeVariance);
+        ImGui::Text("Loss: %.1f%%, throttle: %.0f%%", sample.packetLoss * 100.0f,
+            sample.packetThrottle * 100.0f);
+        ImGui::Text("ENet in: %.1f KB/s, out: %.1f KB/s", sample.enetBytesIn / 1024.0f,
+            sample.enetBytesOut / 1024.0f);
+
+        std::vector<float> roundTripTimes;
+        for (const auto& s : telemetry_.getSamples())
+            roundTripTimes.push_back(s.roundTripTime);
+        ImGui::PlotLines("RTT", roundTripTimes.data(), static_cast<int>(roundTripTimes.size()),
+            0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+
+        ImGui::Columns(3, nullptr, false);
+        ImGui::TextUnformatted("Channel");
+        ImGui::NextColumn();
+        ImGui::TextUnformatted("In");
+        ImGui::NextColumn();
+        ImGui::TextUnformatted("Out");
+        ImGui::NextColumn();
+        for (size_t c = 0; c < sample.channels.size(); ++c) {
+            const auto& channel = sample.channels[c];
+            ImGui::TextUnformatted(asString(static_cast<Channel>(c)).c_str());
+            ImGui::NextColumn();
+            ImGui::Text("%zu msg, %.1f KB", channel.in.messages, channel.in.bytes / 1024.0f);
+            ImGui::NextColumn();
+            ImGui::Text("%zu msg, %.1f KB", channel.out.messages, channel.out.bytes / 1024.0f);
+            ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
+        ImGui::End();
+    });
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -7,10 +8,15 @@
 
 #include "ecs.hpp"
 #include "graphics.hpp"
+#include "interpolation.hpp"
 #include "net.hpp"
+#include "physics.hpp"
 #include "shipsystem.hpp"
+#include "snapshot.hpp"
 #include "sound.hpp"
+#include "telemetry.hpp"
 #include "terminaldata.hpp"
+#include "timesync.hpp"
 #include "util.hpp"
 
 class Client {
@@ -18,7 +24,8 @@ public:
     Client() = default;
 
     // this blocks until the window is closed or the player ends the game
-    bool run(std::optional<HostPort> hostPort, uint32_t gameCode);
+    bool run(std::optional<HostPort> hostPort, uint32_t gameCode,
+        const enet::NetworkConditions& networkConditions = {});
 
 private:
     struct MoveState {
@@ -32,31 +39,81 @@ private:
 
     using PlayerState = std::variant<MoveState, TerminalState>;
 
+    struct RemotePlayer {
+        ecs::EntityHandle entity;
+        // The snapshot generation this player was last seen in
+        uint32_t generation = 0;
+        InterpolationBuffer interpolation;
+    };
+
+    // An input command that has been simulated locally, but not acknowledged by the server yet
+    struct PredictedInput {
+        uint32_t sequence;
+        MoveInput input;
+        ecs::EntityHandle terminal; // approached instead of moving, if valid
+    };
+
+    // Connecting is driven by updateConnection, which is called between the loading steps and
+    // afterwards until ServerHello arrived. Everything received until then is kept for later.
+    enum class ConnectionState {
+        Connecting, // until ENet's handshake is done
+        WaitingForHello,
+        WaitingForRetry,
+        Connected, // got ServerHello
+        Failed,
+    };
+
     uint32_t showConnectCodeMenu(std::optional<HostPort>& hostPort);
     void showError(const std::string& message);
+    bool load();
+    void drawLoadingScreen(const std::string& step, float progress);
+
+    bool startConnecting(const HostPort& hostPort, uint32_t gameCode,
+        const enet::NetworkConditions& networkConditions);
+    void connectAttempt();
+    void retryConnect(const std::string& reason);
+    void failConnection(const std::string& error);
+    void updateConnection(uint32_t timeoutMs = 0);
+    std::string getConnectionStatus() const;
 
     void resized(size_t width, size_t height);
 
     void processSdlEvents();
     void processEnetEvents();
+    // Returns how fast ticks should currently run to stay aligned with the server
+    float alignTicks(float accumulator);
     void update(float dt);
     void sendUpdate();
+    void sendInputs();
+    void sendMoveUpdate();
+    // Holds back reliable messages until ServerHello has been processed
+    void handlePacket(uint8_t channelId, enet::Packet&& packet);
     void receive(uint8_t channelId, const enet::Packet& packet);
+    // A whole message (after putting chunks back together)
+    void receiveMessage(Channel channel, const uint8_t* data, size_t size);
+    void interpolateRemotePlayers();
     void draw();
-    void addPlayer(PlayerId id);
+    void drawTelemetry();
+    RemotePlayer& addPlayer(PlayerId id);
     void handleInteractions();
+    void playLadderSound(const LadderClimb& climb);
+    void predictInput(const MoveInput& input, ecs::EntityHandle terminal, float dt);
+    std::optional<LadderClimb> simulateInput(const PredictedInput& input, float dt);
+    void reconcile(const PlayerSnapshot& state, uint32_t inputAck, const glm::vec3& velocity);
 
     template <MessageType MsgType>
     bool send(Channel channel, const Message<MsgType>& message)
     {
-        return sendMessage(serverPeer_, channel, frameCounter_, message);
+        const auto buffer = serializeMessage(frameCounter_, message);
+        telemetry_.addSent(channel, buffer.getSize());
+        return sendBuffer(serverPeer_, channel, buffer);
     }
 
     template <MessageType MsgType>
     void processMessage(uint32_t frameNumber, ReadBuffer& buffer)
     {
         Message<MsgType> message;
-        if (!deserialize(buffer, message)) {
+        if (!deserializeMessage(buffer, message)) {
             printErr("Could not decode message of type {}", static_cast<uint8_t>(MsgType));
             return;
         }
@@ -83,6 +140,7 @@ private:
         uint32_t frameNumber, const Message<MessageType::ServerUpdateInputEnabled>& message);
     void processMessage(
         uint32_t frameNumber, const Message<MessageType::ServerUpdateShipState>& message);
+    void processMessage(uint32_t frameNumber, const Message<MessageType::ServerTimeSync>& message);
 
     SoLoud::handle playEntitySound(const std::string& name, const std::string entityName,
         float volume = 1.0f, float playbackSpeed = 1.0f);
@@ -92,13 +150,46 @@ private:
 
     ENetPeer* serverPeer_ = nullptr;
     enet::Host host_;
+    ENetAddress serverAddress_ {};
+    std::string serverName_; // for messages
+    uint32_t connectCode_ = 0;
+    ConnectionState connectionState_ = ConnectionState::Connecting;
+    size_t connectAttempts_ = 0;
+    // When the current state was entered or, for WaitingForRetry, when the next attempt is due
+    float connectionStateTime_ = 0.0f;
+    float lastConnectionUpdate_ = 0.0f;
+    std::string connectionError_;
+    // Everything received until ServerHello arrived and loading is done
+    std::vector<std::pair<uint8_t, enet::Packet>> pendingPackets_;
     glwx::Window window_;
     ecs::World world_;
     Frustum frustum_;
     PlayerState state_;
     ShipState shipState_;
     float nextStepSound_ = 0.0f;
-    std::unordered_map<PlayerId, ecs::EntityHandle> players_; // excludes self
+    std::unordered_map<PlayerId, RemotePlayer> players_; // excludes self
+    uint32_t snapshotGeneration_ = 0;
+    SnapshotBuffer receivedSnapshots_;
+    SnapshotClock snapshotClock_;
+    ClockSync clockSync_;
+    uint32_t snapshotAck_ = InvalidFrame;
+    bool inputCommands_ = false;
+    uint32_t nextInputSequence_ = 0;
+    uint32_t lastSentInput_ = InvalidInputSequence;
+    glm::quat lastInputOrientation_ { 1.0f, 0.0f, 0.0f, 0.0f };
+    std::deque<PredictedInput> predictedInputs_;
+    glm::vec3 lastSentPosition_ { 0.0f };
+    glm::quat lastSentOrientation_ { 1.0f, 0.0f, 0.0f, 0.0f };
+    size_t moveUpdateRepeats_ = 0;
+    float nextHeartbeat_ = 0.0f;
+    // Reliable messages that arrived before ServerHello
+    std::vector<std::pair<uint8_t, enet::Packet>> earlyPackets_;
+    ChunkAssembler chunks_;
+    SymbolTable systemNames_;
+    SymbolTable soundNames_;
+    LaneCompressionStats compressionStats_;
+    PeerTelemetry telemetry_;
+    bool showTelemetry_ = false;
     std::unordered_map<ShipSystem::Name, TerminalData> terminalData_;
     std::vector<std::shared_ptr<Mesh>> playerMeshes_;
     std::unique_ptr<Skybox> skybox_;
@@ -0,0 +1,180 @@
+#include "compression.hpp"
+
+#include <cassert>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "util.hpp"
+
+namespace {
+enum class Encoding : uint8_t { Raw = 0, Deflate = 1 };
+
+// Below this deflate can not win much, even with a dictionary
+constexpr size_t minCompressSize = 64;
+// Terminal output messages are at most 16 KB, so anything much bigger is garbage
+constexpr uint32_t maxDecompressedSize = 64 * 1024;
+constexpr size_t headerSize = sizeof(Encoding) + sizeof(uint32_t);
+
+const std::string& getDictionary()
+{
+    static const std::string dictionary = []() {
+        auto dict = readFile("media/terminal.dict");
+        if (!dict) {
+            printErr("Could not load 'media/terminal.dict'");
+            return std::string();
+        }
+        return *dict;
+    }();
+    return dictionary;
+}
+
+// Setting up a z_stream allocates a lot, so there is one per thread, which is reset for every
+// message.
+struct Deflater {
+    z_stream stream {};
+    bool valid;
+
+    Deflater()
+        : valid(deflateInit(&stream, Z_DEFAULT_COMPRESSION) == Z_OK)
+    {
+    }
+
+    ~Deflater()
+    {
+        if (valid)
+            deflateEnd(&stream);
+    }
+};
+
+struct Inflater {
+    z_stream stream {};
+    bool valid;
+
+    Inflater()
+        : valid(inflateInit(&stream) == Z_OK)
+    {
+    }
+
+    ~Inflater()
+    {
+        if (valid)
+            inflateEnd(&stream);
+    }
+};
+
+WriteBuffer getRawMessage(const WriteBuffer& buffer)
+{
+    WriteBuffer raw(buffer.getSize() + 1);
+    raw.write(Encoding::Raw);
+    raw.write(buffer.getData(), buffer.getSize());
+    return raw;
+}
+
+std::optional<std::vector<uint8_t>> deflateMessage(const WriteBuffer& buffer)
+{
+    thread_local Deflater deflater;
+    if (!deflater.valid)
+        return std::nullopt;
+    auto& stream = deflater.stream;
+    if (deflateReset(&stream) != Z_OK)
+        return std::nullopt;
+    const auto& dict = getDictionary();
+    if (!dict.empty()
+        && deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dict.data()),
+               static_cast<uInt>(dict.size()))
+            != Z_OK)
+        return std::nullopt;
+
+    std::vector<uint8_t> out(deflateBound(&stream, static_cast<uLong>(buffer.getSize())));
+    stream.next_in = const_cast<Bytef*>(buffer.getData());
+    stream.avail_in = static_cast<uInt>(buffer.getSize());
+    stream.next_out = out.data();
+    stream.avail_out = static_cast<uInt>(out.size());
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        return std::nullopt;
+    out.resize(stream.total_out);
+    return out;
+}
+}
+
+float CompressionStats::getRatio() const
+{
+    return wireBytes > 0 ? static_cast<float>(rawBytes) / wireBytes : 1.0f;
+}
+
+WriteBuffer compressMessage(const WriteBuffer& buffer, CompressionStats& stats)
+{
+    const auto start = getSteadyTime();
+    stats.messages++;
+
+    std::optional<std::vector<uint8_t>> deflated;
+    if (buffer.getSize() >= minCompressSize && buffer.getSize() <= maxDecompressedSize)
+        deflated = deflateMessage(buffer);
+
+    if (!deflated || headerSize + deflated->size() >= buffer.getSize() + 1)
+        return getRawMessage(buffer);
+
+    WriteBuffer compressed(headerSize + deflated->size());
+    compressed.write(Encoding::Deflate);
+    compressed.write(hton(static_cast<uint32_t>(buffer.getSize())));
+    compressed.write(deflated->data(), deflated->size());
+    stats.compressedMessages++;
+    stats.rawBytes += buffer.getSize();
+    stats.wireBytes += compressed.getSize();
+    stats.time += getSteadyTime() - start;
+    return compressed;
+}
+
+std::optional<std::vector<uint8_t>> decompressMessage(
+    const uint8_t* data, size_t size, CompressionStats& stats)
+{
+    const auto start = getSteadyTime();
+    ReadBuffer buffer(data, size);
+    Encoding encoding;
+    if (!buffer.read(encoding))
+        return std::nullopt;
+
+    stats.messages++;
+    if (encoding == Encoding::Raw)
+        return std::vector<uint8_t>(data + 1, data + size);
+    if (encoding != Encoding::Deflate)
+        return std::nullopt;
+
+    uint32_t rawSize = 0;
+    if (!buffer.read(rawSize))
+        return std::nullopt;
+    rawSize = ntoh(rawSize);
+    if (rawSize > maxDecompressedSize || size < headerSize)
+        return std::nullopt;
+
+    thread_local Inflater inflater;
+    if (!inflater.valid)
+        return std::nullopt;
+    auto& stream = inflater.stream;
+    if (inflateReset(&stream) != Z_OK)
+        return std::nullopt;
+
+    std::vector<uint8_t> out(rawSize);
+    stream.next_in = const_cast<Bytef*>(data + headerSize);
+    stream.avail_in = static_cast<uInt>(size - headerSize);
+    stream.next_out = out.data();
+    stream.avail_out = static_cast<uInt>(out.size());
+    auto res = inflate(&stream, Z_FINISH);
+    if (res == Z_NEED_DICT) {
+        const auto& dict = getDictionary();
+        if (inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dict.data()),
+                static_cast<uInt>(dict.size()))
+            != Z_OK)
+            return std::nullopt;
+        res = inflate(&stream, Z_FINISH);
+    }
+    if (res != Z_STREAM_END || stream.total_out != rawSize)
+        return std::nullopt;
+
+    stats.compressedMessages++;
+    stats.rawBytes += rawSize;
+    stats.wireBytes += size;
+    stats.time += getSteadyTime() - start;
+    return out;
+}
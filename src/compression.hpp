@@ -0,0 +1,31 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "serialization.hpp"
+
+// Terminal text is very repetitive (prompts, log lines, banners), so messages on the lanes that
+// carry it are deflated with a preset dictionary of typical terminal output
+// (media/terminal.dict, generated by tools/terminaldict.py from the strings in media/systems/*.lua
+// and the fixed terminal text of shipsystem.cpp).
+// Every message on such a lane starts with a byte that says whether it is compressed. Small
+// messages and ones that would not get smaller are sent as they are.
+
+struct CompressionStats {
+    size_t messages = 0;
+    size_t compressedMessages = 0;
+    // The rest is only about the compressed messages, so the ratio is not diluted by the raw ones
+    size_t rawBytes = 0; // before compression
+    size_t wireBytes = 0; // after compression, including the header
+    double time = 0.0; // seconds spent compressing or decompressing
+
+    float getRatio() const;
+};
+
+// The returned buffer is what has to be sent
+WriteBuffer compressMessage(const WriteBuffer& buffer, CompressionStats& stats);
+
+// Returns nullopt if the data is garbage
+std::optional<std::vector<uint8_t>> decompressMessage(
+    const uint8_t* data, size_t size, CompressionStats& stats);
@@ -15,3 +15,5 @@ static constexpr size_t terminalTruncateAmount = 2 * 1024;
 static constexpr float scrollAmount = 80.0f;
 static constexpr float pageScrollAmount = 3.0f * scrollAmount;
 static constexpr size_t maxHistoryEntries = 64;
+// Of commands and terminal input, longer ones are dropped by the server
+static constexpr size_t maxTerminalInputLength = 512;
@@ -2,6 +2,8 @@
 
 #include <cstdlib>
 
+#include "util.hpp"
+
 namespace enet {
 
 std::optional<ENetAddress> getAddress(const std::string& host, Port port)
@@ -34,11 +36,13 @@ std::optional<std::string> getHostname(const ENetAddress& addr)
 Packet::Packet(ENetPacket* packet)
     : packet_(packet)
 {
+    addReference();
 }
 
 Packet::Packet(std::string_view data, uint32_t flags)
     : packet_(enet_packet_create(data.data(), data.size(), flags))
 {
+    addReference();
 }
 
 Packet::Packet(Packet&& other)
@@ -49,15 +53,17 @@ Packet::Packet(Packet&& other)
 
 Packet& Packet::operator=(Packet&& other)
 {
-    packet_ = other.packet_;
-    other.packet_ = nullptr;
+    if (this != &other) {
+        reset();
+        packet_ = other.packet_;
+        other.packet_ = nullptr;
+    }
     return *this;
 }
 
 Packet::~Packet()
 {
-    if (packet_)
-        enet_packet_destroy(packet_);
+    reset();
 }
 
 size_t Packet::getSize() const
@@ -78,10 +84,26 @@ ENetPacket* Packet::get()
 ENetPacket* Packet::release()
 {
     auto ret = packet_;
+    if (ret)
+        --ret->referenceCount;
     packet_ = nullptr;
     return ret;
 }
 
+void Packet::addReference()
+{
+    if (packet_)
+        ++packet_->referenceCount;
+}
+
+void Packet::reset()
+{
+    // Peers it is still queued on hold their own reference, ENet destroys it after them
+    if (packet_ && --packet_->referenceCount == 0)
+        enet_packet_destroy(packet_);
+    packet_ = nullptr;
+}
+
 Host::Host(const ENetAddress& addr, size_t maxClients, size_t channelCount, uint32_t inBandwidth,
     uint32_t outBandwidth)
     : host_(enet_host_create(&addr, maxClients, channelCount, inBandwidth, outBandwidth))
@@ -89,12 +111,16 @@ Host::Host(const ENetAddress& addr, size_t maxClients, size_t channelCount, uint
 }
 
 Host::Host(size_t channelCount, uint32_t inBandwidth, uint32_t outBandwidth)
-    : host_(enet_host_create(nullptr, 1, channelCount, inBandwidth, outBandwidth))
 {
+    // Without an address the socket is only bound when the first datagram is sent, but the
+    // network simulator needs to know the port right away.
+    const ENetAddress any { ENET_HOST_ANY, 0 };
+    host_ = enet_host_create(&any, 1, channelCount, inBandwidth, outBandwidth);
 }
 
 Host::Host(Host&& other)
     : host_(other.host_)
+    , simulator_(std::move(other.simulator_))
 {
     other.host_ = nullptr;
 }
@@ -102,19 +128,36 @@ Host::Host(Host&& other)
 Host& Host::operator=(Host&& other)
 {
     host_ = other.host_;
+    simulator_ = std::move(other.simulator_);
     other.host_ = nullptr;
     return *this;
 }
 
 Host::~Host()
 {
+    simulator_.reset(); // it still uses the host
     if (host_)
         enet_host_destroy(host_);
 }
 
 void Host::broadcast(uint8_t channel, Packet&& packet)
 {
-    enet_host_broadcast(host_, channel, packet.release());
+    if (packet.get())
+        enet_host_broadcast(host_, channel, packet.release());
+}
+
+bool Host::multicast(const std::vector<ENetPeer*>& peers, uint8_t channel, Packet&& packet)
+{
+    if (!packet.get())
+        return false;
+    bool ret = true;
+    for (auto peer : peers) {
+        if (enet_peer_send(peer, channel, packet.get()) < 0)
+            ret = false;
+    }
+    // Every peer it was queued for holds a reference, so it is only destroyed here if there is none
+    packet.reset();
+    return ret;
 }
 
 ENetPeer* Host::connect(const ENetAddress& addr, size_t channelCount, uint32_t data)
@@ -142,7 +185,8 @@ ENetHost* Host::release()
 std::optional<Event> Host::service(uint32_t timeoutMs)
 {
     ENetEvent event;
-    const auto res = enet_host_service(host_, &event, timeoutMs);
+    const auto res = simulator_ ? simulator_->service(&event, timeoutMs)
+                                : enet_host_service(host_, &event, timeoutMs);
     if (res < 0)
         return ServiceFailedEvent { res };
     if (res == 0)
@@ -171,4 +215,21 @@ bool Host::compressWithRangeCoder()
 {
     return enet_host_compress_with_range_coder(host_) == 0;
 }
+
+bool Host::simulate(const NetworkConditions& conditions)
+{
+    simulator_.reset();
+    if (!conditions.isValid()) {
+        printErr("Invalid network simulation settings");
+        return false;
+    }
+    if (!conditions.isEnabled())
+        return true;
+    simulator_ = std::make_unique<NetworkSimulator>(host_, conditions);
+    if (!*simulator_) {
+        simulator_.reset();
+        return false;
+    }
+    return true;
+}
 }
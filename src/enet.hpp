@@ -1,12 +1,16 @@
 #pragma once
 
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <variant>
+#include <vector>
 
 #include <enet/enet.h>
 
+#include "netsim.hpp"
+
 using Port = uint16_t;
 
 namespace enet {
@@ -15,6 +19,9 @@ std::optional<ENetAddress> getAddress(const std::string& host, Port port);
 std::optional<std::string> getIp(const ENetAddress& addr);
 std::optional<std::string> getHostname(const ENetAddress& addr);
 
+// Holds a reference to the ENet packet, like the peers it is queued on do. ENet destroys it when
+// the last peer is done with it, so a Packet stays valid while it is sent (even to several peers)
+// and destroys it itself if no peer has it queued anymore.
 class Packet {
 public:
     Packet(ENetPacket* packet);
@@ -25,6 +32,7 @@ public:
     Packet(const T* data, size_t size, uint32_t flags)
         : packet_(enet_packet_create(data, size, flags))
     {
+        addReference();
     }
 
     Packet(Packet&& other);
@@ -50,9 +58,14 @@ public:
 
     ENetPacket* get();
 
+    // Gives up the reference without destroying the packet. Pass it to ENet right away.
     ENetPacket* release();
 
+    void reset();
+
 private:
+    void addReference();
+
     ENetPacket* packet_ = nullptr;
 };
 
@@ -85,6 +98,7 @@ public:
     Host(const ENetAddress& addr, size_t maxClients, size_t channelCount, uint32_t inBandwidth = 0,
         uint32_t outBandwidth = 0);
 
+    // For clients, bound to an ephemeral port on any address
     Host(size_t channelCount, uint32_t inBandwidth = 0, uint32_t outBandwidth = 0);
 
     Host(Host&& other);
@@ -98,6 +112,10 @@ public:
 
     void broadcast(uint8_t channel, Packet&& packet);
 
+    // Like broadcast, but only for the passed peers. The packet is shared (reference counted), so
+    // the data is only copied once. Returns false if it could not be queued for some peer.
+    bool multicast(const std::vector<ENetPeer*>& peers, uint8_t channel, Packet&& packet);
+
     ENetPeer* connect(const ENetAddress& addr, size_t channelCount, uint32_t data = 0);
 
     explicit operator bool() const;
@@ -112,8 +130,12 @@ public:
 
     bool compressWithRangeCoder();
 
+    // Simulates the conditions for everything this host receives from now on
+    bool simulate(const NetworkConditions& conditions);
+
 private:
     ENetHost* host_ = nullptr;
+    std::unique_ptr<NetworkSimulator> simulator_;
 };
 
 }
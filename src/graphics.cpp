@@ -407,6 +407,8 @@ void renderTerminalScreens(ecs::World& world, const glm::vec3& cameraPosition,
                     ImGui::PushStyleVar(ImGuiStyleVar_Alpha, 0.4f);
                 }
                 ImGui::InputText("Execute", &inputText, flags);
+                if (inputText.size() > maxTerminalInputLength)
+                    inputText.resize(maxTerminalInputLength);
                 term.input = inputText;
                 if (!term.inputEnabled) {
                     ImGui::PopStyleVar();
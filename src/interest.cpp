@@ -0,0 +1,42 @@
+#include "interest.hpp"
+
+#include <cmath>
+#include <cstdlib>
+
+#include "constants.hpp"
+
+namespace {
+// Within this distance on the same deck players are updated every tick
+constexpr auto nearDistance = 20.0f;
+// Players on the same deck within this distance or on an adjacent deck within half of it get
+// medium frequency updates, everyone else is updated rarely.
+constexpr auto midDistance = 60.0f;
+constexpr uint32_t nearInterval = 1;
+constexpr uint32_t midInterval = 4;
+constexpr uint32_t farInterval = 30;
+// Same as the default max distance in sound.cpp. Sounds from further away are inaudible anyway.
+constexpr auto maxSoundDistance = 60.0f;
+}
+
+int getDeck(const glm::vec3& position)
+{
+    return static_cast<int>(std::floor(position.y / floorHeight));
+}
+
+uint32_t getUpdateInterval(const glm::vec3& viewer, const glm::vec3& position)
+{
+    const auto deckDiff = std::abs(getDeck(viewer) - getDeck(position));
+    const auto dist = glm::length(position - viewer);
+    if (deckDiff == 0 && dist < nearDistance)
+        return nearInterval;
+    if ((deckDiff == 0 && dist < midDistance) || (deckDiff == 1 && dist < midDistance * 0.5f))
+        return midInterval;
+    return farInterval;
+}
+
+bool isAudible(const glm::vec3& listener, const glm::vec3& source)
+{
+    // Sounds in the middle of a ladder are between decks and should be heard from both
+    const auto deckDiff = std::abs(getDeck(listener) - getDeck(source));
+    return deckDiff <= 1 && glm::length(source - listener) <= maxSoundDistance;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "net.hpp"
+
+// Interest management: decides how relevant other players and events are to a player, based on
+// the deck (multiple of floorHeight) they are on and the distance between them.
+
+int getDeck(const glm::vec3& position);
+
+// Returns every how many ticks the state of an entity at position should ideally be sent to a
+// player at viewer. The snapshot scheduler uses its inverse as priority.
+uint32_t getUpdateInterval(const glm::vec3& viewer, const glm::vec3& position);
+
+bool isAudible(const glm::vec3& listener, const glm::vec3& source);
@@ -0,0 +1,155 @@
+#include "interpolation.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+// Lateness and delay are averaged over roughly this many snapshots
+constexpr auto jitterSmoothing = 0.05f;
+// If latency increases permanently, offset_ has to follow slowly
+constexpr auto offsetDrift = 0.002f;
+// One frame is needed to always have a sample to interpolate towards
+constexpr auto minDelay = 1.0f;
+constexpr auto maxDelay = 12.0f;
+constexpr auto jitterDelayFactor = 2.5f;
+// Per snapshot, so the playback speed changes by at most 5%, which is not noticeable
+constexpr auto maxDelayChange = 0.05f;
+// About 100ms
+constexpr auto maxExtrapolation = 6.0f;
+constexpr size_t maxSamples = 64;
+// Longer pauses between updates are most likely because the entity did not move
+constexpr auto maxInterval = 30.0f;
+constexpr auto intervalSmoothing = 0.25f;
+
+bool operator==(const InterpolationBuffer::Sample& a, const InterpolationBuffer::Sample& b)
+{
+    return a.position == b.position && a.orientation == b.orientation;
+}
+}
+
+void SnapshotClock::addSnapshot(uint32_t frame, double localTime)
+{
+    const auto offset = static_cast<double>(frame) - localTime * tickRate;
+    if (!isValid()) {
+        newestFrame_ = frame;
+        offset_ = offset;
+        delay_ = minDelay;
+        return;
+    }
+
+    if (frame > newestFrame_) {
+        const auto gap = std::min(static_cast<float>(frame - newestFrame_), maxInterval);
+        interval_ += (gap - interval_) * intervalSmoothing;
+        newestFrame_ = frame;
+    }
+    if (offset > offset_)
+        offset_ = offset;
+    else
+        offset_ += (offset - offset_) * offsetDrift;
+
+    const auto lateness = static_cast<float>(offset_ - offset);
+    jitter_ += (lateness - jitter_) * jitterSmoothing;
+
+    // There should always be a newer snapshot to interpolate towards
+    const auto targetDelay = std::clamp(
+        std::max(minDelay, interval_) + jitter_ * jitterDelayFactor, minDelay, maxDelay);
+    delay_ += std::clamp(targetDelay - delay_, -maxDelayChange, maxDelayChange);
+}
+
+bool SnapshotClock::isValid() const
+{
+    return newestFrame_ != InvalidFrame;
+}
+
+uint32_t SnapshotClock::getNewestFrame() const
+{
+    return newestFrame_;
+}
+
+double SnapshotClock::getServerFrame(double localTime) const
+{
+    assert(isValid());
+    return localTime * tickRate + offset_;
+}
+
+float SnapshotClock::getDelay() const
+{
+    return delay_;
+}
+
+double SnapshotClock::getRenderFrame(double localTime) const
+{
+    return getServerFrame(localTime) - delay_;
+}
+
+void InterpolationBuffer::add(
+    uint32_t frame, const glm::vec3& position, const glm::quat& orientation)
+{
+    const auto sample = Sample { static_cast<double>(frame), position, orientation };
+    if (!samples_.empty() && sample.frame < samples_.front().frame)
+        return; // Already in the past
+
+    const auto it = std::upper_bound(samples_.begin(), samples_.end(), sample.frame,
+        [](double value, const Sample& s) { return value < s.frame; });
+    if (it != samples_.begin() && *std::prev(it) == sample)
+        return;
+
+    if (it == samples_.end() && !samples_.empty()) {
+        const auto gap = static_cast<float>(sample.frame - samples_.back().frame);
+        if (gap > interval_ * 2.0f) {
+            // The entity was most likely standing still since the last sample. Without this it
+            // would start to move towards the new sample right after the last one.
+            samples_.push_back(Sample { sample.frame - interval_, samples_.back().position,
+                samples_.back().orientation });
+        }
+        samples_.push_back(sample);
+
+        interval_ += (std::min(gap, maxInterval) - interval_) * intervalSmoothing;
+        // Increase right away, so the entity does not run out of samples, but decrease slowly, so
+        // playback only speeds up a little.
+        delay_ = std::max(interval_ - 1.0f, delay_ - maxDelayChange);
+    } else {
+        samples_.insert(it, sample);
+    }
+
+    while (samples_.size() > maxSamples)
+        samples_.pop_front();
+}
+
+bool InterpolationBuffer::empty() const
+{
+    return samples_.empty();
+}
+
+float InterpolationBuffer::getDelay() const
+{
+    return delay_;
+}
+
+InterpolationBuffer::Sample InterpolationBuffer::get(double frame, uint32_t newestFrame)
+{
+    assert(!samples_.empty());
+    while (samples_.size() > 2 && samples_[1].frame <= frame)
+        samples_.pop_front();
+
+    const auto& front = samples_.front();
+    if (frame <= front.frame)
+        return Sample { frame, front.position, front.orientation };
+
+    if (samples_.size() > 1 && frame <= samples_[1].frame) {
+        const auto& next = samples_[1];
+        const auto t = static_cast<float>((frame - front.frame) / (next.frame - front.frame));
+        return Sample { frame, glm::mix(front.position, next.position, t),
+            glm::slerp(front.orientation, next.orientation, t) };
+    }
+
+    const auto& last = samples_.back();
+    if (frame <= static_cast<double>(newestFrame) || samples_.size() < 2)
+        return Sample { frame, last.position, last.orientation };
+
+    const auto& prev = samples_[samples_.size() - 2];
+    const auto velocity
+        = (last.position - prev.position) / static_cast<float>(last.frame - prev.frame);
+    const auto extrapolation = std::min(static_cast<float>(frame - last.frame), maxExtrapolation);
+    return Sample { frame, last.position + velocity * extrapolation, last.orientation };
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <deque>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "net.hpp"
+
+// Remote entities are not rendered at the state of the newest snapshot, but at an interpolated
+// state slightly in the past, so snapshots arriving unevenly do not make them stutter.
+// All times here are measured in (fractional) server frames. Those are doubles, because a server
+// that has been running for a day is at millions of frames, where floats are too coarse.
+
+// Estimates which server frame is current from the arrival times of snapshots and how far behind
+// it entities need to be rendered, so that snapshots delayed by jitter are usually there in time.
+class SnapshotClock {
+public:
+    // localTime in seconds (getSteadyTime)
+    void addSnapshot(uint32_t frame, double localTime);
+
+    bool isValid() const;
+
+    // The newest frame a snapshot has been received for
+    uint32_t getNewestFrame() const;
+
+    // The frame the server would be at, if the fastest snapshots so far were not delayed at all
+    double getServerFrame(double localTime) const;
+
+    float getDelay() const;
+
+    // The frame remote entities should be rendered at
+    double getRenderFrame(double localTime) const;
+
+private:
+    uint32_t newestFrame_ = InvalidFrame;
+    double offset_ = 0.0; // server frame - local time (in frames) of the fastest snapshots
+    float jitter_ = 0.0f; // mean lateness relative to offset_
+    float interval_ = 1.0f; // mean number of frames between snapshots
+    float delay_ = 0.0f;
+};
+
+class InterpolationBuffer {
+public:
+    struct Sample {
+        double frame;
+        glm::vec3 position;
+        glm::quat orientation;
+    };
+
+    // Samples that are equal to the previous one are dropped, so that only actual changes are
+    // interpolated between.
+    void add(uint32_t frame, const glm::vec3& position, const glm::quat& orientation);
+
+    bool empty() const;
+
+    // Entities are not necessarily updated in every snapshot (see the snapshot scheduler on the
+    // server). They have to be rendered further in the past by this many frames, so the next
+    // update is usually already there.
+    float getDelay() const;
+
+    // If frame is past the last sample, but not past newestFrame, the entity has not changed since
+    // and the last sample is returned. If it is past newestFrame as well, snapshots have been
+    // lost or delayed and the last movement is extrapolated for a limited time.
+    // Samples older than frame are discarded.
+    Sample get(double frame, uint32_t newestFrame);
+
+private:
+    std::deque<Sample> samples_; // sorted by frame
+    float interval_ = 1.0f; // mean number of frames between updates
+    float delay_ = 0.0f;
+};
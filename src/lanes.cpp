@@ -0,0 +1,57 @@
+#include "lanes.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+std::array<Channel, static_cast<size_t>(Channel::Count)> getChannelsByPriority()
+{
+    std::array<Channel, static_cast<size_t>(Channel::Count)> channels;
+    for (size_t i = 0; i < channels.size(); ++i)
+        channels[i] = static_cast<Channel>(i);
+    std::stable_sort(channels.begin(), channels.end(), [](Channel a, Channel b) {
+        return getChannelProperties(a).priority < getChannelProperties(b).priority;
+    });
+    return channels;
+}
+}
+
+bool LaneScheduler::queue(Channel channel, std::shared_ptr<enet::Packet> packet)
+{
+    assert(getChannelProperties(channel).windowShare < 1.0f);
+    if (!packet->get())
+        return false;
+    queuedBytes_ += packet->getSize();
+    queues_[static_cast<size_t>(channel)].push_back(std::move(packet));
+    return true;
+}
+
+bool LaneScheduler::flush(ENetPeer* peer)
+{
+    static const auto channels = getChannelsByPriority();
+
+    // Packets passed to ENet in this call are not in flight yet, but will be soon
+    size_t inFlight = peer->reliableDataInTransit;
+    bool ret = true;
+    for (const auto channel : channels) {
+        auto& queue = queues_[static_cast<size_t>(channel)];
+        const auto limit = getChannelProperties(channel).windowShare * peer->windowSize;
+        while (!queue.empty()) {
+            const auto size = queue.front()->getSize();
+            // If nothing is in flight, packets bigger than the limit still have to get through
+            if (inFlight > 0 && inFlight + size > limit)
+                break;
+            if (enet_peer_send(peer, static_cast<uint8_t>(channel), queue.front()->get()) < 0)
+                ret = false;
+            inFlight += size;
+            queuedBytes_ -= size;
+            queue.pop_front();
+        }
+    }
+    return ret;
+}
+
+size_t LaneScheduler::getQueuedBytes() const
+{
+    return queuedBytes_;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <memory>
+
+#include "enet.hpp"
+#include "net.hpp"
+
+// ENet passes reliable packets to the socket in the order they were queued, no matter the channel,
+// and stops once the peer's reliable window is full. So a big terminal output dump queued before
+// a terminal handoff delays it, even if they are on different channels.
+// This holds back packets of the lanes with a windowShare below 1 until there is room for them,
+// so the window is never filled up with low priority data.
+class LaneScheduler {
+public:
+    // The packet may be queued for other peers too. Its reference keeps it alive until it is passed
+    // to this peer, even if the other peers are done with it by then.
+    bool queue(Channel channel, std::shared_ptr<enet::Packet> packet);
+
+    // Call once per tick. Passes as many held back packets to ENet as the lanes allow.
+    bool flush(ENetPeer* peer);
+
+    size_t getQueuedBytes() const;
+
+private:
+    std::array<std::deque<std::shared_ptr<enet::Packet>>, static_cast<size_t>(Channel::Count)>
+        queues_;
+    size_t queuedBytes_ = 0;
+};
@@ -1,13 +1,19 @@
 #include <chrono>
 #include <thread>
 
+#include <cmath>
+#include <fstream>
 #include <iostream>
 
 #include <fmt/format.h>
 
 #include <docopt/docopt.h>
 
+#include "analysis.hpp"
+#include "bots.hpp"
 #include "client.hpp"
+#include "pool.hpp"
+#include "relay.hpp"
 #include "server.hpp"
 #include "util.hpp"
 #include "version.hpp"
@@ -20,9 +26,13 @@ ARBITRARY COMPLEXITY - A video game made for 7DFPS 2020
 
 Usage:
   complexity
-  complexity solo
-  complexity connect <host> <port> [--gamecode=<gamecode>]
-  complexity server <host> <port> [--exit-after-game] [--exit-timeout=<timeout>] [--gamecode=<gamecode>]
+  complexity solo [--input-commands] [--sim-latency=<ms>] [--sim-jitter=<ms>] [--sim-loss=<percent>] [--sim-duplicate=<percent>] [--sim-reorder=<percent>] [--sim-bandwidth=<bytes>]
+  complexity connect <host> <port> [--gamecode=<gamecode>] [--sim-latency=<ms>] [--sim-jitter=<ms>] [--sim-loss=<percent>] [--sim-duplicate=<percent>] [--sim-reorder=<percent>] [--sim-bandwidth=<bytes>]
+  complexity server <host> <port> [--exit-after-game] [--exit-timeout=<timeout>] [--gamecode=<gamecode>] [--max-players=<n>] [--input-commands] [--snapshot-rate=<hz>] [--client-bandwidth=<bytes>] [--sim-latency=<ms>] [--sim-jitter=<ms>] [--sim-loss=<percent>] [--sim-duplicate=<percent>] [--sim-reorder=<percent>] [--sim-bandwidth=<bytes>] [--record=<file>] [--stats=<file>] [--relay-key=<key>]
+  complexity replay <file>
+  complexity analyze <file> [--port=<port>] [--output=<file>]
+  complexity bots <host> <port> [--count=<n>] [--gamecode=<gamecode>] [--script=<file>] [--duration=<seconds>]
+  complexity relay <host> <port> --relay-key=<key> [--gamecode=<gamecode>] [--listen=<host>] [--listen-port=<port>] [--max-spectators=<n>] [--delay=<seconds>] [--snapshot-rate=<hz>]
   complexity -h | --help
   complexity --version
 
@@ -31,6 +41,28 @@ Options:
   --version                 Show version.
   --exit-timeout=<timeout>  Exit the server after there are no players on it for the specified number of seconds. [default: 900]
   --gamecode=<gamecode>     Gamecode to use.
+  --max-players=<n>         Maximum number of players on the server. [default: 4]
+  --input-commands          Simulate player movement on the server from client inputs.
+  --snapshot-rate=<hz>      Maximum number of snapshots sent to each client (or spectator) per second. [default: 60]
+  --client-bandwidth=<bytes>  Maximum number of bytes sent to each client per second. [default: 65536]
+  --sim-latency=<ms>        Simulate latency for everything received (in solo mode both ways).
+  --sim-jitter=<ms>         Simulated random additional latency of up to this much.
+  --sim-loss=<percent>      Simulated packet loss.
+  --sim-duplicate=<percent>  Simulated packet duplication.
+  --sim-reorder=<percent>   Packets held back for another latency + jitter, so they arrive out of order.
+  --sim-bandwidth=<bytes>   Simulated bandwidth limit in bytes per second.
+  --record=<file>           Record everything the server receives to replay the session later.
+  --stats=<file>            Append the link quality of every player to this file every second (JSON lines).
+  --relay-key=<key>         Key (hex, up to 7fffff) relays connect to the server with. Without it, the server refuses relays.
+  --port=<port>             The server's port in the analyzed capture. [default: 8192]
+  --output=<file>           Where to write the analysis (JSON). [default: analysis.json]
+  --count=<n>               Number of bots. [default: 8]
+  --script=<file>           What the bots do. [default: media/bots.lua]
+  --duration=<seconds>      Stop the bots after this long, 0 to run forever. [default: 0]
+  --listen=<host>           Where the relay accepts spectators. [default: 0.0.0.0]
+  --listen-port=<port>      The port the relay accepts spectators on. [default: 8193]
+  --max-spectators=<n>      Maximum number of spectators on the relay. [default: 64]
+  --delay=<seconds>         How far spectators are behind the game. [default: 0]
 )"s;
 
 Port getPort(const std::map<std::string, docopt::value>& args)
@@ -56,6 +88,16 @@ uint32_t getGameCode(const std::map<std::string, docopt::value>& args)
     return 0;
 }
 
+uint32_t getRelayKey(const std::map<std::string, docopt::value>& args)
+{
+    const auto relayKey = parseInt<uint32_t>(args.at("--relay-key").asString(), 16);
+    if (!relayKey || *relayKey > maxRelayKey) {
+        printErr("Relay key must be in [0, {:x}]\n{}", maxRelayKey, usage);
+        std::exit(255);
+    }
+    return *relayKey;
+}
+
 float getExitTimeout(const std::map<std::string, docopt::value>& args)
 {
     const auto timeout = parseFloat(args.at("--exit-timeout").asString());
@@ -66,9 +108,68 @@ float getExitTimeout(const std::map<std::string, docopt::value>& args)
     return *timeout;
 }
 
+float getSimulationArg(const std::map<std::string, docopt::value>& args, const std::string& name,
+    float scale, float max = std::numeric_limits<float>::max())
+{
+    if (!args.at(name))
+        return 0.0f;
+    const auto value = parseFloat(args.at(name).asString());
+    // NaN would pass the range check
+    if (!value || !std::isfinite(*value) || *value < 0.0f || *value > max) {
+        printErr("{} must be in [0, {}]\n{}", name, max, usage);
+        std::exit(255);
+    }
+    return *value * scale;
+}
+
+enet::NetworkConditions getNetworkConditions(const std::map<std::string, docopt::value>& args)
+{
+    enet::NetworkConditions conditions;
+    conditions.latency = getSimulationArg(args, "--sim-latency", 0.001f);
+    conditions.jitter = getSimulationArg(args, "--sim-jitter", 0.001f);
+    conditions.loss = getSimulationArg(args, "--sim-loss", 0.01f, 100.0f);
+    conditions.duplication = getSimulationArg(args, "--sim-duplicate", 0.01f, 100.0f);
+    conditions.reordering = getSimulationArg(args, "--sim-reorder", 0.01f, 100.0f);
+    conditions.bandwidth = getSimulationArg(args, "--sim-bandwidth", 1.0f);
+    return conditions;
+}
+
+ServerOptions getServerOptions(const std::map<std::string, docopt::value>& args)
+{
+    ServerOptions options;
+    const auto maxPlayers = parseInt<uint8_t>(args.at("--max-players").asString());
+    if (!maxPlayers || *maxPlayers == 0) {
+        printErr("Max players must be in [1, {}]\n{}", maxPlayersLimit, usage);
+        std::exit(255);
+    }
+    options.maxPlayers = *maxPlayers;
+    options.inputCommands = args.at("--input-commands").asBool();
+    const auto snapshotRate = parseFloat(args.at("--snapshot-rate").asString());
+    if (!snapshotRate || *snapshotRate <= 0.0f || *snapshotRate > tickRate) {
+        printErr("Snapshot rate must be in (0, {}]\n{}", tickRate, usage);
+        std::exit(255);
+    }
+    options.snapshotRate = *snapshotRate;
+    const auto clientBandwidth = parseInt<uint32_t>(args.at("--client-bandwidth").asString());
+    if (!clientBandwidth || *clientBandwidth == 0) {
+        printErr("Client bandwidth must be a positive integer\n{}", usage);
+        std::exit(255);
+    }
+    options.clientBandwidth = static_cast<float>(*clientBandwidth);
+    options.networkConditions = getNetworkConditions(args);
+    if (args.at("--record"))
+        options.recordPath = args.at("--record").asString();
+    if (args.at("--stats"))
+        options.statsPath = args.at("--stats").asString();
+    if (args.at("--relay-key"))
+        options.relayKey = getRelayKey(args);
+    return options;
+}
+
 int main(int argc, char** argv)
 {
-    if (enet_initialize()) {
+    const ENetCallbacks callbacks { pool::allocate, pool::deallocate, nullptr };
+    if (enet_initialize_with_callbacks(ENET_VERSION, &callbacks)) {
         printErr("Could not initialize ENet");
         return 1;
     }
@@ -82,8 +183,9 @@ int main(int argc, char** argv)
         Server server;
         std::atomic<bool> serverFailed { false };
         float exitTimeout = getExitTimeout(args);
-        std::thread serverThread([&server, &serverFailed, exitTimeout]() {
-            if (!server.run("127.0.0.1", 8192, 0, exitTimeout))
+        const auto options = getServerOptions(args);
+        std::thread serverThread([&server, &serverFailed, exitTimeout, options]() {
+            if (!server.run("127.0.0.1", 8192, 0, exitTimeout, options))
                 serverFailed.store(true);
         });
 
@@ -99,7 +201,8 @@ int main(int argc, char** argv)
         println("Server started");
 
         Client client;
-        const auto res = client.run(HostPort { "127.0.0.1", 8192 }, 0);
+        const auto res
+            = client.run(HostPort { "127.0.0.1", 8192 }, 0, getNetworkConditions(args));
         if (!res) {
             printErr("Error starting client");
         }
@@ -112,8 +215,8 @@ int main(int argc, char** argv)
         return res ? 0 : 1;
     } else if (args.at("connect").asBool()) {
         Client client;
-        const auto res = client.run(
-            HostPort { args.at("<host>").asString(), getPort(args) }, getGameCode(args));
+        const auto res = client.run(HostPort { args.at("<host>").asString(), getPort(args) },
+            getGameCode(args), getNetworkConditions(args));
         if (!res) {
             printErr("Error starting client");
         }
@@ -121,13 +224,85 @@ int main(int argc, char** argv)
         return res ? 0 : 1;
     } else if (args.at("server").asBool()) {
         Server server;
-        const auto res = server.run(
-            args.at("<host>").asString(), getPort(args), getGameCode(args), getExitTimeout(args));
+        const auto res = server.run(args.at("<host>").asString(), getPort(args), getGameCode(args),
+            getExitTimeout(args), getServerOptions(args));
         if (!res) {
             printErr("Error starting server");
         }
         println("Server stopped");
         return res ? 0 : 1;
+    } else if (args.at("replay").asBool()) {
+        Server server;
+        const auto res = server.replay(args.at("<file>").asString());
+        if (!res) {
+            printErr("Error replaying recording");
+        }
+        return res ? 0 : 1;
+    } else if (args.at("analyze").asBool()) {
+        const auto path = args.at("<file>").asString();
+        TrafficAnalysis analysis;
+        bool res = false;
+        if (isPcapFile(path)) {
+            const auto port = parseInt<uint16_t>(args.at("--port").asString());
+            if (!port) {
+                printErr("Port must be in [0, 65535]\n{}", usage);
+                return 255;
+            }
+            res = analyzePcap(path, *port, analysis);
+        } else {
+            Server server;
+            res = server.replay(path, &analysis);
+        }
+        if (!res) {
+            printErr("Error analyzing '{}'", path);
+            return 1;
+        }
+        analysis.printSummary();
+        const auto output = args.at("--output").asString();
+        std::ofstream file(output);
+        file << analysis.toJson(path);
+        if (!file) {
+            printErr("Could not write '{}'", output);
+            return 1;
+        }
+        println("Wrote analysis to '{}'", output);
+        return 0;
+    } else if (args.at("bots").asBool()) {
+        const auto count = parseInt<uint32_t>(args.at("--count").asString());
+        const auto duration = parseFloat(args.at("--duration").asString());
+        if (!count || *count == 0 || !duration || *duration < 0.0f) {
+            printErr("Count must be positive and duration must not be negative\n{}", usage);
+            return 255;
+        }
+        const auto script = BotScript::load(args.at("--script").asString());
+        if (!script)
+            return 1;
+        BotSwarm bots(*script);
+        const auto res = bots.run(HostPort { args.at("<host>").asString(), getPort(args) },
+            getGameCode(args), *count, *duration);
+        return res ? 0 : 1;
+    } else if (args.at("relay").asBool()) {
+        const auto listenPort = parseInt<uint16_t>(args.at("--listen-port").asString());
+        const auto maxSpectators = parseInt<uint32_t>(args.at("--max-spectators").asString());
+        const auto delay = parseFloat(args.at("--delay").asString());
+        const auto snapshotRate = parseFloat(args.at("--snapshot-rate").asString());
+        if (!listenPort || !maxSpectators || !delay || !snapshotRate) {
+            printErr("Invalid relay options\n{}", usage);
+            return 255;
+        }
+        RelayOptions options;
+        options.maxSpectators = *maxSpectators;
+        options.delay = *delay;
+        options.snapshotRate = *snapshotRate;
+        options.relayKey = getRelayKey(args);
+        Relay relay;
+        const auto res = relay.run(HostPort { args.at("<host>").asString(), getPort(args) },
+            getGameCode(args), args.at("--listen").asString(), *listenPort, options);
+        if (!res) {
+            printErr("Error running relay");
+        }
+        println("Relay stopped");
+        return res ? 0 : 1;
     } else {
         Client client;
         const auto res = client.run(std::nullopt, 0);
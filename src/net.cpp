@@ -1,5 +1,44 @@
 #include "net.hpp"
 
+#include <algorithm>
+
+SymbolTable::SymbolTable(std::vector<std::string> names)
+    : names_(std::move(names))
+{
+    assert(names_.size() <= InvalidId);
+}
+
+SymbolTable::Id SymbolTable::getId(const std::string& name) const
+{
+    // These tables are small and this is not called every tick
+    for (size_t i = 0; i < names_.size(); ++i) {
+        if (names_[i] == name)
+            return static_cast<Id>(i);
+    }
+    return InvalidId;
+}
+
+const std::string& SymbolTable::getName(Id id) const
+{
+    assert(isValid(id));
+    return names_[id];
+}
+
+bool SymbolTable::isValid(Id id) const
+{
+    return id < names_.size();
+}
+
+size_t SymbolTable::getSize() const
+{
+    return names_.size();
+}
+
+const std::vector<std::string>& SymbolTable::getNames() const
+{
+    return names_;
+}
+
 std::string asString(MessageType messageType)
 {
     switch (messageType) {
@@ -25,19 +64,148 @@ std::string asString(MessageType messageType)
         return "ClientPlaySound";
     case MessageType::ServerUpdateInputEnabled:
         return "ServerUpdateInputEnabled";
+    case MessageType::ServerUpdateShipState:
+        return "ServerUpdateShipState";
+    case MessageType::ClientInputCommand:
+        return "ClientInputCommand";
+    case MessageType::ClientTimeSync:
+        return "ClientTimeSync";
+    case MessageType::ServerTimeSync:
+        return "ServerTimeSync";
     default:
         return fmt::format("Unknown({})", static_cast<uint8_t>(messageType));
     }
 }
 
-uint32_t getChannelFlags(Channel channel)
+const ChannelProperties& getChannelProperties(Channel channel)
 {
+    static const ChannelProperties unreliable { ENET_PACKET_FLAG_UNSEQUENCED, 0, 1.0f, false };
+    static const ChannelProperties control { ENET_PACKET_FLAG_RELIABLE, 0, 1.0f, false };
+    static const ChannelProperties event { ENET_PACKET_FLAG_RELIABLE, 1, 0.75f, false };
+    // Leaves room in the window for the other lanes, even if there is a lot of output
+    static const ChannelProperties bulk { ENET_PACKET_FLAG_RELIABLE, 2, 0.5f, true };
     switch (channel) {
     case Channel::Unreliable:
-        return ENET_PACKET_FLAG_UNSEQUENCED;
-    case Channel::Reliable:
-        return ENET_PACKET_FLAG_RELIABLE;
+        return unreliable;
+    case Channel::Control:
+        return control;
+    case Channel::Event:
+        return event;
+    case Channel::Bulk:
+        return bulk;
     default:
         std::abort();
     }
 }
+
+uint32_t getChannelFlags(Channel channel)
+{
+    return getChannelProperties(channel).flags;
+}
+
+std::string asString(Channel channel)
+{
+    switch (channel) {
+    case Channel::Unreliable:
+        return "Unreliable";
+    case Channel::Control:
+        return "Control";
+    case Channel::Event:
+        return "Event";
+    case Channel::Bulk:
+        return "Bulk";
+    default:
+        return fmt::format("Unknown({})", static_cast<uint8_t>(channel));
+    }
+}
+
+void printCompressionStats(const LaneCompressionStats& stats)
+{
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const auto& lane = stats[i];
+        if (lane.messages == 0)
+            continue;
+        println("{} lane: {} messages ({} compressed), {} -> {} bytes (ratio {:.2f}), {:.1f} ms",
+            asString(static_cast<Channel>(i)), lane.messages, lane.compressedMessages,
+            lane.rawBytes, lane.wireBytes, lane.getRatio(), lane.time * 1000.0);
+    }
+}
+
+bool isChunk(const uint8_t* data, size_t size)
+{
+    return size > 0 && data[0] == chunkMarker;
+}
+
+std::vector<enet::Packet> createPackets(
+    Channel channel, const uint8_t* data, size_t size, size_t chunkSize)
+{
+    const auto flags = getChannelFlags(channel);
+    std::vector<enet::Packet> packets;
+    if (size <= chunkSize || !(flags & ENET_PACKET_FLAG_RELIABLE)) {
+        packets.emplace_back(data, size, flags);
+        return packets;
+    }
+    if (size > maxChunkedMessageSize) {
+        printErr("Message is too big to send ({} bytes)", size);
+        return packets;
+    }
+    packets.reserve((size + chunkSize - 1) / chunkSize);
+    WriteBuffer buffer(chunkSize + 2 * maxVarintBytes + 1);
+    for (size_t offset = 0; offset < size; offset += chunkSize) {
+        buffer.clear();
+        ChunkHeader header { chunkMarker, static_cast<uint32_t>(size),
+            static_cast<uint32_t>(offset) };
+        serialize(buffer, header);
+        buffer.write(data + offset, std::min(chunkSize, size - offset));
+        packets.emplace_back(buffer.getData(), buffer.getSize(), flags);
+    }
+    return packets;
+}
+
+bool ChunkAssembler::add(
+    Channel channel, const uint8_t* data, size_t size, std::vector<uint8_t>& message)
+{
+    auto& partial = messages_[static_cast<size_t>(channel)];
+    ReadBuffer buffer(data, size);
+    ChunkHeader header;
+    if (!deserialize(buffer, header) || header.marker != chunkMarker
+        || header.messageSize > maxChunkedMessageSize || buffer.getLeft() == 0
+        || header.offset + buffer.getLeft() > header.messageSize) {
+        partial = PartialMessage {};
+        return false;
+    }
+    if (header.offset == 0) {
+        partial.data.clear();
+        partial.data.reserve(header.messageSize);
+        partial.size = header.messageSize;
+    } else if (header.messageSize != partial.size || header.offset != partial.data.size()) {
+        partial = PartialMessage {};
+        return false;
+    }
+    partial.data.insert(partial.data.end(), data + buffer.getCursor(), data + size);
+    if (partial.data.size() == partial.size) {
+        message = std::move(partial.data);
+        partial = PartialMessage {};
+    }
+    return true;
+}
+
+bool sendBuffer(ENetPeer* peer, Channel channel, const WriteBuffer& buffer)
+{
+    auto packets = createPackets(channel, buffer.getData(), buffer.getSize());
+    if (packets.empty())
+        return false;
+    for (auto& packet : packets) {
+        if (!packet.get()) {
+            printErr("Could not create packet");
+            return false;
+        }
+        // The peer takes its own reference, so the wrapper only destroys it if sending failed
+        const auto res = enet_peer_send(peer, static_cast<uint8_t>(channel), packet.get());
+        if (res < 0) {
+            printErr("Error sending message of type {}", buffer.getData()[0]);
+            return false;
+        }
+    }
+    return true;
+}
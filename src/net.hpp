@@ -1,32 +1,100 @@
 #pragma once
 
+#include <array>
 #include <unordered_map>
 
 #include <fmt/format.h>
 
+#include "compression.hpp"
 #include "enet.hpp"
 #include "serialization.hpp"
 #include "shipsystem.hpp"
 #include "util.hpp"
 #include "version.hpp"
 
-static constexpr size_t maxPlayers = 4;
+static constexpr size_t defaultMaxPlayers = 4;
+// A full ServerPlayerStateUpdate of this many players is already a lot bigger than a datagram
+static constexpr size_t maxPlayersLimit = 255;
 static constexpr size_t tickRate = 60;
+static constexpr float defaultClientBandwidth = 64.0f * 1024.0f; // bytes per second
+
+// Positions are quantized to this resolution inside a cube of this half-extent (the ship fits
+// comfortably). This results in 17 bits per component.
+static constexpr float maxCoordinate = 256.0f;
+static constexpr float positionResolution = 1.0f / 128.0f;
+
+// How many past snapshots are kept as potential delta baselines (a little more than a second)
+static constexpr size_t snapshotBufferSize = 64;
+static constexpr auto InvalidFrame = std::numeric_limits<uint32_t>::max();
+
+// Velocities are only sent for the own player in input command mode (for replaying inputs)
+static constexpr float maxVelocity = 16.0f;
+static constexpr float velocityResolution = 1.0f / 256.0f;
+static constexpr auto InvalidInputSequence = std::numeric_limits<uint32_t>::max();
+static constexpr size_t maxRedundantInputs = 8;
 
 using PlayerId = uint32_t;
 static constexpr auto InvalidPlayerId = std::numeric_limits<PlayerId>::max();
 
+// Names that are sent often (ship systems, sounds) are sent as an index into a table instead,
+// which the server sends once with ServerHello.
+class SymbolTable {
+public:
+    using Id = uint8_t;
+    // Ids are sent as a single byte and the last one is reserved for InvalidId
+    static constexpr auto InvalidId = std::numeric_limits<Id>::max();
+
+    SymbolTable() = default;
+    SymbolTable(std::vector<std::string> names);
+
+    // Returns InvalidId for unknown names
+    Id getId(const std::string& name) const;
+    const std::string& getName(Id id) const;
+    bool isValid(Id id) const;
+    size_t getSize() const;
+    const std::vector<std::string>& getNames() const;
+
+private:
+    std::vector<std::string> names_;
+};
+
+using SystemId = SymbolTable::Id;
+using SoundId = SymbolTable::Id;
+
 struct HostPort {
     std::string host;
     Port port;
 };
 
+// Reliable messages are only ordered within their channel, so they are split into lanes that
+// can not hold up each other.
 enum class Channel : uint8_t {
     Unreliable = 0,
-    Reliable = 1,
+    Control, // handshake and terminal interaction
+    Event, // ship state and sounds
+    Bulk, // terminal output and history
     Count,
 };
 
+struct ChannelProperties {
+    uint32_t flags; // ENet packet flags, which also decide ordering
+    // Lanes that are held back (see LaneScheduler) are passed to ENet in this order, lowest first
+    uint8_t priority;
+    // Held back packets are only passed to ENet while less than this share of the peer's reliable
+    // window is in flight. If it is 1 or more, packets are sent right away.
+    float windowShare;
+    // See compression.hpp
+    bool compressed;
+};
+
+const ChannelProperties& getChannelProperties(Channel channel);
+
+std::string asString(Channel channel);
+
+using LaneCompressionStats = std::array<CompressionStats, static_cast<size_t>(Channel::Count)>;
+
+void printCompressionStats(const LaneCompressionStats& stats);
+
 uint32_t getChannelFlags(Channel channel);
 
 struct CommonMessageHeader {
@@ -54,6 +122,9 @@ enum class MessageType : uint8_t {
     ClientPlaySound,
     ServerUpdateInputEnabled,
     ServerUpdateShipState,
+    ClientInputCommand,
+    ClientTimeSync,
+    ServerTimeSync,
 };
 
 std::string asString(MessageType messageType);
@@ -66,12 +137,21 @@ struct Message<MessageType::ServerHello> {
     uint32_t playerId;
     glm::vec3 spawnPosition;
     glm::quat spawnOrientation;
+    // If true, the client sends ClientInputCommand instead of ClientMoveUpdate and the server
+    // simulates the movement.
+    bool inputCommands;
+    // Indexed by SystemId and SoundId respectively
+    std::vector<std::string> systems;
+    std::vector<std::string> sounds;
 
     SERIALIZE()
     {
         FIELD(playerId);
-        FIELD(spawnPosition);
+        FIELD_QUANTIZED(spawnPosition, -maxCoordinate, maxCoordinate, positionResolution);
         FIELD(spawnOrientation);
+        FIELD(inputCommands);
+        FIELD_VEC(systems);
+        FIELD_VEC(sounds);
         SERIALIZE_END;
     }
 };
@@ -80,43 +160,101 @@ template <>
 struct Message<MessageType::ClientMoveUpdate> {
     glm::vec3 position;
     glm::quat orientation;
+    uint32_t snapshotAck; // frame number of the last player state update that was received
 
     SERIALIZE()
     {
-        FIELD(position);
+        FIELD_QUANTIZED(position, -maxCoordinate, maxCoordinate, positionResolution);
         FIELD(orientation);
+        FIELD(snapshotAck);
         SERIALIZE_END;
     }
 };
 
+// Sent when there is a new input or as a heartbeat. Besides the newest input, it repeats the
+// previous ones that have not been acknowledged yet (up to maxRedundantInputs), so the server can
+// make up for lost packets without retransmits.
+template <>
+struct Message<MessageType::ClientInputCommand> {
+    struct Input {
+        uint8_t buttons; // MoveInput::Buttons
+        // The look direction is sent as an absolute orientation rather than a delta, so a lost
+        // command does not make the server look elsewhere permanently.
+        glm::quat orientation;
+
+        SERIALIZE()
+        {
+            FIELD(buttons);
+            FIELD(orientation);
+            SERIALIZE_END;
+        }
+    };
+
+    uint32_t sequence; // of the last input, the ones before have consecutive sequence numbers
+    std::vector<Input> inputs; // oldest first, might be empty
+    uint32_t snapshotAck;
+
+    SERIALIZE()
+    {
+        FIELD(sequence);
+        FIELD_VEC(inputs);
+        FIELD(snapshotAck);
+        SERIALIZE_END;
+    }
+};
+
+// This is a delta against the snapshot of frame (frameNumber - baselineAge), which the client has
+// acknowledged. If baselineAge is 0, this is a full snapshot.
+// Only players that changed are included and of those only the fields that changed.
 template <>
 struct Message<MessageType::ServerPlayerStateUpdate> {
     struct PlayerState {
-        uint32_t id;
+        enum Fields : uint8_t {
+            Position = 1 << 0,
+            Orientation = 1 << 1,
+            All = Position | Orientation,
+        };
+
+        PlayerId id;
+        uint8_t fields;
         glm::vec3 position;
         glm::quat orientation;
 
         SERIALIZE()
         {
             FIELD(id);
-            FIELD(position);
-            FIELD(orientation);
+            FIELD_BOUNDED(fields, 0, All);
+            if (fields & Position)
+                FIELD_QUANTIZED(position, -maxCoordinate, maxCoordinate, positionResolution);
+            if (fields & Orientation)
+                FIELD(orientation);
             SERIALIZE_END;
         }
     };
 
+    uint8_t baselineAge;
     std::vector<PlayerState> players;
+    std::vector<PlayerId> removedPlayers;
+    // In input command mode the sequence number of the last command the server has simulated for
+    // the receiving player and its velocity afterwards, so the client can replay the rest.
+    uint32_t inputAck = InvalidInputSequence;
+    glm::vec3 velocity;
 
     SERIALIZE()
     {
+        FIELD_BOUNDED(baselineAge, 0, snapshotBufferSize - 1);
         FIELD_VEC(players);
+        FIELD_VEC(removedPlayers);
+        FIELD(inputAck);
+        if (inputAck != InvalidInputSequence)
+            FIELD_QUANTIZED(velocity, -maxVelocity, maxVelocity, velocityResolution);
         SERIALIZE_END;
     }
 };
 
 template <>
 struct Message<MessageType::ClientInteractTerminal> {
-    std::string terminal;
+    SystemId terminal; // SymbolTable::InvalidId to stop using a terminal
 
     SERIALIZE()
     {
@@ -127,7 +265,7 @@ struct Message<MessageType::ClientInteractTerminal> {
 
 template <>
 struct Message<MessageType::ServerInteractTerminal> {
-    std::string terminal;
+    SystemId terminal;
     PlayerId user;
 
     SERIALIZE()
@@ -162,7 +300,7 @@ struct Message<MessageType::ClientExecuteCommand> {
 
 template <>
 struct Message<MessageType::ServerUpdateTerminalOutput> {
-    std::string terminal;
+    SystemId terminal;
     std::string text;
 
     SERIALIZE()
@@ -175,7 +313,7 @@ struct Message<MessageType::ServerUpdateTerminalOutput> {
 
 template <>
 struct Message<MessageType::ServerAddTerminalHistory> {
-    std::string terminal;
+    SystemId terminal;
     std::vector<std::string> commands;
 
     SERIALIZE()
@@ -188,20 +326,20 @@ struct Message<MessageType::ServerAddTerminalHistory> {
 
 template <>
 struct Message<MessageType::ClientPlaySound> {
-    std::string name;
+    SoundId sound;
     glm::vec3 position;
 
     SERIALIZE()
     {
-        FIELD(name);
-        FIELD(position);
+        FIELD(sound);
+        FIELD_QUANTIZED(position, -maxCoordinate, maxCoordinate, positionResolution);
         SERIALIZE_END;
     }
 };
 
 template <>
 struct Message<MessageType::ServerUpdateInputEnabled> {
-    std::string terminal;
+    SystemId terminal;
     bool enabled;
 
     SERIALIZE()
@@ -225,40 +363,163 @@ struct Message<MessageType::ServerUpdateShipState> {
     }
 };
 
+template <>
+struct Message<MessageType::ClientTimeSync> {
+    uint32_t clientTime; // getTimeSyncStamp
+
+    SERIALIZE()
+    {
+        FIELD(clientTime);
+        SERIALIZE_END;
+    }
+};
+
+// The answer to ClientTimeSync, sent as soon as it is received
+template <>
+struct Message<MessageType::ServerTimeSync> {
+    uint32_t clientTime; // from ClientTimeSync
+    uint32_t serverFrame;
+    float serverFrameFraction; // time since serverFrame started, in frames
+
+    SERIALIZE()
+    {
+        FIELD(clientTime);
+        FIELD(serverFrame);
+        FIELD(serverFrameFraction);
+        SERIALIZE_END;
+    }
+};
+
+// CommonMessageHeader is written with the byte streams
+static constexpr size_t commonMessageHeaderSize = sizeof(uint8_t) + sizeof(uint32_t);
+
+// Messages without strings, vectors and fields that are only sent depending on other fields always
+// have the same size, which is known at compile time.
+template <MessageType MsgType>
+constexpr bool hasFixedSize = MsgType == MessageType::ClientMoveUpdate
+    || MsgType == MessageType::ClientInteractTerminal
+    || MsgType == MessageType::ServerInteractTerminal || MsgType == MessageType::ClientPlaySound
+    || MsgType == MessageType::ServerUpdateInputEnabled
+    || MsgType == MessageType::ServerUpdateShipState || MsgType == MessageType::ClientTimeSync
+    || MsgType == MessageType::ServerTimeSync;
+
+// Including the header
+template <MessageType MsgType>
+constexpr size_t fixedMessageSize
+    = commonMessageHeaderSize + getFixedSerializedBitsSize<Message<MsgType>>();
+
+// The exact size of what serializeMessage returns
+template <MessageType MsgType>
+size_t getMessageSize(const Message<MsgType>& message)
+{
+    if constexpr (hasFixedSize<MsgType>)
+        return fixedMessageSize<MsgType>;
+    else
+        return commonMessageHeaderSize + getSerializedBitsSize(message);
+}
+
+// ENet's default MTU is 1400 bytes, so packets up to this size fit into a single datagram with all
+// the headers. Bigger unreliable packets are fragmented and lost if any fragment is lost.
+static constexpr size_t maxPacketSize = 1200;
+
+// Sent unreliably many times per second
+static_assert(fixedMessageSize<MessageType::ClientMoveUpdate> <= maxPacketSize);
+static_assert(fixedMessageSize<MessageType::ClientTimeSync> <= maxPacketSize);
+static_assert(fixedMessageSize<MessageType::ServerTimeSync> <= maxPacketSize);
+
+// The header is byte aligned, so it can be inspected without knowing the message type, the
+// message body itself is bit-packed.
 template <MessageType MsgType>
 WriteBuffer serializeMessage(uint32_t frameNumber, Message<MsgType> message)
 {
-    WriteBuffer buffer(1024);
+    WriteBuffer buffer(getMessageSize(message));
     CommonMessageHeader header { static_cast<uint8_t>(MsgType), frameNumber };
     if (!serialize(buffer, header)) {
         assert(false);
     }
-    if (!serialize(buffer, message)) {
+    if (!serializeBits(buffer, message)) {
         assert(false);
     }
     return buffer;
 }
 
+template <MessageType MsgType>
+bool deserializeMessage(ReadBuffer& buffer, Message<MsgType>& message)
+{
+    return deserializeBits(buffer, message);
+}
+
+// Reliable messages bigger than maxChunkSize (mostly terminal output dumps) are split into chunks,
+// which are sent one after another on the same channel. ENet would fragment them itself otherwise,
+// but then the whole message has to fit into the peer's reliable window at once, while chunks are
+// held back by the LaneScheduler one at a time, so the other lanes can get through in between.
+// Chunks are cut from the message as it is passed to ENet (so after compression) and start with
+// chunkMarker, which is neither a MessageType nor a compression encoding.
+static constexpr uint8_t chunkMarker = 0xff;
+// So a chunk including its header is not bigger than maxPacketSize
+static constexpr size_t maxChunkSize = maxPacketSize - 1 - 2 * maxVarintBytes;
+// Terminal output is decompressed to at most 64 KB, so anything much bigger is garbage
+static constexpr size_t maxChunkedMessageSize = 128 * 1024;
+
+struct ChunkHeader {
+    uint8_t marker = chunkMarker;
+    uint32_t messageSize; // of the whole message
+    uint32_t offset; // of this chunk in the message
+
+    SERIALIZE()
+    {
+        FIELD(marker);
+        FIELD_VARINT(messageSize);
+        FIELD_VARINT(offset);
+        SERIALIZE_END;
+    }
+};
+
+bool isChunk(const uint8_t* data, size_t size);
+
+// Returns the packets the message has to be sent as: just itself or its chunks. Reliable messages
+// bigger than maxChunkedMessageSize can not be reassembled, so there are none for them.
+std::vector<enet::Packet> createPackets(
+    Channel channel, const uint8_t* data, size_t size, size_t chunkSize = maxChunkSize);
+
+// Puts chunked messages back together. The channels are reliable and ordered, so the chunks of a
+// message arrive in order and without any other message of the same channel in between.
+class ChunkAssembler {
+public:
+    // Returns false if the chunk does not belong to the current message of its channel, which is
+    // dropped then. Once the last chunk of a message is added, the message is moved to message
+    // (which stays empty otherwise).
+    bool add(Channel channel, const uint8_t* data, size_t size, std::vector<uint8_t>& message);
+
+private:
+    struct PartialMessage {
+        std::vector<uint8_t> data;
+        size_t size = 0; // of the whole message, 0 if there is none
+    };
+
+    std::array<PartialMessage, static_cast<size_t>(Channel::Count)> messages_;
+};
+
+bool sendBuffer(ENetPeer* peer, Channel channel, const WriteBuffer& buffer);
+
 template <MessageType MsgType>
 bool sendMessage(
     ENetPeer* peer, Channel channel, uint32_t frameNumber, const Message<MsgType>& message)
 {
-    const auto buffer = serializeMessage(frameNumber, message);
-    const auto packet
-        = enet_packet_create(buffer.getData(), buffer.getSize(), getChannelFlags(channel));
-    if (!packet) {
-        printErr("Could not create packet");
-        return false;
-    }
-    const auto res = enet_peer_send(peer, static_cast<uint8_t>(channel), packet);
-    if (res < 0) {
-        printErr("Error sending message of type {}", MsgType);
-        return false;
-    }
-    return true;
+    return sendBuffer(peer, channel, serializeMessage(frameNumber, message));
 }
 
+// Set in the connect code by relays (see relay.hpp), which only watch. They see every player, so
+// instead of the game code they connect with a key the server has to be started with.
+static constexpr uint32_t spectatorConnectFlag = 1 << 8;
+static constexpr uint32_t maxRelayKey = (1 << 23) - 1;
+
 constexpr uint32_t getConnectCode(uint32_t gameCode)
 {
     return gameCode << 24 | version;
 }
+
+constexpr uint32_t getRelayConnectCode(uint32_t relayKey)
+{
+    return relayKey << 9 | spectatorConnectFlag | version;
+}
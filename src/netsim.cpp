@@ -0,0 +1,186 @@
+#include "netsim.hpp"
+
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#include "util.hpp"
+
+namespace enet {
+
+namespace {
+// If a wake datagram did not arrive after this long (it is loopback, but still UDP), send another
+constexpr auto maxWakeWait = 0.1;
+
+// The intercept callback only gets the ENetHost. It is only called from enet_host_service, so the
+// simulator servicing its host sets this instead of looking itself up for every datagram.
+// Client and server might run in different threads.
+thread_local NetworkSimulator* servicingSimulator = nullptr;
+
+bool operator==(const ENetAddress& a, const ENetAddress& b)
+{
+    return a.host == b.host && a.port == b.port;
+}
+}
+
+bool NetworkConditions::isEnabled() const
+{
+    return latency > 0.0f || jitter > 0.0f || loss > 0.0f || duplication > 0.0f
+        || reordering > 0.0f || bandwidth > 0.0f;
+}
+
+bool NetworkConditions::isValid() const
+{
+    const auto inRange
+        = [](float v, float max) { return std::isfinite(v) && v >= 0.0f && v <= max; };
+    const auto maxValue = std::numeric_limits<float>::max();
+    return inRange(latency, maxValue) && inRange(jitter, maxValue) && inRange(loss, 1.0f)
+        && inRange(duplication, 1.0f) && inRange(reordering, 1.0f) && inRange(bandwidth, maxValue);
+}
+
+NetworkSimulator::NetworkSimulator(ENetHost* host, const NetworkConditions& conditions)
+    : host_(host)
+    , conditions_(conditions)
+    , rng_(std::random_device()())
+{
+    // The wake datagrams are sent to this port, so the socket has to be bound already
+    if (enet_socket_get_address(host_->socket, &hostAddress_) < 0 || hostAddress_.port == 0) {
+        printErr("Could not get host address for network simulation");
+        return;
+    }
+    ENetAddress loopback;
+    enet_address_set_host(&loopback, "127.0.0.1");
+    if (hostAddress_.host == ENET_HOST_ANY)
+        hostAddress_.host = loopback.host;
+
+    wakeSocket_ = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+    loopback.port = 0;
+    if (wakeSocket_ == ENET_SOCKET_NULL || enet_socket_bind(wakeSocket_, &loopback) < 0
+        || enet_socket_get_address(wakeSocket_, &wakeAddress_) < 0) {
+        printErr("Could not create wake socket for network simulation");
+        if (wakeSocket_ != ENET_SOCKET_NULL)
+            enet_socket_destroy(wakeSocket_);
+        wakeSocket_ = ENET_SOCKET_NULL;
+        return;
+    }
+
+    host_->intercept = &NetworkSimulator::intercept;
+}
+
+NetworkSimulator::~NetworkSimulator()
+{
+    if (wakeSocket_ == ENET_SOCKET_NULL)
+        return;
+    host_->intercept = nullptr;
+    enet_socket_destroy(wakeSocket_);
+}
+
+NetworkSimulator::operator bool() const
+{
+    return wakeSocket_ != ENET_SOCKET_NULL;
+}
+
+int NetworkSimulator::service(ENetEvent* event, uint32_t timeoutMs)
+{
+    timeoutMs = update(timeoutMs);
+    const auto previous = std::exchange(servicingSimulator, this);
+    const auto res = enet_host_service(host_, event, timeoutMs);
+    servicingSimulator = previous;
+    return res;
+}
+
+uint32_t NetworkSimulator::update(uint32_t timeoutMs)
+{
+    const auto now = getSteadyTime();
+    if (pendingWakes_ > 0 && now - lastWakeTime_ > maxWakeWait)
+        pendingWakes_ = 0;
+
+    auto it = queue_.begin();
+    size_t due = 0;
+    while (it != queue_.end() && it->first <= now) {
+        ++it;
+        ++due;
+    }
+
+    static const uint8_t wake = 0;
+    ENetBuffer buffer { const_cast<uint8_t*>(&wake), sizeof(wake) };
+    for (; pendingWakes_ < due; ++pendingWakes_) {
+        if (enet_socket_send(wakeSocket_, &hostAddress_, &buffer, 1) < 0)
+            break;
+        lastWakeTime_ = now;
+    }
+
+    if (it != queue_.end()) {
+        const auto wait = static_cast<uint32_t>(std::ceil((it->first - now) * 1000.0));
+        timeoutMs = std::min(timeoutMs, wait);
+    }
+    return timeoutMs;
+}
+
+int NetworkSimulator::intercept(ENetHost* host, ENetEvent* /*event*/)
+{
+    if (!servicingSimulator || servicingSimulator->host_ != host)
+        return 0;
+    return servicingSimulator->intercept();
+}
+
+int NetworkSimulator::intercept()
+{
+    const auto now = getSteadyTime();
+    if (host_->receivedAddress == wakeAddress_) {
+        if (pendingWakes_ > 0)
+            pendingWakes_--;
+    } else {
+        enqueue(now);
+    }
+    // 0 makes ENet process what receivedData points to, 1 makes it skip the datagram
+    return release(now) ? 0 : 1;
+}
+
+void NetworkSimulator::enqueue(double now)
+{
+    if (chance(conditions_.loss))
+        return;
+
+    const auto copies = chance(conditions_.duplication) ? 2 : 1;
+    for (int i = 0; i < copies; ++i) {
+        std::uniform_real_distribution<float> jitter(0.0f, conditions_.jitter);
+        auto delay = conditions_.latency + jitter(rng_);
+        if (chance(conditions_.reordering))
+            delay += conditions_.latency + jitter(rng_);
+        auto time = now + delay;
+
+        if (conditions_.bandwidth > 0.0f) {
+            linkFreeTime_ = std::max(linkFreeTime_, now)
+                + static_cast<double>(host_->receivedDataLength) / conditions_.bandwidth;
+            time = std::max(time, linkFreeTime_);
+        }
+
+        const auto data = static_cast<const uint8_t*>(host_->receivedData);
+        queue_.emplace(time,
+            Datagram { host_->receivedAddress,
+                std::vector<uint8_t>(data, data + host_->receivedDataLength) });
+    }
+}
+
+bool NetworkSimulator::release(double now)
+{
+    if (queue_.empty() || queue_.begin()->first > now)
+        return false;
+    current_ = std::move(queue_.begin()->second);
+    queue_.erase(queue_.begin());
+    host_->receivedAddress = current_.address;
+    host_->receivedData = current_.data.data();
+    host_->receivedDataLength = current_.data.size();
+    return true;
+}
+
+bool NetworkSimulator::chance(float probability)
+{
+    if (probability <= 0.0f)
+        return false;
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    return dist(rng_) < probability;
+}
+
+}
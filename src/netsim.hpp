@@ -0,0 +1,72 @@
+#pragma once
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include <enet/enet.h>
+
+namespace enet {
+
+// Conditions simulated for the packets a host receives (so only one way). All zero means no
+// simulation.
+struct NetworkConditions {
+    float latency = 0.0f; // seconds
+    float jitter = 0.0f; // seconds, uniformly distributed on top of latency
+    float loss = 0.0f; // probability
+    float duplication = 0.0f; // probability
+    float reordering = 0.0f; // probability to be held back for another latency + jitter
+    float bandwidth = 0.0f; // bytes per second, 0 is unlimited
+
+    bool isEnabled() const;
+    // All finite and in range
+    bool isValid() const;
+};
+
+// This works on the datagram level, below everything ENet does, so interpolation, prediction and
+// congestion control see the same thing as with a bad real link.
+// Received datagrams are taken away from ENet with an intercept callback and held back in a queue.
+// When one is due, a wake datagram is sent to the host's own socket, so enet_host_service wakes up
+// and the intercept can swap in the delayed datagram instead.
+class NetworkSimulator {
+public:
+    NetworkSimulator(ENetHost* host, const NetworkConditions& conditions);
+    ~NetworkSimulator();
+
+    NetworkSimulator(const NetworkSimulator&) = delete;
+    NetworkSimulator& operator=(const NetworkSimulator&) = delete;
+
+    explicit operator bool() const;
+
+    // Use instead of enet_host_service for the host. It wakes up in time for the next datagram.
+    int service(ENetEvent* event, uint32_t timeoutMs);
+
+private:
+    struct Datagram {
+        ENetAddress address;
+        std::vector<uint8_t> data;
+    };
+
+    static int intercept(ENetHost* host, ENetEvent* event);
+
+    // Returns the timeout to pass to enet_host_service
+    uint32_t update(uint32_t timeoutMs);
+    int intercept();
+    void enqueue(double now);
+    bool release(double now);
+    bool chance(float probability);
+
+    ENetHost* host_;
+    NetworkConditions conditions_;
+    ENetSocket wakeSocket_ = ENET_SOCKET_NULL;
+    ENetAddress wakeAddress_;
+    ENetAddress hostAddress_;
+    std::multimap<double, Datagram> queue_; // by release time
+    Datagram current_; // ENet reads this while it processes it
+    double linkFreeTime_ = 0.0;
+    size_t pendingWakes_ = 0;
+    double lastWakeTime_ = 0.0;
+    std::default_random_engine rng_;
+};
+
+}
@@ -152,6 +152,12 @@ void integrationSystem(ecs::World& world, float dt)
         });
 }
 
+void integrate(ecs::World& world, ecs::EntityHandle entity, float dt)
+{
+    integrateCylinderColliders(world, entity, entity.get<comp::Velocity>(),
+        entity.get<comp::Transform>(), entity.get<comp::CylinderCollider>(), dt);
+}
+
 void comp::PlayerInputController::updateFromOrientation(const comp::Transform& trafo)
 {
     // glm::eulerAngles returns I don't even know what (some total bullshit)
@@ -176,6 +182,32 @@ void playerLookSystem(ecs::World& world, float dt)
 }
 
 void playerControlSystem(ecs::World& world, float dt)
+{
+    world.forEachEntity<comp::Transform, comp::Velocity, comp::PlayerInputController>(
+        [dt](comp::Transform& transform, comp::Velocity& velocity,
+            const comp::PlayerInputController& ctrl) {
+            applyMoveInput(velocity, getMoveInput(ctrl, transform), dt);
+        });
+}
+
+MoveInput getMoveInput(const comp::PlayerInputController& ctrl, const comp::Transform& transform)
+{
+    MoveInput input;
+    input.orientation = transform.getOrientation();
+    const auto set = [&input](bool state, MoveInput::Buttons button) {
+        if (state)
+            input.buttons |= button;
+    };
+    set(ctrl.forwards->getState(), MoveInput::Forwards);
+    set(ctrl.backwards->getState(), MoveInput::Backwards);
+    set(ctrl.left->getState(), MoveInput::Left);
+    set(ctrl.right->getState(), MoveInput::Right);
+    set(ctrl.sprint->getState(), MoveInput::Sprint);
+    set(ctrl.interact->getPressed(), MoveInput::Interact);
+    return input;
+}
+
+void applyMoveInput(comp::Velocity& velocity, const MoveInput& input, float dt)
 {
     static constexpr auto maxSpeed = 9.0f;
     static constexpr auto fastBoostFactor = 2;
@@ -183,34 +215,95 @@ void playerControlSystem(ecs::World& world, float dt)
     static constexpr auto friction = maxSpeed * 6.0f;
     static constexpr auto turnAroundFactor = 2.0f;
 
-    world.forEachEntity<comp::Transform, comp::Velocity, comp::PlayerInputController>(
-        [dt](comp::Transform& transform, comp::Velocity& velocity,
-            const comp::PlayerInputController& ctrl) {
-            const auto forward = ctrl.forwards->getState() - ctrl.backwards->getState();
-            const auto sideways = ctrl.right->getState() - ctrl.left->getState();
-            const auto move = glm::vec3(sideways, 0.0f, -forward); // forward is -z
+    const auto pressed = [&input](MoveInput::Buttons button) {
+        return (input.buttons & button) ? 1.0f : 0.0f;
+    };
+    const auto forward = pressed(MoveInput::Forwards) - pressed(MoveInput::Backwards);
+    const auto sideways = pressed(MoveInput::Right) - pressed(MoveInput::Left);
+    const auto move = glm::vec3(sideways, 0.0f, -forward); // forward is -z
 
-            auto currentMaxSpeed = maxSpeed;
-            if (ctrl.sprint->getState()) {
-                // currentMaxSpeed *= fastBoostFactor;
-            }
+    auto currentMaxSpeed = maxSpeed;
+    if (input.buttons & MoveInput::Sprint) {
+        // currentMaxSpeed *= fastBoostFactor;
+    }
 
-            if (glm::length(move) > 0.0f) {
-                auto moveWorld = transform.getOrientation() * move;
-                moveWorld.y = 0.0f;
-                velocity.value.y = 0.0f;
-                const auto dot = -glm::dot(safeNormalize(velocity.value), safeNormalize(moveWorld));
-                const auto factor = rescale(dot, -1.0f, 1.0f, 1.0f, turnAroundFactor);
-                velocity.value += moveWorld * factor * accell * dt;
-
-                const auto speed = glm::length(velocity.value);
-                if (speed > currentMaxSpeed) {
-                    velocity.value *= currentMaxSpeed / speed;
-                }
-            } else {
-                const auto speed = glm::length(velocity.value) + 1e-5f;
-                const auto dir = velocity.value / speed;
-                velocity.value -= dir * std::min(speed, friction * dt);
-            }
-        });
+    if (glm::length(move) > 0.0f) {
+        auto moveWorld = input.orientation * move;
+        moveWorld.y = 0.0f;
+        velocity.value.y = 0.0f;
+        const auto dot = -glm::dot(safeNormalize(velocity.value), safeNormalize(moveWorld));
+        const auto factor = rescale(dot, -1.0f, 1.0f, 1.0f, turnAroundFactor);
+        velocity.value += moveWorld * factor * accell * dt;
+
+        const auto speed = glm::length(velocity.value);
+        if (speed > currentMaxSpeed) {
+            velocity.value *= currentMaxSpeed / speed;
+        }
+    } else {
+        const auto speed = glm::length(velocity.value) + 1e-5f;
+        const auto dir = velocity.value / speed;
+        velocity.value -= dir * std::min(speed, friction * dt);
+    }
+}
+
+std::optional<LadderClimb> useLadder(ecs::World& world, ecs::EntityHandle entity)
+{
+    auto& trafo = entity.get<comp::Transform>();
+    const auto rayOrigin = trafo.getPosition() + glm::vec3(0.0f, cameraOffsetY, 0.0f);
+    const auto rayDir = trafo.getForward();
+    const auto hit = castRay(world, rayOrigin, rayDir);
+    if (!hit || hit->t > interactDistance)
+        return std::nullopt;
+    const auto ladder = hit->entity.getPtr<comp::Ladder>();
+    if (!ladder)
+        return std::nullopt;
+
+    // Sometimes we use a ladder, when we are too far away from it and end up teleporting into a
+    // wall. So first move closer to the ladder (along the ray, but don't change height).
+    const auto& collider = entity.get<comp::CylinderCollider>();
+    const auto dir = glm::vec3(rayDir.x, 0.0f, rayDir.z);
+    while (!findFirstCollision(world, entity, trafo, collider)) {
+        trafo.move(dir * 0.05f);
+    }
+
+    const auto deltaY = ladder->dir == comp::Ladder::Dir::Up ? 1.0f : -1.0f;
+    const auto delta = glm::vec3(0.0f, deltaY * floorHeight, 0.0f);
+    const auto startPos = trafo.getPosition();
+    trafo.setPosition(startPos + delta);
+    return LadderClimb { startPos, trafo.getPosition() };
+}
+
+std::optional<LadderClimb> simulatePlayer(
+    ecs::World& world, ecs::EntityHandle entity, const MoveInput& input, float dt)
+{
+    entity.get<comp::Transform>().setOrientation(input.orientation);
+    applyMoveInput(entity.get<comp::Velocity>(), input, dt);
+    integrate(world, entity, dt);
+    if (input.buttons & MoveInput::Interact)
+        return useLadder(world, entity);
+    return std::nullopt;
+}
+
+void approachTerminal(comp::Transform& transform, const comp::Transform& terminal, float dt)
+{
+    const auto targetDist = 2.5f;
+    auto targetPos = terminal.getPosition() - terminal.getForward() * targetDist;
+    targetPos.y = transform.getPosition().y;
+    const auto delta = targetPos - transform.getPosition();
+    const auto dist = glm::length(delta) + 1e-5f;
+    const auto dir = delta / dist;
+    const auto moveSpeed = 5.0f;
+    transform.move(dir * std::min(dist, moveSpeed * dt));
+
+    // Logically this is not very clean at all, but it looks better than the alternatives I have
+    // tried, so it is what I will use.
+    const auto currentLookPos = transform.getPosition() + transform.getForward() * targetDist;
+    auto targetLookPos = terminal.getPosition();
+    targetLookPos.y = transform.getPosition().y;
+    const auto lookPosDelta = targetLookPos - currentLookPos;
+    const auto lookPosDist = glm::length(lookPosDelta) + 1e-5f;
+    const auto lookPosDeltaDir = lookPosDelta / lookPosDist;
+    const auto lookAtPos
+        = currentLookPos + lookPosDeltaDir * std::min(lookPosDist, moveSpeed * 2.0f * dt);
+    transform.lookAt(lookAtPos);
 }
@@ -3,6 +3,7 @@
 #include <memory>
 
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #include <glwx.hpp>
 
@@ -93,3 +94,41 @@ void integrationSystem(ecs::World& world, float dt);
 
 void playerLookSystem(ecs::World& world, float dt);
 void playerControlSystem(ecs::World& world, float dt);
+
+// Player movement is split into these, so the server can simulate players from their input and
+// clients can predict the same movement locally.
+
+struct MoveInput {
+    enum Buttons : uint8_t {
+        Forwards = 1 << 0,
+        Backwards = 1 << 1,
+        Left = 1 << 2,
+        Right = 1 << 3,
+        Sprint = 1 << 4,
+        Interact = 1 << 5, // pressed this frame
+    };
+
+    uint8_t buttons = 0;
+    glm::quat orientation { 1.0f, 0.0f, 0.0f, 0.0f };
+};
+
+MoveInput getMoveInput(const comp::PlayerInputController& ctrl, const comp::Transform& transform);
+
+void applyMoveInput(comp::Velocity& velocity, const MoveInput& input, float dt);
+
+void integrate(ecs::World& world, ecs::EntityHandle entity, float dt);
+
+struct LadderClimb {
+    glm::vec3 start;
+    glm::vec3 end;
+};
+
+// Climbs the ladder the entity is looking at, if it is close enough
+std::optional<LadderClimb> useLadder(ecs::World& world, ecs::EntityHandle entity);
+
+// Simulates one tick of a player with a Transform, Velocity and CylinderCollider
+std::optional<LadderClimb> simulatePlayer(
+    ecs::World& world, ecs::EntityHandle entity, const MoveInput& input, float dt);
+
+// Walks up to the terminal and turns towards it
+void approachTerminal(comp::Transform& transform, const comp::Transform& terminal, float dt);
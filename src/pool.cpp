@@ -0,0 +1,148 @@
+#include "pool.hpp"
+
+#include <array>
+#include <cstdlib>
+#include <mutex>
+
+#include "util.hpp"
+
+namespace pool {
+
+namespace {
+// Usable bytes per block. ENet's own structures fit in the first few, packet data mostly in
+// the ones up to the MTU.
+constexpr std::array<size_t, 8> blockSizes { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+constexpr size_t largeClass = blockSizes.size(); // passed through to malloc
+constexpr size_t chunkSize = 64 * 1024;
+constexpr size_t minBlocksPerChunk = 16;
+
+// Every block starts with this, so deallocate knows where it belongs. It is padded to keep
+// the memory after it suitably aligned.
+struct alignas(std::max_align_t) Header {
+    size_t sizeClass;
+};
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// Every size class has its own mutex, so the client and server threads in solo mode rarely
+// wait on each other.
+struct SizeClass {
+    std::mutex mutex;
+    FreeBlock* freeList = nullptr;
+    size_t allocations = 0;
+    size_t inUse = 0;
+    size_t peakInUse = 0;
+    size_t capacity = 0;
+
+    void allocated()
+    {
+        allocations++;
+        inUse++;
+        peakInUse = std::max(peakInUse, inUse);
+    }
+};
+
+using Pool = std::array<SizeClass, blockSizes.size() + 1>;
+
+Pool& getPool()
+{
+    // Never destroyed, because ENet might free memory during static destruction
+    static auto pool = new Pool;
+    return *pool;
+}
+
+size_t getSizeClass(size_t size)
+{
+    for (size_t i = 0; i < blockSizes.size(); ++i) {
+        if (size <= blockSizes[i])
+            return i;
+    }
+    return largeClass;
+}
+
+bool grow(SizeClass& sizeClass, size_t blockSize)
+{
+    const auto stride = sizeof(Header) + blockSize;
+    const auto numBlocks = std::max(minBlocksPerChunk, chunkSize / stride);
+    auto chunk = static_cast<uint8_t*>(std::malloc(numBlocks * stride));
+    if (!chunk)
+        return false;
+    for (size_t i = 0; i < numBlocks; ++i) {
+        auto block = reinterpret_cast<FreeBlock*>(chunk + i * stride);
+        block->next = sizeClass.freeList;
+        sizeClass.freeList = block;
+    }
+    sizeClass.capacity += numBlocks;
+    return true;
+}
+}
+
+void* allocate(size_t size)
+{
+    const auto index = getSizeClass(size);
+    auto& sizeClass = getPool()[index];
+    Header* header = nullptr;
+    if (index == largeClass) {
+        header = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+        if (!header)
+            return nullptr;
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+        sizeClass.allocated();
+    } else {
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+        if (!sizeClass.freeList && !grow(sizeClass, blockSizes[index]))
+            return nullptr;
+        auto block = sizeClass.freeList;
+        sizeClass.freeList = block->next;
+        header = reinterpret_cast<Header*>(block);
+        sizeClass.allocated();
+    }
+    header->sizeClass = index;
+    return header + 1;
+}
+
+void deallocate(void* ptr)
+{
+    if (!ptr)
+        return;
+    auto header = static_cast<Header*>(ptr) - 1;
+    const auto index = header->sizeClass;
+    auto& sizeClass = getPool()[index];
+    std::lock_guard<std::mutex> lock(sizeClass.mutex);
+    sizeClass.inUse--;
+    if (index == largeClass) {
+        std::free(header);
+    } else {
+        auto block = reinterpret_cast<FreeBlock*>(header);
+        block->next = sizeClass.freeList;
+        sizeClass.freeList = block;
+    }
+}
+
+std::vector<SizeClassStats> getStats()
+{
+    std::vector<SizeClassStats> stats;
+    auto& pool = getPool();
+    for (size_t i = 0; i < pool.size(); ++i) {
+        std::lock_guard<std::mutex> lock(pool[i].mutex);
+        stats.push_back(SizeClassStats { i < blockSizes.size() ? blockSizes[i] : 0,
+            pool[i].allocations, pool[i].inUse, pool[i].peakInUse, pool[i].capacity });
+    }
+    return stats;
+}
+
+void printStats()
+{
+    println("ENet memory pool:");
+    for (const auto& stats : getStats()) {
+        if (stats.allocations == 0)
+            continue;
+        const auto name = stats.blockSize > 0 ? fmt::format("{} B", stats.blockSize) : "large";
+        println("  {:>7}: {} allocations, {} in use (peak {}), {} blocks", name, stats.allocations,
+            stats.inUse, stats.peakInUse, stats.capacity);
+    }
+}
+
+}
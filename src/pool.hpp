@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// A thread-safe allocator with free lists for a few size classes, which ENet uses for everything
+// (see main). Most of what ENet allocates (packets, outgoing and incoming commands,
+// acknowledgements) is small and short-lived. Blocks are carved out of bigger chunks that are never
+// given back, so long sessions do not fragment the heap and most allocations are just a pop from
+// a free list.
+namespace pool {
+
+struct SizeClassStats {
+    size_t blockSize; // 0 for allocations that are too big for any size class
+    size_t allocations; // in total
+    size_t inUse;
+    size_t peakInUse;
+    size_t capacity; // blocks
+};
+
+void* allocate(size_t size);
+void deallocate(void* ptr);
+
+std::vector<SizeClassStats> getStats();
+void printStats();
+
+}
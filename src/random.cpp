@@ -1,3 +1,3 @@
 #include "random.hpp"
 
-std::default_random_engine rng;
+thread_local std::default_random_engine rng;
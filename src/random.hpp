@@ -4,7 +4,9 @@
 #include <random>
 #include <type_traits>
 
-extern std::default_random_engine rng;
+// Every thread has its own, so the server's random sequence does not depend on what the client
+// does in solo mode (see Server::replay).
+extern thread_local std::default_random_engine rng;
 
 template <typename IntType>
 std::enable_if_t<std::is_integral_v<IntType>, IntType> rand(IntType min, IntType max)
@@ -0,0 +1,194 @@
+#include "recording.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#include "serialization.hpp"
+#include "util.hpp"
+
+namespace {
+constexpr uint32_t magic = 0x43585243; // "CXRC"
+constexpr size_t fileBufferSize = 64 * 1024;
+// Nothing ENet receives gets close to this, so bigger sizes mean the file is damaged
+constexpr uint32_t maxRecordDataSize = 16 * 1024 * 1024;
+}
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+bool Recorder::open(const std::string& path, const RecordingHeader& header)
+{
+    close();
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) {
+        printErr("Could not open '{}' for writing: {}", path, std::strerror(errno));
+        return false;
+    }
+    buffer_.resize(fileBufferSize);
+    std::setvbuf(file_, buffer_.data(), _IOFBF, buffer_.size());
+
+    writeInt(magic);
+    writeInt(header.version);
+    writeInt(header.randomSeed);
+    writeInt(header.maxPlayers);
+    writeInt(static_cast<uint8_t>(header.inputCommands));
+    writeFloat(header.snapshotRate);
+    writeFloat(header.clientBandwidth);
+    return true;
+}
+
+void Recorder::close()
+{
+    if (file_) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+Recorder::operator bool() const
+{
+    return file_ != nullptr;
+}
+
+void Recorder::tick(uint32_t frame)
+{
+    write(Record::Type::Tick, frame, InvalidPlayerId);
+}
+
+void Recorder::connect(uint32_t frame, PlayerId player, bool spectator)
+{
+    write(spectator ? Record::Type::ConnectSpectator : Record::Type::Connect, frame, player);
+}
+
+void Recorder::disconnect(uint32_t frame, PlayerId player)
+{
+    write(Record::Type::Disconnect, frame, player);
+}
+
+void Recorder::receive(
+    uint32_t frame, PlayerId player, uint8_t channel, const uint8_t* data, size_t size)
+{
+    if (!file_)
+        return;
+    write(Record::Type::Receive, frame, player);
+    writeInt(channel);
+    writeInt(static_cast<uint32_t>(size));
+    std::fwrite(data, 1, size, file_);
+}
+
+void Recorder::write(Record::Type type, uint32_t frame, PlayerId player)
+{
+    if (!file_)
+        return;
+    writeInt(static_cast<uint8_t>(type));
+    writeInt(frame);
+    if (type != Record::Type::Tick)
+        writeInt(player);
+}
+
+template <typename T>
+void Recorder::writeInt(T value)
+{
+    value = hton(value);
+    std::fwrite(&value, sizeof(T), 1, file_);
+}
+
+void Recorder::writeFloat(float value)
+{
+    const auto bits = htonf(value);
+    std::fwrite(&bits, sizeof(bits), 1, file_);
+}
+
+RecordingReader::~RecordingReader()
+{
+    if (file_)
+        std::fclose(file_);
+}
+
+std::optional<RecordingHeader> RecordingReader::open(const std::string& path)
+{
+    file_ = std::fopen(path.c_str(), "rb");
+    if (!file_) {
+        printErr("Could not open '{}': {}", path, std::strerror(errno));
+        return std::nullopt;
+    }
+    buffer_.resize(fileBufferSize);
+    std::setvbuf(file_, buffer_.data(), _IOFBF, buffer_.size());
+
+    uint32_t fileMagic = 0;
+    RecordingHeader header;
+    uint8_t inputCommands = 0;
+    if (!readInt(fileMagic) || fileMagic != magic) {
+        printErr("'{}' is not a recording", path);
+        return std::nullopt;
+    }
+    if (!readInt(header.version) || !readInt(header.randomSeed) || !readInt(header.maxPlayers)
+        || !readInt(inputCommands) || !readFloat(header.snapshotRate)
+        || !readFloat(header.clientBandwidth)) {
+        printErr("Recording header is incomplete");
+        return std::nullopt;
+    }
+    header.inputCommands = inputCommands != 0;
+    return header;
+}
+
+std::optional<Record> RecordingReader::next()
+{
+    uint8_t type = 0;
+    if (std::fread(&type, 1, 1, file_) != 1) {
+        atEnd_ = std::feof(file_);
+        return std::nullopt;
+    }
+    if (type > static_cast<uint8_t>(Record::Type::ConnectSpectator)) {
+        printErr("Invalid record type: {}", type);
+        return std::nullopt;
+    }
+
+    Record record { static_cast<Record::Type>(type), 0, InvalidPlayerId, 0, {} };
+    if (!readInt(record.frame))
+        return std::nullopt;
+    if (record.type == Record::Type::Tick)
+        return record;
+
+    if (!readInt(record.player))
+        return std::nullopt;
+    if (record.type != Record::Type::Receive)
+        return record;
+
+    uint32_t size = 0;
+    if (!readInt(record.channel) || !readInt(size))
+        return std::nullopt;
+    if (record.channel >= static_cast<uint8_t>(Channel::Count) || size > maxRecordDataSize) {
+        printErr("Invalid received message record");
+        return std::nullopt;
+    }
+    record.data.resize(size);
+    if (std::fread(record.data.data(), 1, size, file_) != size)
+        return std::nullopt;
+    return record;
+}
+
+bool RecordingReader::isAtEnd() const
+{
+    return atEnd_;
+}
+
+template <typename T>
+bool RecordingReader::readInt(T& value)
+{
+    if (std::fread(&value, sizeof(T), 1, file_) != 1)
+        return false;
+    value = ntoh(value);
+    return true;
+}
+
+bool RecordingReader::readFloat(float& value)
+{
+    uint32_t bits = 0;
+    if (std::fread(&bits, sizeof(bits), 1, file_) != 1)
+        return false;
+    value = ntohf(bits);
+    return true;
+}
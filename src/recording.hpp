@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "net.hpp"
+
+// A recording contains everything that reaches the server's game logic from the outside: every
+// tick, every connect and disconnect and every received message (as it arrived, so still
+// compressed). Everything else the server does only depends on these and the random seed, so
+// replaying a recording (see Server::replay) runs exactly the same session again.
+
+struct RecordingHeader {
+    uint32_t version = 0; // of the protocol, which the recorded messages use
+    uint32_t randomSeed = 0;
+    uint32_t maxPlayers = 0;
+    bool inputCommands = false;
+    float snapshotRate = 0.0f;
+    float clientBandwidth = 0.0f;
+};
+
+struct Record {
+    enum class Type : uint8_t { Tick = 0, Connect, Disconnect, Receive, ConnectSpectator };
+
+    Type type;
+    uint32_t frame;
+    PlayerId player = InvalidPlayerId; // not for Tick
+    uint8_t channel = 0; // only for Receive
+    std::vector<uint8_t> data; // only for Receive
+};
+
+class Recorder {
+public:
+    Recorder() = default;
+    ~Recorder();
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    bool open(const std::string& path, const RecordingHeader& header);
+    void close();
+
+    explicit operator bool() const;
+
+    // These do nothing if no file is open
+    void tick(uint32_t frame);
+    void connect(uint32_t frame, PlayerId player, bool spectator);
+    void disconnect(uint32_t frame, PlayerId player);
+    void receive(
+        uint32_t frame, PlayerId player, uint8_t channel, const uint8_t* data, size_t size);
+
+private:
+    void write(Record::Type type, uint32_t frame, PlayerId player);
+    template <typename T>
+    void writeInt(T value);
+    void writeFloat(float value);
+
+    std::FILE* file_ = nullptr;
+    // A recording gets a record every tick, so they are collected and written in large blocks
+    std::vector<char> buffer_;
+};
+
+class RecordingReader {
+public:
+    RecordingReader() = default;
+    ~RecordingReader();
+
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+
+    std::optional<RecordingHeader> open(const std::string& path);
+
+    // Returns nullopt at the end of the file or if it is damaged (see isAtEnd)
+    std::optional<Record> next();
+
+    bool isAtEnd() const;
+
+private:
+    template <typename T>
+    bool readInt(T& value);
+    bool readFloat(float& value);
+
+    std::FILE* file_ = nullptr;
+    std::vector<char> buffer_;
+    bool atEnd_ = false;
+};
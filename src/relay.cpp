@@ -0,0 +1,484 @@
+#include "relay.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+
+#include <fmt/format.h>
+
+#include "constants.hpp"
+#include "util.hpp"
+
+namespace {
+constexpr auto connectTimeout = 5.0; // seconds
+// The server hands out ids counting up from 0, so these will not collide with players
+constexpr PlayerId firstSpectatorId = 0x80000000;
+
+// Like ShipSystem does it, at a line break
+void truncateOutput(std::string& output)
+{
+    if (output.size() <= maxTerminalOutputSize)
+        return;
+    auto count = output.size() - maxTerminalOutputSize;
+    while (count < output.size() && output[count - 1] != '\n')
+        count++;
+    output.erase(0, count);
+}
+}
+
+bool Relay::run(const HostPort& server, uint32_t gameCode, const std::string& host, Port port,
+    const RelayOptions& options)
+{
+    if (options.maxSpectators == 0) {
+        printErr("Max spectators must be positive");
+        return false;
+    }
+    if (options.snapshotRate <= 0.0f || options.snapshotRate > tickRate) {
+        printErr("Snapshot rate must be in (0, {}]", tickRate);
+        return false;
+    }
+    if (options.delay < 0.0f) {
+        printErr("Delay must not be negative");
+        return false;
+    }
+    options_ = options;
+    delayFrames_ = options.delay * tickRate;
+    if (options.relayKey > maxRelayKey) {
+        printErr("Relay key must be at most {:x}", maxRelayKey);
+        return false;
+    }
+    connectCode_ = getConnectCode(gameCode);
+    relayConnectCode_ = getRelayConnectCode(options.relayKey);
+    nextSpectatorId_ = firstSpectatorId;
+
+    const auto serverAddr = enet::getAddress(server.host, server.port);
+    if (!serverAddr) {
+        printErr("Could not resolve server address");
+        return false;
+    }
+    upstreamHost_ = enet::Host(static_cast<uint8_t>(Channel::Count), 0, 0);
+    if (!upstreamHost_) {
+        printErr("Could not create upstream host");
+        return false;
+    }
+    upstream_ = upstreamHost_.connect(
+        *serverAddr, static_cast<uint8_t>(Channel::Count), relayConnectCode_);
+    if (!upstream_) {
+        printErr("Could not connect to server");
+        return false;
+    }
+
+    const auto addr = enet::getAddress(host, port);
+    if (!addr) {
+        printErr("Could not get address");
+        return false;
+    }
+    host_ = enet::Host(*addr, options.maxSpectators, static_cast<uint8_t>(Channel::Count));
+    if (!host_) {
+        printErr("Could not create relay host");
+        return false;
+    }
+
+    println("Relaying {}:{} on {}:{} with a delay of {}s..", server.host, server.port, host, port,
+        options.delay);
+
+    running_.store(true);
+    const auto start = getSteadyTime();
+    constexpr auto dt = 1.0 / tickRate;
+    auto nextTick = start;
+    while (running_.load()) {
+        const auto now = getSteadyTime();
+        if (!upstreamConnected_ && now - start > connectTimeout) {
+            printErr("Could not connect to server");
+            running_.store(false);
+            break;
+        }
+        if (now >= nextTick) {
+            tick(now);
+            upstreamHost_.flush();
+            host_.flush();
+            // Don't try to catch up, if this process was stalled
+            nextTick = std::max(nextTick + dt, now - dt);
+            continue;
+        }
+        processUpstreamEvents();
+        // Wait a little for spectators, but not so long that answers to time sync requests are
+        // late (in either direction)
+        const auto timeoutMs = static_cast<uint32_t>(std::min((nextTick - now) * 1000.0, 1.0));
+        processEnetEvents(timeoutMs);
+    }
+
+    for (const auto& [id, spectator] : spectators_)
+        enet_peer_disconnect(spectator.peer, 0);
+    host_.flush();
+    if (upstreamConnected_)
+        enet_peer_disconnect_now(upstream_, 0);
+    printCompressionStats(compressionStats_);
+    return upstreamConnected_;
+}
+
+void Relay::stop()
+{
+    running_.store(false);
+}
+
+void* Relay::getPeerData(PlayerId id)
+{
+    return reinterpret_cast<void*>(static_cast<uintptr_t>(id));
+}
+
+PlayerId Relay::getSpectatorId(const void* peerData)
+{
+    return static_cast<PlayerId>(reinterpret_cast<uintptr_t>(peerData));
+}
+
+void Relay::processUpstreamEvents()
+{
+    for (auto event = upstreamHost_.service(); event; event = upstreamHost_.service()) {
+        if (std::holds_alternative<enet::ConnectEvent>(*event)) {
+            println("Connected to server");
+            upstreamConnected_ = true;
+        } else if (std::holds_alternative<enet::DisconnectEvent>(*event)) {
+            printErr("Disconnected from server");
+            running_.store(false);
+            return;
+        } else if (const auto recvEvent = std::get_if<enet::ReceiveEvent>(&event.value())) {
+            receiveUpstream(recvEvent->channelId, std::move(recvEvent->packet));
+        } else if (const auto errEvent = std::get_if<enet::ServiceFailedEvent>(&event.value())) {
+            printErr("Upstream host service failed: {}", errEvent->result);
+            return;
+        }
+    }
+}
+
+void Relay::receiveUpstream(uint8_t channelId, enet::Packet&& packet)
+{
+    if (channelId >= static_cast<uint8_t>(Channel::Count))
+        return;
+    const auto channel = static_cast<Channel>(channelId);
+    if (isChunk(packet.getData<uint8_t>(), packet.getSize())) {
+        std::vector<uint8_t> message;
+        if (!upstreamChunks_.add(channel, packet.getData<uint8_t>(), packet.getSize(), message))
+            printErr("Invalid message chunk");
+        else if (!message.empty())
+            receiveUpstream(channelId,
+                enet::Packet(message.data(), message.size(), getChannelFlags(channel)));
+        return;
+    }
+    std::optional<std::vector<uint8_t>> decompressed;
+    if (getChannelProperties(channel).compressed) {
+        decompressed = decompressMessage(packet.getData<uint8_t>(), packet.getSize(),
+            compressionStats_[static_cast<size_t>(channel)]);
+        if (!decompressed) {
+            printErr("Could not decompress message");
+            return;
+        }
+    }
+    ReadBuffer buffer = decompressed
+        ? ReadBuffer(decompressed->data(), decompressed->size())
+        : ReadBuffer(packet.getData<uint8_t>(), packet.getSize());
+    CommonMessageHeader header;
+    if (!deserialize(buffer, header)) {
+        printErr("Could not decode common message header");
+        return;
+    }
+    const auto messageType = static_cast<MessageType>(header.messageType);
+
+    if (messageType == MessageType::ServerHello) {
+        Message<MessageType::ServerHello> message;
+        if (!deserializeMessage(buffer, message)) {
+            printErr("Could not decode message of type {}", asString(messageType));
+            return;
+        }
+        hello_ = std::move(message);
+        systems_.resize(hello_->systems.size());
+        for (auto& [earlyChannel, earlyPacket] : std::exchange(earlyPackets_, {}))
+            receiveUpstream(earlyChannel, std::move(earlyPacket));
+        return;
+    }
+    if (!hello_) {
+        earlyPackets_.emplace_back(channelId, std::move(packet));
+        return;
+    }
+
+    if (messageType == MessageType::ServerTimeSync) {
+        Message<MessageType::ServerTimeSync> message;
+        if (!deserializeMessage(buffer, message))
+            return;
+        const auto now = getSteadyTime();
+        const auto requestTime = now - getTimeSyncStampAge(message.clientTime, now);
+        clockSync_.addSample(requestTime, now,
+            static_cast<double>(message.serverFrame) + message.serverFrameFraction);
+        return;
+    }
+
+    DelayedMessage delayed { header.frameNumber, channel, messageType,
+        std::vector<uint8_t>(
+            packet.getData<uint8_t>(), packet.getData<uint8_t>() + packet.getSize()),
+        std::nullopt };
+    if (messageType == MessageType::ServerPlayerStateUpdate) {
+        Message<MessageType::ServerPlayerStateUpdate> message;
+        if (!deserializeMessage(buffer, message))
+            return;
+        auto snapshot = applyDelta(header.frameNumber, message, upstreamSnapshots_);
+        if (!snapshot)
+            return;
+        upstreamSnapshots_.add(*snapshot);
+        if (upstreamSnapshotAck_ == InvalidFrame || header.frameNumber > upstreamSnapshotAck_)
+            upstreamSnapshotAck_ = header.frameNumber;
+        // The spectators get their own deltas, so the packet is not needed
+        delayed.packet.clear();
+        delayed.snapshot = std::move(snapshot);
+    }
+    delayed_.push_back(std::move(delayed));
+}
+
+void Relay::processEnetEvents(uint32_t timeoutMs)
+{
+    // Only the first call waits, afterwards the already received events are processed
+    for (auto event = host_.service(timeoutMs); event; event = host_.service()) {
+        if (const auto connEvent = std::get_if<enet::ConnectEvent>(&event.value())) {
+            // Relays can be chained, if they use the same key
+            if (connEvent->data != connectCode_ && connEvent->data != relayConnectCode_) {
+                enet_peer_disconnect_now(connEvent->peer, version);
+                continue;
+            }
+            const auto id = nextSpectatorId_++;
+            auto& spectator
+                = spectators_.emplace(id, Spectator { connEvent->peer, id }).first->second;
+            connEvent->peer->data = getPeerData(id);
+            const auto ip = enet::getIp(connEvent->peer->address).value();
+            println("Spectator connected from {}: id = {} ({} watching)", ip, spectator.id,
+                spectators_.size());
+            // Otherwise it is welcomed as soon as the relay got the hello itself
+            if (hello_)
+                welcome(spectator);
+        } else if (const auto discEvent = std::get_if<enet::DisconnectEvent>(&event.value())) {
+            const auto it = spectators_.find(getSpectatorId(discEvent->peerData));
+            if (it != spectators_.end()) {
+                println("Spectator disconnected (id = {})", it->second.id);
+                spectators_.erase(it);
+            }
+        } else if (const auto recvEvent = std::get_if<enet::ReceiveEvent>(&event.value())) {
+            const auto it = spectators_.find(getSpectatorId(recvEvent->peer->data));
+            if (it != spectators_.end())
+                receive(it->second, recvEvent->channelId, recvEvent->packet);
+        } else if (const auto errEvent = std::get_if<enet::ServiceFailedEvent>(&event.value())) {
+            printErr("Host service failed: {}", errEvent->result);
+            return;
+        }
+    }
+}
+
+void Relay::receive(Spectator& spectator, uint8_t channelId, const enet::Packet& packet)
+{
+    // Spectators can only acknowledge snapshots and synchronize their clock, which are both sent
+    // unreliably and uncompressed. Everything else is dropped.
+    if (channelId != static_cast<uint8_t>(Channel::Unreliable))
+        return;
+    ReadBuffer buffer(packet.getData<uint8_t>(), packet.getSize());
+    CommonMessageHeader header;
+    if (!deserialize(buffer, header))
+        return;
+
+    const auto messageType = static_cast<MessageType>(header.messageType);
+    if (messageType == MessageType::ClientMoveUpdate) {
+        Message<MessageType::ClientMoveUpdate> message;
+        if (deserializeMessage(buffer, message) && message.snapshotAck != InvalidFrame
+            && (spectator.snapshotAck == InvalidFrame
+                || message.snapshotAck > spectator.snapshotAck))
+            spectator.snapshotAck = message.snapshotAck;
+    } else if (messageType == MessageType::ClientTimeSync) {
+        Message<MessageType::ClientTimeSync> message;
+        if (!deserializeMessage(buffer, message) || !clockSync_.isValid())
+            return;
+        // Spectators live in the delayed time, so their snapshot interpolation works as usual
+        const auto frame
+            = std::max(clockSync_.getServerFrame(getSteadyTime()) - delayFrames_, 0.0);
+        const auto serverFrame = static_cast<uint32_t>(frame);
+        send(spectator.peer, Channel::Unreliable,
+            Message<MessageType::ServerTimeSync> {
+                message.clientTime, serverFrame, static_cast<float>(frame - serverFrame) });
+    }
+}
+
+void Relay::tick(double now)
+{
+    if (!upstreamConnected_ || !hello_)
+        return;
+
+    if (clockSync_.isRequestDue(now)) {
+        sendMessage(upstream_, Channel::Unreliable, 0,
+            Message<MessageType::ClientTimeSync> { getTimeSyncStamp(now) });
+        clockSync_.requestSent(now);
+    }
+    // The server only uses the acknowledgement
+    sendMessage(upstream_, Channel::Unreliable, 0,
+        Message<MessageType::ClientMoveUpdate> {
+            glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), upstreamSnapshotAck_ });
+
+    for (auto& [id, spectator] : spectators_) {
+        if (!spectator.welcomed)
+            welcome(spectator);
+    }
+
+    // Without a delay there is no need to wait for the clock
+    if (delayFrames_ > 0.0 && !clockSync_.isValid())
+        return;
+    const auto releaseFrame = delayFrames_ > 0.0
+        ? clockSync_.getServerFrame(now) - delayFrames_
+        : std::numeric_limits<double>::max();
+    while (!delayed_.empty() && delayed_.front().frame <= releaseFrame) {
+        release(delayed_.front());
+        delayed_.pop_front();
+    }
+
+    if (now >= nextSnapshot_) {
+        sendSnapshots();
+        nextSnapshot_ = std::max(nextSnapshot_ + 1.0 / options_.snapshotRate, now);
+    }
+}
+
+void Relay::release(const DelayedMessage& delayed)
+{
+    releasedFrame_ = std::max(releasedFrame_, delayed.frame);
+
+    // Snapshots are unsequenced, so an older one might be released after a newer one
+    if (delayed.snapshot) {
+        if (snapshot_.frame == InvalidFrame || delayed.snapshot->frame > snapshot_.frame)
+            snapshot_ = *delayed.snapshot;
+        return;
+    }
+
+    // Everything else is passed on unchanged, but kept track of for spectators joining later
+    std::optional<std::vector<uint8_t>> decompressed;
+    if (getChannelProperties(delayed.channel).compressed) {
+        decompressed = decompressMessage(delayed.packet.data(), delayed.packet.size(),
+            compressionStats_[static_cast<size_t>(delayed.channel)]);
+        if (!decompressed)
+            return;
+    }
+    ReadBuffer buffer = decompressed ? ReadBuffer(decompressed->data(), decompressed->size())
+                                     : ReadBuffer(delayed.packet.data(), delayed.packet.size());
+    CommonMessageHeader header;
+    if (!deserialize(buffer, header))
+        return;
+
+    const auto isValidSystem = [this](SystemId id) { return id < systems_.size(); };
+    switch (delayed.type) {
+    case MessageType::ServerUpdateTerminalOutput: {
+        Message<MessageType::ServerUpdateTerminalOutput> message;
+        if (!deserializeMessage(buffer, message) || !isValidSystem(message.terminal))
+            return;
+        auto& output = systems_[message.terminal].output;
+        output.append(message.text);
+        truncateOutput(output);
+        break;
+    }
+    case MessageType::ServerAddTerminalHistory: {
+        Message<MessageType::ServerAddTerminalHistory> message;
+        if (!deserializeMessage(buffer, message) || !isValidSystem(message.terminal))
+            return;
+        auto& history = systems_[message.terminal].history;
+        history.insert(history.end(), message.commands.begin(), message.commands.end());
+        while (history.size() > maxHistoryEntries)
+            history.pop_front();
+        break;
+    }
+    case MessageType::ServerUpdateInputEnabled: {
+        Message<MessageType::ServerUpdateInputEnabled> message;
+        if (!deserializeMessage(buffer, message) || !isValidSystem(message.terminal))
+            return;
+        systems_[message.terminal].inputEnabled = message.enabled;
+        break;
+    }
+    case MessageType::ServerInteractTerminal: {
+        Message<MessageType::ServerInteractTerminal> message;
+        if (!deserializeMessage(buffer, message) || !isValidSystem(message.terminal))
+            return;
+        systems_[message.terminal].user = message.user;
+        break;
+    }
+    case MessageType::ServerUpdateShipState: {
+        Message<MessageType::ServerUpdateShipState> message;
+        if (!deserializeMessage(buffer, message))
+            return;
+        shipState_ = message;
+        break;
+    }
+    case MessageType::ClientPlaySound:
+        break;
+    default:
+        printErr("Received unrecognized message: {}", asString(delayed.type));
+        return;
+    }
+
+    const auto peers = getWelcomedPeers();
+    const auto& data = delayed.packet;
+    for (auto& packet : createPackets(delayed.channel, data.data(), data.size()))
+        host_.multicast(peers, static_cast<uint8_t>(delayed.channel), std::move(packet));
+}
+
+void Relay::welcome(Spectator& spectator)
+{
+    if (!hello_)
+        return;
+    // Spectators never send input commands, because nothing they send is passed on
+    send(spectator.peer, Channel::Control,
+        Message<MessageType::ServerHello> { spectator.id, hello_->spawnPosition,
+            hello_->spawnOrientation, false, hello_->systems, hello_->sounds });
+
+    for (SystemId id = 0; id < systems_.size(); ++id) {
+        const auto& system = systems_[id];
+        if (!system.output.empty())
+            send(spectator.peer, Channel::Bulk,
+                Message<MessageType::ServerUpdateTerminalOutput> { id, system.output });
+        if (!system.history.empty())
+            send(spectator.peer, Channel::Bulk,
+                Message<MessageType::ServerAddTerminalHistory> {
+                    id, { system.history.begin(), system.history.end() } });
+        send(spectator.peer, Channel::Control,
+            Message<MessageType::ServerUpdateInputEnabled> { id, system.inputEnabled });
+        if (system.user != InvalidPlayerId)
+            send(spectator.peer, Channel::Control,
+                Message<MessageType::ServerInteractTerminal> { id, system.user });
+    }
+    if (shipState_)
+        send(spectator.peer, Channel::Event, *shipState_);
+    spectator.welcomed = true;
+}
+
+void Relay::sendSnapshots()
+{
+    if (snapshot_.frame == InvalidFrame || snapshot_.frame == lastSnapshotFrame_)
+        return;
+
+    // Spectators that are behind are usually behind by the same amount, so every delta is only
+    // encoded once per acknowledged frame
+    std::map<uint32_t, std::vector<ENetPeer*>> groups;
+    for (const auto& [id, spectator] : spectators_) {
+        if (spectator.welcomed)
+            groups[spectator.snapshotAck].push_back(spectator.peer);
+    }
+    for (const auto& [ack, peers] : groups) {
+        auto baseline = sentSnapshots_.find(ack);
+        if (baseline && snapshot_.frame - baseline->frame >= snapshotBufferSize)
+            baseline = nullptr;
+        const auto buffer = serializeMessage(snapshot_.frame, encodeDelta(snapshot_, baseline));
+        host_.multicast(peers, static_cast<uint8_t>(Channel::Unreliable),
+            enet::Packet(buffer.getData(), buffer.getSize(), getChannelFlags(Channel::Unreliable)));
+    }
+    sentSnapshots_.add(snapshot_);
+    lastSnapshotFrame_ = snapshot_.frame;
+}
+
+std::vector<ENetPeer*> Relay::getWelcomedPeers() const
+{
+    std::vector<ENetPeer*> peers;
+    for (const auto& [id, spectator] : spectators_) {
+        if (spectator.welcomed)
+            peers.push_back(spectator.peer);
+    }
+    return peers;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "enet.hpp"
+#include "net.hpp"
+#include "snapshot.hpp"
+#include "timesync.hpp"
+
+struct RelayOptions {
+    size_t maxSpectators = 64;
+    // Everything is passed on this much later, e.g. so a stream does not give away the crew's
+    // plans to the other team
+    float delay = 0.0f; // seconds
+    float snapshotRate = tickRate; // per second
+    // The server has to be started with it (see ServerOptions::relayKey). Relays connecting to
+    // this one need the same key.
+    uint32_t relayKey = 0;
+};
+
+// Connects to a server as a single spectator and passes everything it receives on to many
+// spectators of its own, so the server sends the same amount no matter how many are watching.
+// Spectators are regular clients connected to the relay. They can walk around, but the relay never
+// forwards anything they send, so they can not interact with the ship.
+// Messages are released in the order they were received once their frame is older than the delay.
+// The relay keeps the released state of the terminals and the ship, so spectators joining later
+// get everything the server would have sent them.
+class Relay {
+public:
+    // this blocks until you call stop or the server disconnects
+    bool run(const HostPort& server, uint32_t gameCode, const std::string& host, Port port,
+        const RelayOptions& options = {});
+
+    void stop();
+
+private:
+    struct Spectator {
+        ENetPeer* peer;
+        PlayerId id;
+        bool welcomed = false; // got ServerHello and the current state
+        uint32_t snapshotAck = InvalidFrame;
+    };
+
+    struct DelayedMessage {
+        uint32_t frame;
+        Channel channel;
+        MessageType type;
+        std::vector<uint8_t> packet; // as received, maybe compressed
+        std::optional<Snapshot> snapshot; // for ServerPlayerStateUpdate
+    };
+
+    struct SystemState {
+        std::string output;
+        std::deque<std::string> history;
+        bool inputEnabled = false;
+        PlayerId user = InvalidPlayerId;
+    };
+
+    template <MessageType MsgType>
+    WriteBuffer encodeMessage(Channel channel, const Message<MsgType>& message)
+    {
+        const auto buffer = serializeMessage(releasedFrame_, message);
+        if (!getChannelProperties(channel).compressed)
+            return buffer;
+        return compressMessage(buffer, compressionStats_[static_cast<size_t>(channel)]);
+    }
+
+    template <MessageType MsgType>
+    bool send(ENetPeer* peer, Channel channel, const Message<MsgType>& message)
+    {
+        return sendBuffer(peer, channel, encodeMessage(channel, message));
+    }
+
+    // peer->data is the id of the spectator (never 0, see firstSpectatorId)
+    static void* getPeerData(PlayerId id);
+    static PlayerId getSpectatorId(const void* peerData);
+    void processUpstreamEvents();
+    void receiveUpstream(uint8_t channelId, enet::Packet&& packet);
+    void processEnetEvents(uint32_t timeoutMs);
+    void receive(Spectator& spectator, uint8_t channelId, const enet::Packet& packet);
+    void tick(double now);
+    void release(const DelayedMessage& message);
+    // Sends ServerHello and the released state of the terminals and the ship
+    void welcome(Spectator& spectator);
+    void sendSnapshots();
+    std::vector<ENetPeer*> getWelcomedPeers() const;
+
+    enet::Host upstreamHost_;
+    ENetPeer* upstream_ = nullptr;
+    bool upstreamConnected_ = false;
+    std::optional<Message<MessageType::ServerHello>> hello_;
+    // Packets can arrive on other channels before ServerHello
+    std::vector<std::pair<uint8_t, enet::Packet>> earlyPackets_;
+    ChunkAssembler upstreamChunks_;
+    SnapshotBuffer upstreamSnapshots_;
+    uint32_t upstreamSnapshotAck_ = InvalidFrame;
+    ClockSync clockSync_;
+    std::deque<DelayedMessage> delayed_;
+
+    enet::Host host_;
+    uint32_t connectCode_ = 0;
+    uint32_t relayConnectCode_ = 0;
+    std::unordered_map<PlayerId, Spectator> spectators_;
+    PlayerId nextSpectatorId_ = 0;
+    RelayOptions options_;
+    double delayFrames_ = 0.0;
+    uint32_t releasedFrame_ = 0;
+    std::vector<SystemState> systems_; // indexed by SystemId
+    std::optional<Message<MessageType::ServerUpdateShipState>> shipState_;
+    Snapshot snapshot_; // the newest released one
+    // All spectators get the same snapshots, so one buffer of baselines is enough
+    SnapshotBuffer sentSnapshots_;
+    uint32_t lastSnapshotFrame_ = InvalidFrame;
+    double nextSnapshot_ = 0.0;
+    LaneCompressionStats compressionStats_;
+    std::atomic<bool> running_ { false };
+};
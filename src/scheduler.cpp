@@ -0,0 +1,91 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+
+namespace {
+constexpr auto minRate = 10.0f;
+constexpr auto minBandwidth = 4.0f * 1024.0f;
+// Per second of a healthy link
+constexpr auto rateIncrease = 5.0f;
+constexpr auto bandwidthIncrease = 4.0f * 1024.0f;
+constexpr auto decreaseFactor = 0.75f;
+// After a decrease the link needs some time to show an effect
+constexpr auto minDecreaseCooldown = 0.5f;
+
+constexpr auto maxPacketLoss = 0.02f;
+// A round trip time this much above the lowest one seen means queues are building up
+constexpr auto roundTripTimeFactor = 2.0f;
+constexpr uint32_t roundTripTimeSlack = 50; // milliseconds
+// Unused budget does not accumulate beyond this much time worth of bandwidth
+constexpr auto maxBurstTime = 0.1f;
+}
+
+SnapshotScheduler::SnapshotScheduler(float maxRate, float maxBandwidth)
+    : maxRate_(maxRate)
+    , maxBandwidth_(maxBandwidth)
+    , rate_(maxRate)
+    , bandwidth_(maxBandwidth)
+{
+}
+
+void SnapshotScheduler::update(const ENetPeer& peer, float dt)
+{
+    if (peer.roundTripTime > 0
+        && (minRoundTripTime_ == 0 || peer.roundTripTime < minRoundTripTime_))
+        minRoundTripTime_ = peer.roundTripTime;
+
+    const auto packetLoss = static_cast<float>(peer.packetLoss) / ENET_PEER_PACKET_LOSS_SCALE;
+    const auto roundTripTimeLimit
+        = static_cast<uint32_t>(minRoundTripTime_ * roundTripTimeFactor) + roundTripTimeSlack;
+    const auto congested = packetLoss > maxPacketLoss
+        || (minRoundTripTime_ > 0 && peer.roundTripTime > roundTripTimeLimit)
+        || peer.reliableDataInTransit > peer.windowSize / 2;
+
+    decreaseCooldown_ = std::max(decreaseCooldown_ - dt, 0.0f);
+    if (congested) {
+        if (decreaseCooldown_ <= 0.0f) {
+            rate_ = std::max(rate_ * decreaseFactor, std::min(minRate, maxRate_));
+            bandwidth_
+                = std::max(bandwidth_ * decreaseFactor, std::min(minBandwidth, maxBandwidth_));
+            decreaseCooldown_ = std::max(minDecreaseCooldown, peer.roundTripTime * 2.0f / 1000.0f);
+        }
+    } else {
+        rate_ = std::min(rate_ + rateIncrease * dt, maxRate_);
+        bandwidth_ = std::min(bandwidth_ + bandwidthIncrease * dt, maxBandwidth_);
+    }
+
+    snapshotAccumulator_ = std::min(snapshotAccumulator_ + rate_ * dt, 1.0f);
+    byteBudget_ = std::min(byteBudget_ + bandwidth_ * dt, bandwidth_ * maxBurstTime);
+}
+
+void SnapshotScheduler::addSentBytes(size_t bytes)
+{
+    // This may go negative, which delays the following snapshots
+    byteBudget_ -= static_cast<float>(bytes);
+}
+
+bool SnapshotScheduler::isSnapshotDue() const
+{
+    // rate * dt might add up to slightly less than 1 at the full tick rate
+    return snapshotAccumulator_ >= 1.0f - 1e-3f && byteBudget_ > 0.0f;
+}
+
+size_t SnapshotScheduler::getSnapshotBudget() const
+{
+    return static_cast<size_t>(std::max(byteBudget_, 0.0f));
+}
+
+void SnapshotScheduler::snapshotSent()
+{
+    snapshotAccumulator_ = std::max(snapshotAccumulator_ - 1.0f, 0.0f);
+}
+
+float SnapshotScheduler::getRate() const
+{
+    return rate_;
+}
+
+float SnapshotScheduler::getBandwidth() const
+{
+    return bandwidth_;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <enet/enet.h>
+
+// Decides how often and with how many bytes snapshots are sent to a single client.
+// Rate and bandwidth are raised additively while the link is fine and cut multiplicatively when
+// it shows congestion (packet loss, growing round trip times or piling up reliable data), so a bad
+// link is not flooded with data that only leads to more losses and retransmits.
+// Everything sent to the client is paid from the same byte budget, so reliable messages (e.g.
+// terminal output) go first and snapshots get what is left.
+class SnapshotScheduler {
+public:
+    // rates in snapshots per second, bandwidths in bytes per second
+    SnapshotScheduler(float maxRate, float maxBandwidth);
+
+    // Call once per tick, before anything is sent to the client
+    void update(const ENetPeer& peer, float dt);
+
+    void addSentBytes(size_t bytes);
+
+    bool isSnapshotDue() const;
+
+    // How many bytes the next snapshot may take up
+    size_t getSnapshotBudget() const;
+
+    void snapshotSent();
+
+    float getRate() const;
+    float getBandwidth() const;
+
+private:
+    float maxRate_;
+    float maxBandwidth_;
+    float rate_;
+    float bandwidth_;
+    float snapshotAccumulator_ = 0.0f; // in snapshots
+    float byteBudget_ = 0.0f;
+    float decreaseCooldown_ = 0.0f; // seconds
+    uint32_t minRoundTripTime_ = 0; // milliseconds, 0 if unknown
+};
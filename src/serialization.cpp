@@ -1,5 +1,7 @@
 #include "serialization.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <string>
 #include <vector>
@@ -7,6 +9,25 @@
 using StringLength = uint32_t;
 static constexpr auto MaxStringLength = std::numeric_limits<StringLength>::max();
 
+namespace {
+// The fifth byte only holds the 4 most significant bits
+constexpr uint8_t maxLastVarintByte = 0x0f;
+// The largest component is left out, so the others are in [-1/sqrt(2), 1/sqrt(2)]
+constexpr auto quatComponentMax = 0.70710678f;
+constexpr uint32_t quatComponentSteps = (1u << quatComponentBits) - 1;
+
+uint32_t quantize(float val, float min, float max, uint32_t steps)
+{
+    const auto t = (std::clamp(val, min, max) - min) / (max - min);
+    return static_cast<uint32_t>(std::lround(t * steps));
+}
+
+float dequantize(uint32_t val, float min, float max, uint32_t steps)
+{
+    return min + static_cast<float>(val) / steps * (max - min);
+}
+}
+
 #ifndef _WIN32
 float ntohf(uint32_t val)
 {
@@ -110,7 +131,7 @@ bool WriteStream::serialize(float val)
 bool WriteStream::serialize(std::string& str)
 {
     assert(str.size() <= MaxStringLength);
-    if (!serialize(static_cast<StringLength>(str.size())))
+    if (!serializeVarint(static_cast<StringLength>(str.size())))
         return false;
     buffer_.write(str.data(), str.size());
     return true;
@@ -136,6 +157,27 @@ bool WriteStream::serialize(glm::quat& q)
     return serializeFor(q, 4);
 }
 
+bool WriteStream::serializeQuantized(float v, float /*min*/, float /*max*/, float /*resolution*/)
+{
+    return serialize(v);
+}
+
+bool WriteStream::serializeQuantized(
+    glm::vec3& v, float /*min*/, float /*max*/, float /*resolution*/)
+{
+    return serialize(v);
+}
+
+bool WriteStream::serializeVarint(uint32_t v)
+{
+    while (v >= 0x80) {
+        buffer_.write(static_cast<uint8_t>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    buffer_.write(static_cast<uint8_t>(v));
+    return true;
+}
+
 ReadBuffer::ReadBuffer(const uint8_t* data, size_t size)
     : data_(data)
     , size_(size)
@@ -212,7 +254,9 @@ bool ReadStream::serialize(float& val)
 bool ReadStream::serialize(std::string& str)
 {
     StringLength size = 0;
-    if (!serialize(size))
+    if (!serializeVarint(size))
+        return false;
+    if (!buffer_.canRead(size))
         return false;
     str.resize(size, 0);
     return buffer_.read(str.data(), size);
@@ -237,3 +281,340 @@ bool ReadStream::serialize(glm::quat& q)
 {
     return serializeFor(q, 4);
 }
+
+bool ReadStream::serializeQuantized(float& v, float /*min*/, float /*max*/, float /*resolution*/)
+{
+    return serialize(v);
+}
+
+bool ReadStream::serializeQuantized(
+    glm::vec3& v, float /*min*/, float /*max*/, float /*resolution*/)
+{
+    return serialize(v);
+}
+
+bool ReadStream::serializeVarint(uint32_t& v)
+{
+    v = 0;
+    for (size_t i = 0; i < maxVarintBytes; ++i) {
+        uint8_t byte = 0;
+        if (!buffer_.read(byte))
+            return false;
+        if (i == maxVarintBytes - 1 && byte > maxLastVarintByte)
+            return false;
+        v |= static_cast<uint32_t>(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+BitWriteStream::BitWriteStream(WriteBuffer& buffer)
+    : buffer_(buffer)
+{
+}
+
+bool BitWriteStream::serialize(bool v)
+{
+    return writeBits(v ? 1 : 0, 1);
+}
+
+bool BitWriteStream::serialize(uint8_t v)
+{
+    return serializeInt(v);
+}
+
+bool BitWriteStream::serialize(int8_t v)
+{
+    return serializeInt(v);
+}
+
+bool BitWriteStream::serialize(uint16_t v)
+{
+    return serializeInt(v);
+}
+
+bool BitWriteStream::serialize(int16_t v)
+{
+    return serializeInt(v);
+}
+
+bool BitWriteStream::serialize(uint32_t v)
+{
+    return serializeInt(v);
+}
+
+bool BitWriteStream::serialize(int32_t v)
+{
+    return serializeInt(v);
+}
+
+bool BitWriteStream::serialize(float val)
+{
+    static_assert(sizeof(float) == sizeof(uint32_t));
+    uint32_t i = 0;
+    std::memcpy(&i, &val, sizeof(float));
+    return writeBits(i, 32);
+}
+
+bool BitWriteStream::serialize(std::string& str)
+{
+    assert(str.size() <= MaxStringLength);
+    if (!serializeVarint(static_cast<StringLength>(str.size())))
+        return false;
+    flush();
+    buffer_.write(str.data(), str.size());
+    return true;
+}
+
+bool BitWriteStream::serialize(glm::vec2& v)
+{
+    return serializeFor(v, 2);
+}
+
+bool BitWriteStream::serialize(glm::vec3& v)
+{
+    return serializeFor(v, 3);
+}
+
+bool BitWriteStream::serialize(glm::vec4& v)
+{
+    return serializeFor(v, 4);
+}
+
+bool BitWriteStream::serialize(glm::quat& q)
+{
+    // q and -q are the same rotation, so we can flip the sign to make the largest component
+    // positive, which lets us reconstruct it from the other three.
+    int largest = 0;
+    for (int i = 1; i < 4; ++i)
+        if (std::abs(q[i]) > std::abs(q[largest]))
+            largest = i;
+    const auto sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+    if (!writeBits(static_cast<uint32_t>(largest), 2))
+        return false;
+    for (int i = 0; i < 4; ++i) {
+        if (i == largest)
+            continue;
+        const auto v
+            = quantize(sign * q[i], -quatComponentMax, quatComponentMax, quatComponentSteps);
+        if (!writeBits(v, quatComponentBits))
+            return false;
+    }
+    return true;
+}
+
+bool BitWriteStream::serializeQuantized(float v, float min, float max, float resolution)
+{
+    const auto steps = getQuantizationSteps(min, max, resolution);
+    return writeBits(quantize(v, min, max, steps), bitsRequired(steps));
+}
+
+bool BitWriteStream::serializeQuantized(glm::vec3& v, float min, float max, float resolution)
+{
+    for (int i = 0; i < 3; ++i)
+        if (!serializeQuantized(v[i], min, max, resolution))
+            return false;
+    return true;
+}
+
+bool BitWriteStream::serializeVarint(uint32_t v)
+{
+    // The groups are not byte aligned here, but still make small values cheaper than 32 bits
+    while (v >= 0x80) {
+        if (!writeBits((v & 0x7f) | 0x80, 8))
+            return false;
+        v >>= 7;
+    }
+    return writeBits(v, 8);
+}
+
+void BitWriteStream::flush()
+{
+    if (scratchBits_ > 0) {
+        buffer_.write(static_cast<uint8_t>(scratch_ & 0xff));
+        scratch_ = 0;
+        scratchBits_ = 0;
+    }
+}
+
+bool BitWriteStream::writeBits(uint32_t value, size_t bits)
+{
+    assert(bits <= 32);
+    assert(bits == 32 || value < (1ull << bits));
+    scratch_ |= static_cast<uint64_t>(value) << scratchBits_;
+    scratchBits_ += bits;
+    while (scratchBits_ >= 8) {
+        buffer_.write(static_cast<uint8_t>(scratch_ & 0xff));
+        scratch_ >>= 8;
+        scratchBits_ -= 8;
+    }
+    return true;
+}
+
+bool MeasureStream::serialize(std::string& str)
+{
+    assert(str.size() <= MaxStringLength);
+    serializeVarint(static_cast<StringLength>(str.size()));
+    // The contents are byte aligned
+    bits_ = (bits_ + 7) / 8 * 8 + str.size() * 8;
+    return true;
+}
+
+BitReadStream::BitReadStream(ReadBuffer& buffer)
+    : buffer_(buffer)
+{
+}
+
+bool BitReadStream::serialize(bool& v)
+{
+    uint32_t bit = 0;
+    if (!readBits(bit, 1))
+        return false;
+    v = bit != 0;
+    return true;
+}
+
+bool BitReadStream::serialize(uint8_t& v)
+{
+    return serializeInt(v);
+}
+
+bool BitReadStream::serialize(int8_t& v)
+{
+    return serializeInt(v);
+}
+
+bool BitReadStream::serialize(uint16_t& v)
+{
+    return serializeInt(v);
+}
+
+bool BitReadStream::serialize(int16_t& v)
+{
+    return serializeInt(v);
+}
+
+bool BitReadStream::serialize(uint32_t& v)
+{
+    return serializeInt(v);
+}
+
+bool BitReadStream::serialize(int32_t& v)
+{
+    return serializeInt(v);
+}
+
+bool BitReadStream::serialize(float& val)
+{
+    uint32_t i = 0;
+    if (!readBits(i, 32))
+        return false;
+    std::memcpy(&val, &i, sizeof(float));
+    return true;
+}
+
+bool BitReadStream::serialize(std::string& str)
+{
+    StringLength size = 0;
+    if (!serializeVarint(size))
+        return false;
+    align();
+    if (!buffer_.canRead(size))
+        return false;
+    str.resize(size, 0);
+    return buffer_.read(str.data(), size);
+}
+
+bool BitReadStream::serialize(glm::vec2& v)
+{
+    return serializeFor(v, 2);
+}
+
+bool BitReadStream::serialize(glm::vec3& v)
+{
+    return serializeFor(v, 3);
+}
+
+bool BitReadStream::serialize(glm::vec4& v)
+{
+    return serializeFor(v, 4);
+}
+
+bool BitReadStream::serialize(glm::quat& q)
+{
+    uint32_t largest = 0;
+    if (!readBits(largest, 2))
+        return false;
+    float sumSquares = 0.0f;
+    for (uint32_t i = 0; i < 4; ++i) {
+        if (i == largest)
+            continue;
+        uint32_t v = 0;
+        if (!readBits(v, quatComponentBits))
+            return false;
+        q[i] = dequantize(v, -quatComponentMax, quatComponentMax, quatComponentSteps);
+        sumSquares += q[i] * q[i];
+    }
+    q[largest] = std::sqrt(std::max(0.0f, 1.0f - sumSquares));
+    return true;
+}
+
+bool BitReadStream::serializeQuantized(float& v, float min, float max, float resolution)
+{
+    const auto steps = getQuantizationSteps(min, max, resolution);
+    uint32_t q = 0;
+    if (!readBits(q, bitsRequired(steps)))
+        return false;
+    if (q > steps)
+        return false;
+    v = dequantize(q, min, max, steps);
+    return true;
+}
+
+bool BitReadStream::serializeQuantized(glm::vec3& v, float min, float max, float resolution)
+{
+    for (int i = 0; i < 3; ++i)
+        if (!serializeQuantized(v[i], min, max, resolution))
+            return false;
+    return true;
+}
+
+bool BitReadStream::serializeVarint(uint32_t& v)
+{
+    v = 0;
+    for (size_t i = 0; i < maxVarintBytes; ++i) {
+        uint32_t byte = 0;
+        if (!readBits(byte, 8))
+            return false;
+        if (i == maxVarintBytes - 1 && byte > maxLastVarintByte)
+            return false;
+        v |= (byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool BitReadStream::readBits(uint32_t& value, size_t bits)
+{
+    assert(bits <= 32);
+    while (scratchBits_ < bits) {
+        uint8_t byte = 0;
+        if (!buffer_.read(byte))
+            return false;
+        scratch_ |= static_cast<uint64_t>(byte) << scratchBits_;
+        scratchBits_ += 8;
+    }
+    value = static_cast<uint32_t>(scratch_ & ((1ull << bits) - 1));
+    scratch_ >>= bits;
+    scratchBits_ -= bits;
+    return true;
+}
+
+void BitReadStream::align()
+{
+    // We only ever fetch the bytes we need, so whatever is left is padding
+    scratch_ = 0;
+    scratchBits_ = 0;
+}
@@ -1,3 +1,6 @@
+#pragma once
+
+#include <cassert>
 #include <cstring>
 #include <string>
 #include <vector>
@@ -50,6 +53,41 @@ float ntohf(uint32_t val);
 uint32_t htonf(float val);
 #endif
 
+constexpr size_t bitsRequired(uint64_t maxValue)
+{
+    size_t bits = 0;
+    while (maxValue > 0) {
+        bits++;
+        maxValue >>= 1;
+    }
+    return bits;
+}
+
+// std::ceil is not constexpr
+constexpr uint32_t getQuantizationSteps(float min, float max, float resolution)
+{
+    assert(max > min && resolution > 0.0f);
+    const auto range = (max - min) / resolution;
+    assert(range <= static_cast<float>(std::numeric_limits<uint32_t>::max()));
+    const auto steps = static_cast<uint32_t>(range);
+    return static_cast<float>(steps) < range ? steps + 1 : steps;
+}
+
+// Lengths of strings and vectors are sent as LEB128-style varints: 7 bits per byte, least
+// significant group first, with the high bit set on all but the last byte. So short strings and
+// vectors (almost all of them) only need one byte and big ones are not limited to 255 elements.
+static constexpr size_t maxVarintBytes = 5; // for 32 bits
+
+constexpr size_t getVarintSize(uint32_t value)
+{
+    size_t bytes = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        bytes++;
+    }
+    return bytes;
+}
+
 class WriteBuffer {
 public:
     WriteBuffer(size_t capacity);
@@ -108,12 +146,26 @@ public:
     bool serialize(glm::vec4& v);
     bool serialize(glm::quat& q);
 
+    // The byte streams ignore ranges and resolutions and always write the full value
+    template <typename T>
+    bool serializeBounded(T v, int64_t min, int64_t max)
+    {
+        static_assert(std::is_integral_v<T>);
+        assert(static_cast<int64_t>(v) >= min && static_cast<int64_t>(v) <= max);
+        return serialize(v);
+    }
+
+    bool serializeQuantized(float v, float min, float max, float resolution);
+    bool serializeQuantized(glm::vec3& v, float min, float max, float resolution);
+
+    bool serializeVarint(uint32_t v);
+
     // No partial function template specialization :(
     template <typename T>
     bool serializeVector(std::vector<T>& vec)
     {
-        assert(vec.size() <= std::numeric_limits<uint8_t>::max());
-        if (!serialize(static_cast<uint8_t>(vec.size())))
+        assert(vec.size() <= std::numeric_limits<uint32_t>::max());
+        if (!serializeVarint(static_cast<uint32_t>(vec.size())))
             return false;
         for (auto& v : vec)
             if (!serialize(v))
@@ -174,7 +226,7 @@ private:
 
 class ReadStream {
 public:
-    static constexpr StreamType Type = StreamType::Write;
+    static constexpr StreamType Type = StreamType::Read;
 
     ReadStream(ReadBuffer& buffer);
 
@@ -198,12 +250,29 @@ public:
     bool serialize(glm::vec4& v);
     bool serialize(glm::quat& q);
 
+    template <typename T>
+    bool serializeBounded(T& v, int64_t min, int64_t max)
+    {
+        static_assert(std::is_integral_v<T>);
+        if (!serialize(v))
+            return false;
+        return static_cast<int64_t>(v) >= min && static_cast<int64_t>(v) <= max;
+    }
+
+    bool serializeQuantized(float& v, float min, float max, float resolution);
+    bool serializeQuantized(glm::vec3& v, float min, float max, float resolution);
+
+    bool serializeVarint(uint32_t& v);
+
     // No partial function template specialization :(
     template <typename T>
     bool serializeVector(std::vector<T>& vec)
     {
-        uint8_t num;
-        if (!serialize(num))
+        uint32_t num = 0;
+        if (!serializeVarint(num))
+            return false;
+        // Every element takes at least one byte, so a bigger count is garbage
+        if (num > buffer_.getLeft())
             return false;
         vec.resize(num);
         for (size_t i = 0; i < num; ++i)
@@ -236,9 +305,325 @@ private:
     ReadBuffer& buffer_;
 };
 
+// These streams pack values into a bit stream (LSB first). Integers with a declared range
+// (FIELD_BOUNDED) only use as many bits as that range requires, floats with a declared range and
+// resolution (FIELD_QUANTIZED) are quantized accordingly and quaternions are always sent using
+// the "smallest three" method, so they must be normalized.
+// Strings are byte aligned, so their contents can be copied in one go.
+// Everything that is written with a BitWriteStream has to be read with a BitReadStream.
+static constexpr size_t quatComponentBits = 10;
+
+class BitWriteStream {
+public:
+    static constexpr StreamType Type = StreamType::Write;
+
+    BitWriteStream(WriteBuffer& buffer);
+
+    template <typename T>
+    bool serialize(T& obj)
+    {
+        return obj.serialize(*this);
+    }
+
+    bool serialize(bool v);
+    bool serialize(uint8_t v);
+    bool serialize(int8_t v);
+    bool serialize(uint16_t v);
+    bool serialize(int16_t v);
+    bool serialize(uint32_t v);
+    bool serialize(int32_t v);
+    bool serialize(float val);
+    bool serialize(std::string& str);
+    bool serialize(glm::vec2& v);
+    bool serialize(glm::vec3& v);
+    bool serialize(glm::vec4& v);
+    bool serialize(glm::quat& q);
+
+    template <typename T>
+    bool serializeBounded(T v, int64_t min, int64_t max)
+    {
+        static_assert(std::is_integral_v<T>);
+        assert(min < max && max - min <= std::numeric_limits<uint32_t>::max());
+        assert(static_cast<int64_t>(v) >= min && static_cast<int64_t>(v) <= max);
+        return writeBits(
+            static_cast<uint32_t>(static_cast<int64_t>(v) - min), bitsRequired(max - min));
+    }
+
+    bool serializeQuantized(float v, float min, float max, float resolution);
+    bool serializeQuantized(glm::vec3& v, float min, float max, float resolution);
+
+    bool serializeVarint(uint32_t v);
+
+    template <typename T>
+    bool serializeVector(std::vector<T>& vec)
+    {
+        assert(vec.size() <= std::numeric_limits<uint32_t>::max());
+        if (!serializeVarint(static_cast<uint32_t>(vec.size())))
+            return false;
+        for (auto& v : vec)
+            if (!serialize(v))
+                return false;
+        return true;
+    }
+
+    // Writes out the bits that don't fill a whole byte yet (padded with zeros).
+    // Has to be called after the last field has been serialized.
+    void flush();
+
+private:
+    template <typename T>
+    bool serializeInt(T val)
+    {
+        static_assert(std::is_integral_v<T> && sizeof(T) <= sizeof(uint32_t));
+        using U = std::make_unsigned_t<T>;
+        return writeBits(static_cast<U>(val), sizeof(T) * 8);
+    }
+
+    template <typename T>
+    bool serializeFor(T& c, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            if (!serialize(c[i]))
+                return false;
+        return true;
+    }
+
+    bool writeBits(uint32_t value, size_t bits);
+
+    WriteBuffer& buffer_;
+    uint64_t scratch_ = 0;
+    size_t scratchBits_ = 0;
+};
+
+// Runs the same SERIALIZE() bodies as BitWriteStream, but only counts the bits it would write, so
+// buffers can be allocated with the exact size. Everything but strings and vectors is measured
+// without looking at the values, so objects without them can be measured at compile time.
+class MeasureStream {
+public:
+    static constexpr StreamType Type = StreamType::Write;
+
+    template <typename T>
+    constexpr bool serialize(T& obj)
+    {
+        return obj.serialize(*this);
+    }
+
+    constexpr bool serialize(bool /*v*/)
+    {
+        return add(1);
+    }
+
+    constexpr bool serialize(uint8_t v)
+    {
+        return addInt(v);
+    }
+
+    constexpr bool serialize(int8_t v)
+    {
+        return addInt(v);
+    }
+
+    constexpr bool serialize(uint16_t v)
+    {
+        return addInt(v);
+    }
+
+    constexpr bool serialize(int16_t v)
+    {
+        return addInt(v);
+    }
+
+    constexpr bool serialize(uint32_t v)
+    {
+        return addInt(v);
+    }
+
+    constexpr bool serialize(int32_t v)
+    {
+        return addInt(v);
+    }
+
+    constexpr bool serialize(float /*val*/)
+    {
+        return add(32);
+    }
+
+    bool serialize(std::string& str);
+
+    constexpr bool serialize(glm::vec2& /*v*/)
+    {
+        return add(2 * 32);
+    }
+
+    constexpr bool serialize(glm::vec3& /*v*/)
+    {
+        return add(3 * 32);
+    }
+
+    constexpr bool serialize(glm::vec4& /*v*/)
+    {
+        return add(4 * 32);
+    }
+
+    constexpr bool serialize(glm::quat& /*q*/)
+    {
+        return add(2 + 3 * quatComponentBits);
+    }
+
+    template <typename T>
+    constexpr bool serializeBounded(T /*v*/, int64_t min, int64_t max)
+    {
+        static_assert(std::is_integral_v<T>);
+        return add(bitsRequired(max - min));
+    }
+
+    constexpr bool serializeQuantized(float /*v*/, float min, float max, float resolution)
+    {
+        return add(bitsRequired(getQuantizationSteps(min, max, resolution)));
+    }
+
+    constexpr bool serializeQuantized(glm::vec3& /*v*/, float min, float max, float resolution)
+    {
+        return add(3 * bitsRequired(getQuantizationSteps(min, max, resolution)));
+    }
+
+    constexpr bool serializeVarint(uint32_t v)
+    {
+        return add(8 * getVarintSize(v));
+    }
+
+    template <typename T>
+    bool serializeVector(std::vector<T>& vec)
+    {
+        assert(vec.size() <= std::numeric_limits<uint32_t>::max());
+        serializeVarint(static_cast<uint32_t>(vec.size()));
+        for (auto& v : vec)
+            serialize(v);
+        return true;
+    }
+
+    constexpr size_t getBits() const
+    {
+        return bits_;
+    }
+
+    // Including the padding of the last byte (see BitWriteStream::flush)
+    constexpr size_t getBytes() const
+    {
+        return (bits_ + 7) / 8;
+    }
+
+private:
+    template <typename T>
+    constexpr bool addInt(T /*val*/)
+    {
+        static_assert(std::is_integral_v<T> && sizeof(T) <= sizeof(uint32_t));
+        return add(sizeof(T) * 8);
+    }
+
+    constexpr bool add(size_t bits)
+    {
+        bits_ += bits;
+        return true;
+    }
+
+    size_t bits_ = 0;
+};
+
+class BitReadStream {
+public:
+    static constexpr StreamType Type = StreamType::Read;
+
+    BitReadStream(ReadBuffer& buffer);
+
+    template <typename T>
+    bool serialize(T& obj)
+    {
+        return obj.serialize(*this);
+    }
+
+    bool serialize(bool& v);
+    bool serialize(uint8_t& v);
+    bool serialize(int8_t& v);
+    bool serialize(uint16_t& v);
+    bool serialize(int16_t& v);
+    bool serialize(uint32_t& v);
+    bool serialize(int32_t& v);
+    bool serialize(float& val);
+    bool serialize(std::string& str);
+    bool serialize(glm::vec2& v);
+    bool serialize(glm::vec3& v);
+    bool serialize(glm::vec4& v);
+    bool serialize(glm::quat& q);
+
+    template <typename T>
+    bool serializeBounded(T& v, int64_t min, int64_t max)
+    {
+        static_assert(std::is_integral_v<T>);
+        uint32_t bits = 0;
+        if (!readBits(bits, bitsRequired(max - min)))
+            return false;
+        const auto val = min + static_cast<int64_t>(bits);
+        if (val > max)
+            return false;
+        v = static_cast<T>(val);
+        return true;
+    }
+
+    bool serializeQuantized(float& v, float min, float max, float resolution);
+    bool serializeQuantized(glm::vec3& v, float min, float max, float resolution);
+
+    bool serializeVarint(uint32_t& v);
+
+    template <typename T>
+    bool serializeVector(std::vector<T>& vec)
+    {
+        uint32_t num = 0;
+        if (!serializeVarint(num))
+            return false;
+        // Every element takes at least one bit, so a bigger count is garbage
+        if (num > buffer_.getLeft() * 8 + scratchBits_)
+            return false;
+        vec.resize(num);
+        for (size_t i = 0; i < num; ++i)
+            if (!serialize(vec[i]))
+                return false;
+        return true;
+    }
+
+private:
+    template <typename T>
+    bool serializeInt(T& val)
+    {
+        static_assert(std::is_integral_v<T> && sizeof(T) <= sizeof(uint32_t));
+        uint32_t bits = 0;
+        if (!readBits(bits, sizeof(T) * 8))
+            return false;
+        val = static_cast<T>(static_cast<std::make_unsigned_t<T>>(bits));
+        return true;
+    }
+
+    template <typename T>
+    bool serializeFor(T& c, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+            if (!serialize(c[i]))
+                return false;
+        return true;
+    }
+
+    bool readBits(uint32_t& value, size_t bits);
+    void align();
+
+    ReadBuffer& buffer_;
+    uint64_t scratch_ = 0;
+    size_t scratchBits_ = 0;
+};
+
+// constexpr, so MeasureStream can measure messages at compile time
 #define SERIALIZE()                                                                                \
     template <typename Stream>                                                                     \
-    bool serialize(Stream& stream)
+    constexpr bool serialize(Stream& stream)
 
 #define SERIALIZE_END return true
 
@@ -251,6 +636,24 @@ private:
             return false;                                                                          \
     } while (0)
 
+#define FIELD_BOUNDED(obj, min, max)                                                               \
+    do {                                                                                           \
+        if (!stream.serializeBounded(obj, min, max))                                               \
+            return false;                                                                          \
+    } while (0)
+
+#define FIELD_QUANTIZED(obj, min, max, resolution)                                                 \
+    do {                                                                                           \
+        if (!stream.serializeQuantized(obj, min, max, resolution))                                 \
+            return false;                                                                          \
+    } while (0)
+
+#define FIELD_VARINT(obj)                                                                          \
+    do {                                                                                           \
+        if (!stream.serializeVarint(obj))                                                          \
+            return false;                                                                          \
+    } while (0)
+
 #define FIELD_VEC(vec)                                                                             \
     do {                                                                                           \
         if (!stream.serializeVector(vec))                                                          \
@@ -270,3 +673,39 @@ bool deserialize(ReadBuffer& buffer, T& object)
     ReadStream stream(buffer);
     return stream.serialize(object);
 }
+
+template <typename T>
+bool serializeBits(WriteBuffer& buffer, T& object)
+{
+    BitWriteStream stream(buffer);
+    const auto res = stream.serialize(object);
+    stream.flush();
+    return res;
+}
+
+template <typename T>
+bool deserializeBits(ReadBuffer& buffer, T& object)
+{
+    BitReadStream stream(buffer);
+    return stream.serialize(object);
+}
+
+// What serializeBits would write, in bytes. SERIALIZE() bodies are not const, but MeasureStream
+// never changes the object.
+template <typename T>
+size_t getSerializedBitsSize(const T& object)
+{
+    MeasureStream stream;
+    stream.serialize(const_cast<T&>(object));
+    return stream.getBytes();
+}
+
+// The same at compile time, for types without strings and vectors
+template <typename T>
+constexpr size_t getFixedSerializedBitsSize()
+{
+    T object {};
+    MeasureStream stream;
+    stream.serialize(object);
+    return stream.getBytes();
+}
@@ -1,6 +1,13 @@
 #include "server.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <unordered_map>
 
 #include <fmt/format.h>
 
@@ -8,9 +15,46 @@
 
 #include "constants.hpp"
 #include "gltfimport.hpp"
+#include "interest.hpp"
 #include "physics.hpp"
+#include "pool.hpp"
+#include "random.hpp"
 
 namespace {
+// Ticks are skipped, rather than caught up with, if the server is further behind than this
+constexpr uint32_t maxCatchUpTicks = 5;
+// Without players the ship systems are still updated, but not more often than this
+constexpr auto idleTickInterval = 1.0;
+
+// The server does not play sounds, but it needs the names for the symbol table
+std::vector<std::string> loadSoundNames()
+{
+    sol::state lua;
+    const sol::table soundmap = lua.script_file("media/sounds/soundmap.lua");
+    std::vector<std::string> names;
+    for (const auto& [name, value] : soundmap)
+        names.push_back(name.as<std::string>());
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// Groups players by a value that usually is the same for most of them (in order of appearance)
+template <typename Players, typename KeyFunc>
+auto groupPlayers(Players& players, KeyFunc&& keyFunc)
+{
+    using Player = std::remove_reference_t<decltype(*players.begin())>;
+    using Key = std::decay_t<decltype(keyFunc(*players.begin()))>;
+    std::vector<std::pair<Key, std::vector<Player*>>> groups;
+    for (auto& player : players) {
+        const auto key = keyFunc(player);
+        auto it = std::find_if(
+            groups.begin(), groups.end(), [&key](const auto& group) { return group.first == key; });
+        if (it == groups.end())
+            it = groups.emplace(groups.end(), key, std::vector<Player*> {});
+        it->second.push_back(&player);
+    }
+    return groups;
+}
 }
 
 namespace comp {
@@ -19,36 +63,24 @@ struct NetworkPlayer {
 };
 }
 
-bool Server::run(const std::string& host, Port port, uint32_t gameCode, float exitTimeout)
+bool Server::run(const std::string& host, Port port, uint32_t gameCode, float exitTimeout,
+    const ServerOptions& options)
 {
     assert(!started_);
     started_ = true;
 
     connectCode_ = getConnectCode(gameCode);
+    if (options.relayKey) {
+        if (*options.relayKey > maxRelayKey) {
+            printErr("Relay key must be at most {:x}", maxRelayKey);
+            return false;
+        }
+        relayConnectCode_ = getRelayConnectCode(*options.relayKey);
+    }
     exitTimeout_ = exitTimeout;
 
-    println("Loading map..");
-
-    auto shipGltf = GltfFile::load("media/ship.glb");
-    if (!shipGltf) {
-        printErr("Could not load 'media/ship.glb'");
+    if (!init(options))
         return false;
-    }
-    shipGltf->instantiate(world_, true);
-    world_.flush();
-
-    println("Done");
-
-    shipSystems_.emplace("reactor",
-        ShipSystemData { std::make_unique<LuaShipSystem>("reactor", "media/systems/reactor.lua") });
-    shipSystems_.emplace("engine",
-        ShipSystemData { std::make_unique<LuaShipSystem>("engine", "media/systems/engine.lua") });
-    shipSystems_.emplace(
-        "nav", ShipSystemData { std::make_unique<LuaShipSystem>("nav", "media/systems/nav.lua") });
-    shipSystems_.emplace("shields",
-        ShipSystemData { std::make_unique<LuaShipSystem>("shields", "media/systems/shields.lua") });
-    shipSystems_.emplace(
-        "o2", ShipSystemData { std::make_unique<LuaShipSystem>("o2", "media/systems/o2.lua") });
 
     const auto addr = enet::getAddress(host, port);
     if (!addr) {
@@ -56,37 +88,76 @@ bool Server::run(const std::string& host, Port port, uint32_t gameCode, float ex
         return false;
     }
 
-    host_ = enet::Host(*addr, maxPlayers, static_cast<uint8_t>(Channel::Count));
+    host_ = enet::Host(*addr, options.maxPlayers, static_cast<uint8_t>(Channel::Count));
     if (!host_) {
         printErr("Could not create server host");
         return false;
     }
+    if (!host_.simulate(options.networkConditions)) {
+        printErr("Could not start network simulation");
+        return false;
+    }
+
+    if (!options.recordPath.empty()) {
+        const RecordingHeader header { version, *options_.randomSeed,
+            static_cast<uint32_t>(options.maxPlayers), options.inputCommands, options.snapshotRate,
+            options.clientBandwidth };
+        if (!recorder_.open(options.recordPath, header))
+            return false;
+        println("Recording to '{}'", options.recordPath);
+    }
+
+    if (!options.statsPath.empty()) {
+        statsFile_.open(options.statsPath, std::ios::app);
+        if (!statsFile_) {
+            printErr("Could not open '{}'", options.statsPath);
+            return false;
+        }
+        println("Writing stats to '{}'", options.statsPath);
+    }
 
     println("Listening on {}:{}..", host, port);
 
     running_.store(true);
     time_ = 0.0f;
-    float clockTime = glwx::getTime();
-    float accumulator = 0.0f;
+    startTime_ = getSteadyTime();
     constexpr auto dt = 1.0f / tickRate;
+    auto nextTick = startTime_;
     while (running_.load()) {
-        const auto now = glwx::getTime();
-        const auto clockDelta = now - clockTime;
-        clockTime = now;
-
-        accumulator += clockDelta;
-        while (accumulator >= dt) {
-            processEnetEvents();
+        const auto now = getSteadyTime();
+        if (now >= nextTick) {
+            // Frame numbers always match the time since startTime_, which clock synchronization
+            // relies on. If the server is idle or has fallen too far behind, frames are skipped
+            // instead of simulating all of them at once.
+            const auto dueFrame = std::max(
+                frameCounter_, static_cast<uint32_t>((now - startTime_) * tickRate));
+            if (players_.empty() || dueFrame - frameCounter_ > maxCatchUpTicks)
+                frameCounter_ = dueFrame;
+            time_ = static_cast<float>(frameCounter_) / tickRate;
+
+            recorder_.tick(frameCounter_);
             tick(dt);
             host_.flush();
-            accumulator -= dt;
-            time_ += dt;
             frameCounter_++;
+            nextTick = startTime_ + static_cast<double>(frameCounter_) / tickRate;
+            if (players_.empty())
+                nextTick = std::max(nextTick, now + idleTickInterval);
+            continue;
+        }
+
+        // Block until the next tick is due, but handle packets as soon as they arrive. If the host
+        // fails, it fails right away, so this waits instead of retrying until the next tick.
+        const auto timeout = static_cast<uint32_t>(std::ceil((nextTick - now) * 1000.0));
+        if (!processEnetEvents(timeout))
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+        // Don't make new players wait for the next idle tick
+        if (!players_.empty()) {
+            const auto frameTime = startTime_ + static_cast<double>(frameCounter_) / tickRate;
+            nextTick = std::min(nextTick, frameTime);
         }
-        SDL_Delay(1);
     }
 
-    MessageBus::instance().clearEndpoints();
+    shutdown();
 
     for (auto& player : players_)
         enet_peer_disconnect_now(player.peer, 0);
@@ -94,72 +165,256 @@ bool Server::run(const std::string& host, Port port, uint32_t gameCode, float ex
     return true;
 }
 
-void Server::tick(float /*dt*/)
+bool Server::replay(const std::string& path, TrafficAnalysis* analysis)
 {
-    for (auto& [name, system] : shipSystems_) {
-        system.system->update();
+    assert(!started_);
+    started_ = true;
 
-        const auto terminalEnabled = !system.system->commandRunning();
+    RecordingReader reader;
+    const auto header = reader.open(path);
+    if (!header)
+        return false;
+    if (header->version != version) {
+        printErr("Recording is of protocol version {}, but this is version {}", header->version,
+            version);
+        return false;
+    }
+
+    ServerOptions options;
+    options.maxPlayers = header->maxPlayers;
+    options.inputCommands = header->inputCommands;
+    options.snapshotRate = header->snapshotRate;
+    options.clientBandwidth = header->clientBandwidth;
+    options.randomSeed = header->randomSeed;
+    replaying_ = true;
+    analysis_ = analysis;
+    exitTimeout_ = std::numeric_limits<float>::infinity();
+    if (!init(options))
+        return false;
+
+    // The peers are never connected, but the player code needs somewhere to store its data
+    std::deque<ENetPeer> peers;
+    std::unordered_map<PlayerId, ENetPeer*> recordedPeers;
+    const auto findPlayer = [this, &recordedPeers](PlayerId id) -> Player* {
+        const auto it = recordedPeers.find(id);
+        const auto slot
+            = it != recordedPeers.end() ? getPlayerSlot(it->second->data) : std::nullopt;
+        if (!slot) {
+            printErr("Recorded player {} is not connected", id);
+            return nullptr;
+        }
+        return &players_[*slot];
+    };
+
+    println("Replaying '{}'..", path);
+    running_.store(true);
+    const auto start = getSteadyTime();
+    size_t ticks = 0, messages = 0;
+    constexpr auto dt = 1.0f / tickRate;
+    while (running_.load()) {
+        const auto record = reader.next();
+        if (!record)
+            break;
+        switch (record->type) {
+        case Record::Type::Tick:
+            frameCounter_ = record->frame;
+            time_ = static_cast<float>(frameCounter_) / tickRate;
+            tick(dt);
+            frameCounter_++;
+            ticks++;
+            break;
+        case Record::Type::Connect:
+        case Record::Type::ConnectSpectator: {
+            auto& peer = peers.emplace_back();
+            connectPeer(&peer, record->type == Record::Type::ConnectSpectator);
+            recordedPeers[record->player] = &peer;
+            const auto id = players_[*getPlayerSlot(peer.data)].id;
+            if (id != record->player)
+                printErr("Replay diverged: player {} connected as {}", record->player, id);
+            break;
+        }
+        case Record::Type::Disconnect:
+            if (const auto player = findPlayer(record->player)) {
+                disconnectPlayer(*getPlayerSlot(player->peer->data));
+                recordedPeers.erase(record->player);
+            }
+            break;
+        case Record::Type::Receive:
+            if (const auto player = findPlayer(record->player)) {
+                receive(*player, record->channel,
+                    enet::Packet(record->data.data(), record->data.size(), 0));
+                messages++;
+            }
+            break;
+        }
+    }
+    const auto duration = getSteadyTime() - start;
+    running_.store(false);
+
+    if (!reader.isAtEnd())
+        printErr("Recording is damaged, replay stopped early");
+    println("Replayed {} ticks and {} messages ({:.1f}s of game time) in {:.2f}s", ticks,
+        messages, time_, duration);
+
+    shutdown();
+    return reader.isAtEnd();
+}
+
+bool Server::init(const ServerOptions& options)
+{
+    inputCommands_ = options.inputCommands;
+    options_ = options;
+    if (!options_.randomSeed)
+        options_.randomSeed = std::random_device()();
+    rng.seed(*options_.randomSeed);
+
+    if (options.maxPlayers == 0 || options.maxPlayers > maxPlayersLimit) {
+        printErr("Max players must be in [1, {}]", maxPlayersLimit);
+        return false;
+    }
+    if (options.snapshotRate <= 0.0f || options.snapshotRate > tickRate) {
+        printErr("Snapshot rate must be in (0, {}]", tickRate);
+        return false;
+    }
+    if (options.clientBandwidth <= 0.0f) {
+        printErr("Client bandwidth must be positive");
+        return false;
+    }
+    // Reserve all slots, so players never move in memory
+    players_.reserve(options.maxPlayers);
+
+    println("Loading map..");
+
+    auto shipGltf = GltfFile::load("media/ship.glb");
+    if (!shipGltf) {
+        printErr("Could not load 'media/ship.glb'");
+        return false;
+    }
+    shipGltf->instantiate(world_, true);
+    world_.flush();
+
+    println("Done");
+
+    const std::vector<std::string> systemNames { "reactor", "engine", "nav", "shields", "o2" };
+    for (const auto& name : systemNames) {
+        // Every system gets its own seed, so they don't all make the same random decisions
+        const auto seed = *options_.randomSeed + static_cast<uint32_t>(shipSystems_.size());
+        shipSystems_.push_back(ShipSystemData {
+            std::make_unique<LuaShipSystem>(name, "media/systems/" + name + ".lua", seed) });
+    }
+    systemNames_ = SymbolTable(systemNames);
+    soundNames_ = SymbolTable(loadSoundNames());
+    return true;
+}
+
+void Server::shutdown()
+{
+    MessageBus::instance().clearEndpoints();
+    recorder_.close();
+    statsFile_.close();
+
+    printCompressionStats(compressionStats_);
+    pool::printStats();
+}
+
+void Server::tick(float dt)
+{
+    for (auto& player : players_) {
+        player.scheduler.update(*player.peer, dt);
+        player.telemetry.update(*player.peer, time_);
+    }
+    if (statsFile_.is_open() && time_ >= nextStats_) {
+        writeStats();
+        nextStats_ = time_ + static_cast<float>(PeerTelemetry::sampleInterval);
+    }
+
+    if (inputCommands_)
+        simulatePlayers(dt);
+
+    for (SystemId id = 0; id < shipSystems_.size(); ++id) {
+        auto& system = shipSystems_[id];
+        system.system->update(time_);
 
+        const auto terminalEnabled = !system.system->commandRunning();
         const auto totalOutputSize = system.system->getTotalTerminalOutputSize();
         const auto& output = system.system->getTerminalOutput();
-        for (auto& player : players_) {
-            auto& lastKnown = player.lastKnownSystemState[name];
 
-            const auto lastKnownTermSize = lastKnown.terminalSize;
+        // Players that are behind are usually behind by the same amount, so they are grouped by
+        // what they know and every message is only serialized once per group.
+        const auto outputGroups = groupPlayers(players_,
+            [id](const Player& player) { return player.lastKnownSystemState[id].terminalSize; });
+        for (const auto& [lastKnownTermSize, group] : outputGroups) {
             assert(totalOutputSize >= lastKnownTermSize);
             const auto deltaLength = totalOutputSize - lastKnownTermSize;
-            if (deltaLength > 0) {
-                const auto maxDeltaLength = std::min(deltaLength, output.size());
-                const auto delta = output.substr(output.size() - maxDeltaLength);
-                send(player, Channel::Reliable,
-                    Message<MessageType::ServerUpdateTerminalOutput> { name, delta });
-                lastKnown.terminalSize = totalOutputSize;
-            }
+            if (deltaLength == 0)
+                continue;
+            const auto maxDeltaLength = std::min(deltaLength, output.size());
+            const auto delta = output.substr(output.size() - maxDeltaLength);
+            multicast(group, Channel::Bulk,
+                Message<MessageType::ServerUpdateTerminalOutput> { id, delta });
+            for (auto player : group)
+                player->lastKnownSystemState[id].terminalSize = totalOutputSize;
+        }
 
+        std::vector<Player*> recipients;
+        for (auto& player : players_) {
+            auto& lastKnown = player.lastKnownSystemState[id];
             if (terminalEnabled != lastKnown.terminalEnabled) {
-                send(player, Channel::Reliable,
-                    Message<MessageType::ServerUpdateInputEnabled> { name, terminalEnabled });
+                recipients.push_back(&player);
                 lastKnown.terminalEnabled = terminalEnabled;
             }
+        }
+        multicast(recipients, Channel::Control,
+            Message<MessageType::ServerUpdateInputEnabled> { id, terminalEnabled });
 
+        const auto historyGroups = groupPlayers(players_,
+            [id](const Player& player) { return player.lastKnownSystemState[id].historyCount; });
+        for (const auto& [lastKnownHistoryCount, group] : historyGroups) {
             const auto deltaHist
-                = std::min(system.history.size(), system.historyCount - lastKnown.historyCount);
-            if (deltaHist > 0) {
-                Message<MessageType::ServerAddTerminalHistory> message { name, {} };
-                message.commands.reserve(deltaHist);
-                for (size_t i = system.history.size() - deltaHist; i < system.history.size(); ++i) {
-                    message.commands.push_back(system.history[i]);
-                }
-                send(player, Channel::Reliable, message);
-                lastKnown.historyCount = system.historyCount;
+                = std::min(system.history.size(), system.historyCount - lastKnownHistoryCount);
+            if (deltaHist == 0)
+                continue;
+            Message<MessageType::ServerAddTerminalHistory> message { id, {} };
+            message.commands.reserve(deltaHist);
+            for (size_t i = system.history.size() - deltaHist; i < system.history.size(); ++i) {
+                message.commands.push_back(system.history[i]);
             }
+            multicast(group, Channel::Bulk, message);
+            for (auto player : group)
+                player->lastKnownSystemState[id].historyCount = system.historyCount;
+        }
 
+        recipients.clear();
+        for (auto& player : players_) {
+            auto& lastKnown = player.lastKnownSystemState[id];
             if (system.terminalUser != lastKnown.terminalUser) {
-                send(player, Channel::Reliable,
-                    Message<MessageType::ServerInteractTerminal> { name, system.terminalUser });
+                recipients.push_back(&player);
                 lastKnown.terminalUser = system.terminalUser;
             }
         }
+        multicast(recipients, Channel::Control,
+            Message<MessageType::ServerInteractTerminal> { id, system.terminalUser });
     }
 
-    const auto shipStateMessage = Message<MessageType::ServerUpdateShipState> {
-        LuaShipSystem::shipState.engineThrottle,
-        LuaShipSystem::shipState.reactorPower,
-    };
-
-    auto update = Message<MessageType::ServerPlayerStateUpdate>();
+    std::vector<Player*> recipients;
     for (auto& player : players_) {
-        const auto& trafo = player.entity.get<comp::Transform>();
-        update.players.push_back(Message<MessageType::ServerPlayerStateUpdate>::PlayerState {
-            player.id, trafo.getPosition(), trafo.getOrientation() });
-
         if (LuaShipSystem::shipState != player.lastKnownShipState) {
-            send(player, Channel::Reliable, shipStateMessage);
+            recipients.push_back(&player);
             player.lastKnownShipState = LuaShipSystem::shipState;
         }
     }
-    broadcast(Channel::Unreliable, update);
+    multicast(recipients, Channel::Event,
+        Message<MessageType::ServerUpdateShipState> {
+            LuaShipSystem::shipState.engineThrottle,
+            LuaShipSystem::shipState.reactorPower,
+        });
+
+    sendSnapshots();
+
+    if (!replaying_) {
+        for (auto& player : players_)
+            player.lanes.flush(player.peer);
+    }
 
     if (players_.empty()) {
         if (time_ - lastNonEmpty_ > exitTimeout_) {
@@ -171,6 +426,134 @@ void Server::tick(float /*dt*/)
     }
 }
 
+void Server::sendSnapshots()
+{
+    // The slots are needed to index Player::priorities
+    std::vector<std::pair<PlayerSnapshot, PlayerSlot>> states;
+    for (auto it = players_.begin(); it != players_.end(); ++it) {
+        if (it->spectator)
+            continue;
+        const auto& trafo = it->entity.get<comp::Transform>();
+        states.emplace_back(
+            PlayerSnapshot { it->id, trafo.getPosition(), trafo.getOrientation() }, it.getIndex());
+    }
+    std::sort(states.begin(), states.end(),
+        [](const auto& a, const auto& b) { return a.first.id < b.first.id; });
+
+    std::vector<size_t> order(states.size());
+    std::vector<bool> included(states.size());
+    for (auto& player : players_) {
+        if (!player.scheduler.isSnapshotDue())
+            continue;
+
+        auto baseline = player.sentSnapshots.find(player.snapshotAck);
+        // Frames might have been skipped, so the baseline can still be in the buffer, but too
+        // old to be referenced in the message.
+        if (baseline && frameCounter_ - baseline->frame >= snapshotBufferSize)
+            baseline = nullptr;
+        const auto lastSent = player.sentSnapshots.find(player.lastSnapshotFrame);
+        if (player.spectator) {
+            // Relays pass the snapshots on to spectators, who can look anywhere
+            std::fill(included.begin(), included.end(), true);
+        } else {
+            const auto viewer = player.entity.get<comp::Transform>().getPosition();
+
+            // Everyone accumulates priority according to how relevant they are to the viewer. The
+            // players with the highest priority are included until the budget is used up and their
+            // priority is reset. Everyone else repeats the state that was sent last, so they are
+            // elided from the delta once the client has acknowledged it.
+            for (const auto& [state, slot] : states)
+                player.priorities[slot] += 1.0f / getUpdateInterval(viewer, state.position);
+            const auto getPriority = [&](size_t index) {
+                const auto& [state, slot] = states[index];
+                return state.id == player.id ? HUGE_VALF : player.priorities[slot];
+            };
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) { return getPriority(a) > getPriority(b); });
+
+            auto budget = player.scheduler.getSnapshotBudget() * 8; // bits
+            for (const auto index : order) {
+                const auto& [state, slot] = states[index];
+                const auto last = lastSent ? lastSent->find(state.id) : nullptr;
+                const auto base = baseline ? baseline->find(state.id) : nullptr;
+                const auto bits = getPlayerStateBits(state, base);
+                // The own state and new players are always sent
+                included[index] = state.id == player.id || !last || bits <= budget;
+                if (included[index]) {
+                    budget -= std::min(bits, budget);
+                    player.priorities[slot] = 0.0f;
+                }
+            }
+        }
+
+        Snapshot snapshot { frameCounter_, {} };
+        snapshot.players.reserve(states.size());
+        for (size_t i = 0; i < states.size(); ++i) {
+            const auto& state = states[i].first;
+            snapshot.players.push_back(included[i] ? state : *lastSent->find(state.id));
+        }
+
+        auto message = encodeDelta(snapshot, baseline);
+        if (inputCommands_ && !player.spectator) {
+            message.inputAck = player.inputAck;
+            message.velocity = player.entity.get<comp::Velocity>().value;
+        }
+        send(player, Channel::Unreliable, message);
+        player.scheduler.snapshotSent();
+        player.lastSnapshotFrame = frameCounter_;
+        player.sentSnapshots.add(std::move(snapshot));
+    }
+}
+
+void Server::writeStats()
+{
+    std::string json = fmt::format(
+        R"({{"time": {:.3f}, "frame": {}, "players": [)", time_, frameCounter_);
+    bool first = true;
+    for (const auto& player : players_) {
+        const auto ip = enet::getIp(player.peer->address).value_or("");
+        json += fmt::format(
+            R"({}{{"id": {}, "address": "{}:{}", "spectator": {}, "snapshotRate": {:.1f}, )"
+            R"("bandwidth": {:.0f}, "telemetry": {}}})",
+            first ? "" : ", ", player.id, ip, player.peer->address.port, player.spectator,
+            player.scheduler.getRate(), player.scheduler.getBandwidth(),
+            player.telemetry.hasSamples() ? toJson(player.telemetry.getLatest()) : "null");
+        first = false;
+    }
+    json += "]}\n";
+    // Flushed right away, so the file can be followed while the server is running
+    statsFile_ << json << std::flush;
+}
+
+void Server::simulatePlayers(float dt)
+{
+    // Commands arriving in bursts are buffered and simulated one per tick, like the client did.
+    // If there are too many, the client is ahead (or cheating). Simulating the excess would let it
+    // move faster than everyone else, so the oldest ones are dropped. They are acknowledged with
+    // the one simulated after them and the client corrects its prediction.
+    static constexpr size_t maxBufferedInputs = 4;
+    for (auto& player : players_) {
+        while (player.inputs.size() > maxBufferedInputs)
+            player.inputs.pop_front();
+        if (!player.inputs.empty()) {
+            simulateInput(player, player.inputs.front(), dt);
+            player.inputs.pop_front();
+        }
+    }
+}
+
+void Server::simulateInput(Player& player, const Player::InputCommand& command, float dt)
+{
+    if (const auto terminal = getUsedTerminal(player.id)) {
+        approachTerminal(player.entity.get<comp::Transform>(),
+            findTerminal(*terminal).get<comp::Transform>(), dt);
+    } else {
+        simulatePlayer(world_, player.entity, command.input, dt);
+    }
+    player.inputAck = command.sequence;
+}
+
 bool Server::isRunning() const
 {
     return running_.load();
@@ -181,27 +564,42 @@ void Server::stop()
     running_.store(false);
 }
 
-void Server::processEnetEvents()
+bool Server::processEnetEvents(uint32_t timeoutMs)
 {
-    std::optional<enet::Event> event;
-    while ((event = host_.service())) {
+    // Only the first call waits, afterwards the already received events are processed
+    for (auto event = host_.service(timeoutMs); event; event = host_.service()) {
         if (const auto connEvent = std::get_if<enet::ConnectEvent>(&event.value())) {
             // note peer->connectID is just a random value generated on the peer
-            if (connEvent->data != connectCode_) {
+            // Anything else with the spectator flag is refused, because spectators get every
+            // player's state.
+            const auto spectator = relayConnectCode_ && connEvent->data == *relayConnectCode_;
+            if (!spectator && connEvent->data != connectCode_) {
                 // disconnect now, so peer is reset and we have a free slot for another
                 // client!
                 enet_peer_disconnect_now(connEvent->peer, version);
             } else {
-                connectPeer(connEvent->peer);
+                connectPeer(connEvent->peer, spectator);
+                const auto slot = getPlayerSlot(connEvent->peer->data);
+                recorder_.connect(frameCounter_, players_[*slot].id, spectator);
             }
         } else if (const auto discEvent = std::get_if<enet::DisconnectEvent>(&event.value())) {
-            disconnectPlayer(getPlayerId(discEvent->peerData));
+            if (const auto slot = getPlayerSlot(discEvent->peerData)) {
+                recorder_.disconnect(frameCounter_, players_[*slot].id);
+                disconnectPlayer(*slot);
+            }
         } else if (const auto recvEvent = std::get_if<enet::ReceiveEvent>(&event.value())) {
-            receive(getPlayerId(recvEvent->peer->data), recvEvent->channelId, recvEvent->packet);
+            if (const auto slot = getPlayerSlot(recvEvent->peer->data)) {
+                auto& player = players_[*slot];
+                recorder_.receive(frameCounter_, player.id, recvEvent->channelId,
+                    recvEvent->packet.getData<uint8_t>(), recvEvent->packet.getSize());
+                receive(player, recvEvent->channelId, recvEvent->packet);
+            }
         } else if (const auto errEvent = std::get_if<enet::ServiceFailedEvent>(&event.value())) {
             printErr("Host service failed: {}", errEvent->result);
+            return false;
         }
     }
+    return true;
 }
 
 PlayerId Server::Player::getNextId()
@@ -210,26 +608,34 @@ PlayerId Server::Player::getNextId()
     return idCounter++;
 }
 
-Server::Player::Player(ENetPeer* peer)
+Server::Player::Player(ENetPeer* peer, const ServerOptions& options)
     : peer(peer)
     , id(getNextId())
+    , scheduler(options.snapshotRate, options.clientBandwidth)
+    , priorities(options.maxPlayers, 0.0f)
 {
 }
 
-size_t Server::getPlayerIndex(PlayerId id) const
+void Server::Player::acknowledgeSnapshot(uint32_t frame)
 {
-    for (size_t i = 0; i < players_.size(); ++i)
-        if (players_[i].id == id)
-            return i;
-    std::abort();
+    if (frame != InvalidFrame && (snapshotAck == InvalidFrame || frame > snapshotAck))
+        snapshotAck = frame;
 }
 
-PlayerId Server::getPlayerId(const void* peerData) const
+void* Server::getPeerData(PlayerSlot slot)
 {
-    return static_cast<PlayerId>(reinterpret_cast<uintptr_t>(peerData));
+    return reinterpret_cast<void*>(static_cast<uintptr_t>(slot) + 1);
 }
 
-void Server::findSpawnPosition(Player& player)
+std::optional<Server::PlayerSlot> Server::getPlayerSlot(const void* peerData) const
+{
+    const auto data = reinterpret_cast<uintptr_t>(peerData);
+    if (data == 0 || !players_.contains(static_cast<PlayerSlot>(data - 1)))
+        return std::nullopt;
+    return static_cast<PlayerSlot>(data - 1);
+}
+
+const std::vector<glwx::Transform>& Server::getSpawnPoints()
 {
     static std::vector<glwx::Transform> spawnPoints;
     if (spawnPoints.empty()) {
@@ -245,9 +651,14 @@ void Server::findSpawnPosition(Player& player)
             std::abort();
         }
     }
+    return spawnPoints;
+}
+
+void Server::findSpawnPosition(Player& player)
+{
     auto& trafo = player.entity.get<comp::Transform>();
     const auto& collider = player.entity.get<comp::CylinderCollider>();
-    for (const auto& pos : spawnPoints) {
+    for (const auto& pos : getSpawnPoints()) {
         trafo = pos;
         if (!findFirstCollision(world_, player.entity, trafo, collider)) {
             return;
@@ -255,35 +666,53 @@ void Server::findSpawnPosition(Player& player)
     }
 }
 
-void Server::connectPeer(ENetPeer* peer)
+void Server::connectPeer(ENetPeer* peer, bool spectator)
 {
-    auto& player = players_.emplace_back(peer);
-    peer->data = reinterpret_cast<void*>(player.id);
+    const auto slot = players_.emplace(peer, options_);
+    for (auto& other : players_)
+        other.priorities[slot] = 0.0f;
+    auto& player = players_[slot];
+    peer->data = getPeerData(slot);
+    player.spectator = spectator;
+    player.lastKnownSystemState.resize(shipSystems_.size());
     const auto ip = enet::getIp(peer->address).value();
+    if (spectator) {
+        println("Spectator connected from {}: id = {}", ip, player.id);
+        // Passed on to the spectators of the relay, so they start somewhere sensible
+        const auto& spawn = getSpawnPoints().front();
+        send(player, Channel::Control,
+            Message<MessageType::ServerHello> { player.id, spawn.getPosition(),
+                spawn.getOrientation(), false, systemNames_.getNames(),
+                soundNames_.getNames() });
+        return;
+    }
     println("Client connected from {}: id = {}", ip, player.id);
     player.entity = world_.createEntity();
     player.entity.add<comp::Name>(comp::Name { "player_" + std::to_string(player.id) });
     player.entity.add<comp::NetworkPlayer>();
     player.entity.add<comp::CylinderCollider>(
         comp::CylinderCollider { playerRadius, cameraOffsetY });
+    if (inputCommands_)
+        player.entity.add<comp::Velocity>();
     const auto& trafo = player.entity.add<comp::Transform>();
     world_.flush();
     findSpawnPosition(player);
-    send(player, Channel::Reliable,
-        Message<MessageType::ServerHello> {
-            player.id, trafo.getPosition(), trafo.getOrientation() });
+    send(player, Channel::Control,
+        Message<MessageType::ServerHello> { player.id, trafo.getPosition(), trafo.getOrientation(),
+            inputCommands_, systemNames_.getNames(), soundNames_.getNames() });
 }
 
-void Server::disconnectPlayer(PlayerId id)
+void Server::disconnectPlayer(PlayerSlot slot)
 {
-    const auto idx = getPlayerIndex(id);
-    players_[idx].entity.destroy();
-    players_.erase(players_.begin() + idx);
+    const auto id = players_[slot].id;
+    if (players_[slot].entity)
+        players_[slot].entity.destroy();
+    players_.remove(slot);
     world_.flush();
     println("Client disconnected (id = {})", id);
     const auto terminal = getUsedTerminal(id);
     if (terminal) {
-        shipSystems_.at(*terminal).terminalUser = InvalidPlayerId;
+        shipSystems_[*terminal].terminalUser = InvalidPlayerId;
     }
 }
 
@@ -292,21 +721,53 @@ void Server::disconnectPlayer(PlayerId id)
         processMessage<MessageType::Type>(player, header.frameNumber, buffer);                     \
         break;
 
-void Server::receive(PlayerId id, uint8_t channelId, const enet::Packet& packet)
+void Server::receive(Player& player, uint8_t channelId, const enet::Packet& packet)
 {
-    auto& player = players_[getPlayerIndex(id)];
-    ReadBuffer buffer(packet.getData<uint8_t>(), packet.getSize());
+    const auto channel = static_cast<Channel>(channelId);
+    player.telemetry.addReceived(channel, packet.getSize());
+    if (!isChunk(packet.getData<uint8_t>(), packet.getSize())) {
+        receiveMessage(player, channel, packet.getData<uint8_t>(), packet.getSize());
+        return;
+    }
+    std::vector<uint8_t> message;
+    if (!player.chunks.add(channel, packet.getData<uint8_t>(), packet.getSize(), message))
+        printErr("Invalid message chunk");
+    else if (!message.empty())
+        receiveMessage(player, channel, message.data(), message.size());
+}
+
+void Server::receiveMessage(Player& player, Channel channel, const uint8_t* data, size_t size)
+{
+    if (analysis_)
+        analysis_->addMessage(time_, TrafficAnalysis::Direction::ToServer, channel, data, size);
+    std::optional<std::vector<uint8_t>> decompressed;
+    if (getChannelProperties(channel).compressed) {
+        decompressed
+            = decompressMessage(data, size, compressionStats_[static_cast<size_t>(channel)]);
+        if (!decompressed) {
+            printErr("Could not decompress message");
+            return;
+        }
+    }
+    ReadBuffer buffer = decompressed ? ReadBuffer(decompressed->data(), decompressed->size())
+                                     : ReadBuffer(data, size);
     CommonMessageHeader header;
     if (!deserialize(buffer, header)) {
         printErr("Could not decode common message header");
         return; // Ignore message
     }
     const auto messageType = static_cast<MessageType>(header.messageType);
-    if (static_cast<Channel>(channelId) == Channel::Reliable) {
+    if (channel != Channel::Unreliable) {
         // println("[server] Received message: {}", asString(messageType));
     }
+    // Spectators only acknowledge snapshots and synchronize their clock
+    if (player.spectator && messageType != MessageType::ClientMoveUpdate
+        && messageType != MessageType::ClientTimeSync)
+        return;
     switch (messageType) {
         MESSAGE_CASE(ClientMoveUpdate);
+        MESSAGE_CASE(ClientInputCommand);
+        MESSAGE_CASE(ClientTimeSync);
         MESSAGE_CASE(ClientInteractTerminal);
         MESSAGE_CASE(ClientUpdateTerminalInput);
         MESSAGE_CASE(ClientExecuteCommand);
@@ -319,45 +780,104 @@ void Server::receive(PlayerId id, uint8_t channelId, const enet::Packet& packet)
 void Server::processMessage(
     Player& player, uint32_t frameNumber, const Message<MessageType::ClientMoveUpdate>& message)
 {
-    auto& net = player.entity.get<comp::NetworkPlayer>();
-    if (net.lastUpdatedFrame < frameNumber) {
-        auto& trafo = player.entity.get<comp::Transform>();
-        trafo.setPosition(message.position);
-        trafo.setOrientation(message.orientation);
-        net.lastUpdatedFrame = frameNumber;
+    // In input command mode the server decides where players are
+    if (!inputCommands_ && !player.spectator) {
+        auto& net = player.entity.get<comp::NetworkPlayer>();
+        if (net.lastUpdatedFrame < frameNumber) {
+            auto& trafo = player.entity.get<comp::Transform>();
+            trafo.setPosition(message.position);
+            trafo.setOrientation(message.orientation);
+            net.lastUpdatedFrame = frameNumber;
+        }
+    }
+
+    player.acknowledgeSnapshot(message.snapshotAck);
+}
+
+void Server::processMessage(Player& player, uint32_t /*frameNumber*/,
+    const Message<MessageType::ClientInputCommand>& message)
+{
+    if (!inputCommands_) {
+        printErr("Player {} sent an input command, but input commands are disabled", player.id);
+        return;
+    }
+
+    const auto count = message.inputs.size();
+    if (count > maxRedundantInputs || (count > 0 && message.sequence < count - 1)) {
+        printErr("Player {} sent an invalid input command", player.id);
+        return;
+    }
+
+    // Inputs are repeated in the following packets and packets are unsequenced, so everything
+    // that has been received already is dropped.
+    for (size_t i = 0; i < count; ++i) {
+        const auto sequence = message.sequence - static_cast<uint32_t>(count - 1 - i);
+        if (player.lastInputSequence != InvalidInputSequence
+            && sequence <= player.lastInputSequence)
+            continue;
+        const auto& input = message.inputs[i];
+        player.inputs.push_back(
+            Player::InputCommand { sequence, MoveInput { input.buttons, input.orientation } });
+        player.lastInputSequence = sequence;
     }
+
+    player.acknowledgeSnapshot(message.snapshotAck);
 }
 
-std::optional<std::string> Server::getUsedTerminal(PlayerId id) const
+void Server::processMessage(Player& player, uint32_t /*frameNumber*/,
+    const Message<MessageType::ClientTimeSync>& message)
 {
-    for (const auto& [name, system] : shipSystems_) {
-        if (system.terminalUser == id)
-            return name;
+    const auto frame = (getSteadyTime() - startTime_) * tickRate;
+    const auto serverFrame = static_cast<uint32_t>(frame);
+    send(player, Channel::Unreliable,
+        Message<MessageType::ServerTimeSync> {
+            message.clientTime, serverFrame, static_cast<float>(frame - serverFrame) });
+}
+
+std::optional<SystemId> Server::getUsedTerminal(PlayerId id) const
+{
+    for (SystemId system = 0; system < shipSystems_.size(); ++system) {
+        if (shipSystems_[system].terminalUser == id)
+            return system;
     }
     return std::nullopt;
 }
 
+ecs::EntityHandle Server::findTerminal(SystemId id)
+{
+    const auto& system = systemNames_.getName(id);
+    ecs::EntityHandle found;
+    world_.forEachEntity<comp::Terminal>(
+        [&system, &found](ecs::EntityHandle entity, const comp::Terminal& terminal) {
+            if (!found && terminal.systemName == system) {
+                found = entity.get<comp::VisualLink>().entity;
+            }
+        });
+    assert(found);
+    return found;
+}
+
 void Server::processMessage(Player& player, uint32_t /*frameNumber*/,
     const Message<MessageType::ClientInteractTerminal>& message)
 {
-    if (message.terminal.empty()) {
+    if (message.terminal == SymbolTable::InvalidId) {
         const auto terminal = getUsedTerminal(player.id);
         if (!terminal) {
             printErr("Player {} stopped using a terminal when no terminal was used.", player.id);
             return;
         }
-        shipSystems_.at(*terminal).terminalUser = InvalidPlayerId;
+        shipSystems_[*terminal].terminalUser = InvalidPlayerId;
     } else {
-        const auto it = shipSystems_.find(message.terminal);
-        if (it == shipSystems_.end())
+        if (!systemNames_.isValid(message.terminal))
             return; // garbage, do nothing
 
-        if (it->second.terminalUser == InvalidPlayerId) { // terminal not used
-            it->second.terminalUser = player.id;
+        auto& system = shipSystems_[message.terminal];
+        if (system.terminalUser == InvalidPlayerId) { // terminal not used
+            system.terminalUser = player.id;
 
-            if (!it->second.initialized) {
-                it->second.system->executeInternalCommand("internal_init");
-                it->second.initialized = true;
+            if (!system.initialized) {
+                system.system->executeInternalCommand("internal_init");
+                system.initialized = true;
             }
         }
     }
@@ -371,19 +891,28 @@ void Server::processMessage(Player& player, uint32_t /*frameNumber*/,
         printErr("Player {} sent a terminal update without using a terminal", player.id);
         return;
     }
-    shipSystems_.at(*terminal).terminalInput = message.input;
+    if (message.input.size() > maxTerminalInputLength) {
+        printErr("Player {} sent a terminal input that is too long", player.id);
+        return;
+    }
+    shipSystems_[*terminal].terminalInput = message.input;
 }
 
 void Server::processMessage(Player& player, uint32_t /*frameNumber*/,
     const Message<MessageType::ClientExecuteCommand>& message)
 {
-    const auto systemName = getUsedTerminal(player.id);
-    if (!systemName) {
+    const auto systemId = getUsedTerminal(player.id);
+    if (!systemId) {
         printErr("Player {} executed a command on a terminal update without using a terminal",
             player.id);
         return;
     }
-    auto& system = shipSystems_.at(*systemName);
+    // It is echoed to everyone in the history
+    if (message.command.size() > maxTerminalInputLength) {
+        printErr("Player {} executed a command that is too long", player.id);
+        return;
+    }
+    auto& system = shipSystems_[*systemId];
 
     if (!message.command.empty()) {
         system.history.push_back(message.command);
@@ -399,5 +928,16 @@ void Server::processMessage(Player& player, uint32_t /*frameNumber*/,
 void Server::processMessage(
     Player& player, uint32_t /*frameNumber*/, const Message<MessageType::ClientPlaySound>& message)
 {
-    distribute(player, Channel::Reliable, message);
+    if (!soundNames_.isValid(message.sound))
+        return; // garbage, do nothing
+
+    std::vector<Player*> listeners;
+    for (auto& other : players_) {
+        if (other.id == player.id)
+            continue;
+        if (other.spectator
+            || isAudible(other.entity.get<comp::Transform>().getPosition(), message.position))
+            listeners.push_back(&other);
+    }
+    multicast(listeners, Channel::Event, message);
 }
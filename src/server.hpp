@@ -1,20 +1,56 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
+#include <fstream>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include "analysis.hpp"
 #include "ecs.hpp"
+#include "lanes.hpp"
 #include "net.hpp"
+#include "physics.hpp"
+#include "recording.hpp"
+#include "scheduler.hpp"
 #include "shipsystem.hpp"
+#include "slotmap.hpp"
+#include "snapshot.hpp"
+#include "telemetry.hpp"
 #include "util.hpp"
 
+struct ServerOptions {
+    size_t maxPlayers = defaultMaxPlayers;
+    // Upper limits per client. The scheduler sends less on bad links.
+    float snapshotRate = tickRate; // per second
+    float clientBandwidth = defaultClientBandwidth; // bytes per second
+    // Let clients send inputs instead of positions and simulate their movement on the server
+    bool inputCommands = false;
+    // For everything the server receives
+    enet::NetworkConditions networkConditions;
+    // Random if not set. Recordings store it, so the replay makes the same random decisions.
+    std::optional<uint32_t> randomSeed;
+    // Record the session to this file, if not empty
+    std::string recordPath;
+    // Append the telemetry of all players to this file every second (one JSON object per line),
+    // if not empty
+    std::string statsPath;
+    // Relays can only connect with this key (at most maxRelayKey), without it they are refused
+    std::optional<uint32_t> relayKey;
+};
+
 class Server {
 public:
     Server() = default;
 
     // this blocks until you call stop
-    bool run(const std::string& host, Port port, uint32_t gameCode, float exitTimeout);
+    bool run(const std::string& host, Port port, uint32_t gameCode, float exitTimeout,
+        const ServerOptions& options = {});
+
+    // Runs a recorded session again (without network and as fast as possible). If analysis is
+    // passed, everything the server receives and sends is added to it.
+    bool replay(const std::string& path, TrafficAnalysis* analysis = nullptr);
 
     bool isRunning() const;
 
@@ -29,17 +65,44 @@ private:
             PlayerId terminalUser = InvalidPlayerId;
         };
 
-        ecs::EntityHandle entity;
+        ecs::EntityHandle entity; // not for spectators
         ENetPeer* peer;
         PlayerId id;
-        std::unordered_map<ShipSystem::Name, LastKnownSystemState> lastKnownSystemState;
+        // Spectators (relays) are not in the world and can not interact. They get every player
+        // in every snapshot and hear every sound, so they can pass it on.
+        bool spectator = false;
+        std::vector<LastKnownSystemState> lastKnownSystemState; // indexed by SystemId
         ShipState lastKnownShipState;
+        // The snapshots sent to this player, so acknowledged ones can be used as delta baselines
+        SnapshotBuffer sentSnapshots;
+        uint32_t snapshotAck = InvalidFrame;
+        uint32_t lastSnapshotFrame = InvalidFrame;
+        SnapshotScheduler scheduler;
+        LaneScheduler lanes;
+        ChunkAssembler chunks;
+        PeerTelemetry telemetry;
+        // Of other players to be included in the next snapshot, indexed by PlayerSlot
+        std::vector<float> priorities;
+
+        struct InputCommand {
+            uint32_t sequence;
+            MoveInput input;
+        };
+
+        // Received, but not simulated yet
+        std::deque<InputCommand> inputs;
+        uint32_t lastInputSequence = InvalidInputSequence; // received
+        uint32_t inputAck = InvalidInputSequence; // simulated
 
         static PlayerId getNextId();
 
-        Player(ENetPeer* peer);
+        Player(ENetPeer* peer, const ServerOptions& options);
+
+        void acknowledgeSnapshot(uint32_t frame);
     };
 
+    using PlayerSlot = SlotMap<Player>::Index;
+
     struct ShipSystemData {
         std::unique_ptr<ShipSystem> system;
         PlayerId terminalUser = InvalidPlayerId;
@@ -53,46 +116,131 @@ private:
     template <MessageType MsgType>
     void broadcast(Channel channel, const Message<MsgType>& message)
     {
+        if (replaying_)
+            return;
         const auto buffer = serializeMessage(frameCounter_, message);
         host_.broadcast(static_cast<uint8_t>(channel),
             enet::Packet(buffer.getData(), buffer.getSize(), getChannelFlags(channel)));
     }
 
+    template <MessageType MsgType>
+    WriteBuffer encodeMessage(Channel channel, const Message<MsgType>& message)
+    {
+        const auto buffer = serializeMessage(frameCounter_, message);
+        if (!getChannelProperties(channel).compressed)
+            return buffer;
+        return compressMessage(buffer, compressionStats_[static_cast<size_t>(channel)]);
+    }
+
     template <MessageType MsgType>
     bool send(Player& player, Channel channel, const Message<MsgType>& message)
     {
-        return sendMessage(player.peer, channel, frameCounter_, message);
+        const auto buffer = encodeMessage(channel, message);
+        player.scheduler.addSentBytes(buffer.getSize());
+        player.telemetry.addSent(channel, buffer.getSize());
+        if (replaying_) {
+            if (analysis_)
+                analysis_->addMessage(time_, TrafficAnalysis::Direction::ToClient, channel,
+                    buffer.getData(), buffer.getSize());
+            return true;
+        }
+        if (getChannelProperties(channel).windowShare >= 1.0f)
+            return sendBuffer(player.peer, channel, buffer);
+        auto packets = createPackets(channel, buffer.getData(), buffer.getSize());
+        bool ret = !packets.empty();
+        for (auto& packet : packets) {
+            if (!player.lanes.queue(channel, std::make_shared<enet::Packet>(std::move(packet))))
+                ret = false;
+        }
+        return ret;
+    }
+
+    // Serializes the message only once and sends the same packet to all passed players
+    template <MessageType MsgType>
+    bool multicast(
+        const std::vector<Player*>& players, Channel channel, const Message<MsgType>& message)
+    {
+        if (players.empty())
+            return true;
+        const auto buffer = encodeMessage(channel, message);
+        for (auto player : players) {
+            player->scheduler.addSentBytes(buffer.getSize());
+            player->telemetry.addSent(channel, buffer.getSize());
+        }
+        if (replaying_) {
+            if (analysis_)
+                analysis_->addMessage(time_, TrafficAnalysis::Direction::ToClient, channel,
+                    buffer.getData(), buffer.getSize(), players.size());
+            return true;
+        }
+        auto packets = createPackets(channel, buffer.getData(), buffer.getSize());
+        if (packets.empty())
+            return false;
+        if (getChannelProperties(channel).windowShare < 1.0f) {
+            bool ret = true;
+            for (auto& packet : packets) {
+                const auto shared = std::make_shared<enet::Packet>(std::move(packet));
+                for (auto player : players) {
+                    if (!player->lanes.queue(channel, shared))
+                        ret = false;
+                }
+            }
+            return ret;
+        }
+        std::vector<ENetPeer*> peers;
+        peers.reserve(players.size());
+        for (auto player : players)
+            peers.push_back(player->peer);
+        bool ret = true;
+        for (auto& packet : packets) {
+            if (!host_.multicast(peers, static_cast<uint8_t>(channel), std::move(packet)))
+                ret = false;
+        }
+        return ret;
     }
 
     // Sends to everyone, but the passed player
     template <MessageType MsgType>
     bool distribute(Player& player, Channel channel, const Message<MsgType>& message)
     {
-        bool ret = true;
+        std::vector<Player*> others;
         for (auto& other : players_) {
-            if (other.id != player.id) {
-                ret = send(other, channel, message) && ret;
-            }
+            if (other.id != player.id)
+                others.push_back(&other);
         }
-        return ret;
+        return multicast(others, channel, message);
     }
 
-    void processEnetEvents();
+    // Everything run and replay have in common
+    bool init(const ServerOptions& options);
+    void shutdown();
+
+    // Waits up to timeoutMs for the first event. Returns false if the host failed.
+    bool processEnetEvents(uint32_t timeoutMs = 0);
     void tick(float dt);
+    void sendSnapshots();
+    void writeStats();
+    void simulatePlayers(float dt);
+    void simulateInput(Player& player, const Player::InputCommand& command, float dt);
 
-    size_t getPlayerIndex(PlayerId id) const;
-    PlayerId getPlayerId(const void* peerData) const;
-    void connectPeer(ENetPeer* peer);
-    void disconnectPlayer(PlayerId id);
-    void receive(PlayerId id, uint8_t channelId, const enet::Packet& packet);
+    // peer->data is the slot index of the player + 1, so nullptr means no player
+    static void* getPeerData(PlayerSlot slot);
+    std::optional<PlayerSlot> getPlayerSlot(const void* peerData) const;
+    void connectPeer(ENetPeer* peer, bool spectator);
+    void disconnectPlayer(PlayerSlot slot);
+    void receive(Player& player, uint8_t channelId, const enet::Packet& packet);
+    // A whole message (after putting chunks back together)
+    void receiveMessage(Player& player, Channel channel, const uint8_t* data, size_t size);
+    const std::vector<glwx::Transform>& getSpawnPoints();
     void findSpawnPosition(Player& player);
-    std::optional<std::string> getUsedTerminal(PlayerId id) const;
+    std::optional<SystemId> getUsedTerminal(PlayerId id) const;
+    ecs::EntityHandle findTerminal(SystemId system);
 
     template <MessageType MsgType>
     void processMessage(Player& player, uint32_t frameNumber, ReadBuffer& buffer)
     {
         Message<MsgType> message;
-        if (!deserialize(buffer, message)) {
+        if (!deserializeMessage(buffer, message)) {
             printErr("Could not decode message of type {}", MsgType);
             return;
         }
@@ -102,6 +250,12 @@ private:
     void processMessage(Player& player, uint32_t frameNumber,
         const Message<MessageType::ClientMoveUpdate>& message);
 
+    void processMessage(Player& player, uint32_t frameNumber,
+        const Message<MessageType::ClientInputCommand>& message);
+
+    void processMessage(Player& player, uint32_t frameNumber,
+        const Message<MessageType::ClientTimeSync>& message);
+
     void processMessage(Player& player, uint32_t frameNumber,
         const Message<MessageType::ClientInteractTerminal>& message);
 
@@ -116,11 +270,24 @@ private:
 
     enet::Host host_;
     ecs::World world_;
-    std::vector<Player> players_;
-    std::unordered_map<ShipSystem::Name, ShipSystemData> shipSystems_;
+    SlotMap<Player> players_;
+    std::vector<ShipSystemData> shipSystems_; // indexed by SystemId
+    SymbolTable systemNames_;
+    SymbolTable soundNames_;
+    LaneCompressionStats compressionStats_;
+    Recorder recorder_;
+    std::ofstream statsFile_;
+    float nextStats_ = 0.0f;
+    // Messages are still encoded (for the statistics), but not sent
+    bool replaying_ = false;
+    TrafficAnalysis* analysis_ = nullptr;
     float time_ = 0.0f;
+    double startTime_ = 0.0; // frame 0
     uint32_t frameCounter_ = 0;
     uint32_t connectCode_ = 0;
+    std::optional<uint32_t> relayConnectCode_;
+    bool inputCommands_ = false;
+    ServerOptions options_;
     float exitTimeout_ = 0;
     float lastNonEmpty_ = 0.0f;
     std::atomic<bool> running_ { false };
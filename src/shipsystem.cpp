@@ -1,12 +1,11 @@
 #include "shipsystem.hpp"
 
+#include <algorithm>
 #include <ctime>
 #include <functional>
 
 #include <fmt/chrono.h>
 
-#include <glwx.hpp>
-
 #include "constants.hpp"
 #include "util.hpp"
 
@@ -120,13 +119,13 @@ void ShipSystem::addTick(float interval, TickFunction func)
     ticks_.emplace_back(Tick { std::move(func), interval, rand<float>() });
 }
 
-void ShipSystem::update()
+void ShipSystem::update(float time)
 {
-    const auto now = glwx::getTime();
+    time_ = time;
     for (auto& tick : ticks_) {
-        if (tick.lastTick + tick.interval <= now) {
+        if (tick.lastTick + tick.interval <= time_) {
             tick.handler();
-            tick.lastTick = now;
+            tick.lastTick = time_;
         }
     }
 
@@ -139,6 +138,11 @@ void ShipSystem::update()
     }
 }
 
+float ShipSystem::getTime() const
+{
+    return time_;
+}
+
 void ShipSystem::addCommand(const std::string& name, const std::optional<std::string>& subCommand,
     const std::vector<std::string>& arguments, CommandFunc func)
 {
@@ -551,10 +555,12 @@ std::optional<size_t> ShipSystem::findLog(const LogId& id) const
 void ShipSystem::truncateTerminalOutput()
 {
     if (terminalOutput_.size() > maxTerminalOutputSize) {
-        auto count = terminalTruncateAmount;
+        // At once, even if a lot was added
+        auto count
+            = std::max(terminalTruncateAmount, terminalOutput_.size() - maxTerminalOutputSize);
         while (count < terminalOutput_.size() && terminalOutput_[count - 1] != '\n')
             count++;
-        terminalInput_.erase(0, count);
+        terminalOutput_.erase(0, count);
         terminalOutputStart_ += count;
     }
 }
@@ -607,13 +613,15 @@ MessageBus::Message getMessage(const std::string& messageId, sol::variadic_args
 
 ShipState LuaShipSystem::shipState;
 
-LuaShipSystem::LuaShipSystem(const ShipSystem::Name& name, const fs::path& scriptPath)
+LuaShipSystem::LuaShipSystem(
+    const ShipSystem::Name& name, const fs::path& scriptPath, uint32_t randomSeed)
     : ShipSystem(name)
 {
     lua.open_libraries(sol::lib::base, sol::lib::package, sol::lib::coroutine, sol::lib::string,
         sol::lib::os, sol::lib::math, sol::lib::table, sol::lib::bit32, sol::lib::io, sol::lib::ffi,
         sol::lib::jit, sol::lib::utf8);
     lua.set_exception_handler(&solExceptionHandler);
+    lua["math"]["randomseed"](randomSeed);
 
     lua.script(luaLib);
 
@@ -667,7 +675,7 @@ LuaShipSystem::LuaShipSystem(const ShipSystem::Name& name, const fs::path& scrip
     lua["log"].set_function([this](const std::string& logId, int level, const std::string& text) {
         log(logId, static_cast<LogLevel>(level), text);
     });
-    lua["time"].set_function([]() { return glwx::getTime(); });
+    lua["time"].set_function([this]() { return getTime(); });
     lua["setShipState"].set_function([this](const std::string& fieldName, sol::object value) {
         if (fieldName == "engineThrottle") {
             shipState.engineThrottle = value.as<float>();
@@ -109,7 +109,9 @@ public:
     virtual ~ShipSystem();
 
     void addTick(float interval, TickFunction func);
-    void update();
+    // The time is passed in (in seconds), so a replayed session sees the same times
+    void update(float time);
+    float getTime() const;
 
     void addBuiltinCommands();
     void addCommand(const std::string& command, const std::optional<std::string>& subCommand,
@@ -215,6 +217,7 @@ private:
     size_t terminalOutputStart_ = 0;
     std::string terminalInput_;
     Name name_;
+    float time_ = 0.0f;
 };
 
 struct LuaShipSystem : public ShipSystem {
@@ -222,6 +225,6 @@ struct LuaShipSystem : public ShipSystem {
 
     sol::state lua;
 
-    LuaShipSystem(const ShipSystem::Name& name, const fs::path& scriptPath);
+    LuaShipSystem(const ShipSystem::Name& name, const fs::path& scriptPath, uint32_t randomSeed);
     ~LuaShipSystem();
 };
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <vector>
+
+// A container that hands out indices on insertion, which stay valid until that element is
+// removed. Elements are never moved on removal and freed slots are reused.
+// If you reserve enough slots up front, pointers to elements are stable as well.
+template <typename T>
+class SlotMap {
+public:
+    using Index = uint32_t;
+
+    template <typename Slots, typename Value>
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = Value*;
+        using reference = Value&;
+
+        Iterator(Slots& slots, size_t index)
+            : slots_(&slots)
+            , index_(index)
+        {
+            skipEmpty();
+        }
+
+        Value& operator*() const
+        {
+            return *(*slots_)[index_];
+        }
+
+        Value* operator->() const
+        {
+            return &*(*slots_)[index_];
+        }
+
+        Iterator& operator++()
+        {
+            index_++;
+            skipEmpty();
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const
+        {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const Iterator& other) const
+        {
+            return index_ != other.index_;
+        }
+
+        Index getIndex() const
+        {
+            return static_cast<Index>(index_);
+        }
+
+    private:
+        void skipEmpty()
+        {
+            while (index_ < slots_->size() && !(*slots_)[index_])
+                index_++;
+        }
+
+        Slots* slots_;
+        size_t index_;
+    };
+
+    using iterator = Iterator<std::vector<std::optional<T>>, T>;
+    using const_iterator = Iterator<const std::vector<std::optional<T>>, const T>;
+
+    void reserve(size_t capacity)
+    {
+        slots_.reserve(capacity);
+    }
+
+    template <typename... Args>
+    Index emplace(Args&&... args)
+    {
+        size_++;
+        if (!freeList_.empty()) {
+            const auto index = freeList_.back();
+            freeList_.pop_back();
+            slots_[index].emplace(std::forward<Args>(args)...);
+            return index;
+        }
+        slots_.emplace_back(std::in_place, std::forward<Args>(args)...);
+        return static_cast<Index>(slots_.size() - 1);
+    }
+
+    void remove(Index index)
+    {
+        assert(contains(index));
+        slots_[index].reset();
+        freeList_.push_back(index);
+        size_--;
+    }
+
+    bool contains(Index index) const
+    {
+        return index < slots_.size() && slots_[index].has_value();
+    }
+
+    T& operator[](Index index)
+    {
+        assert(contains(index));
+        return *slots_[index];
+    }
+
+    const T& operator[](Index index) const
+    {
+        assert(contains(index));
+        return *slots_[index];
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    iterator begin()
+    {
+        return iterator(slots_, 0);
+    }
+
+    iterator end()
+    {
+        return iterator(slots_, slots_.size());
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(slots_, 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(slots_, slots_.size());
+    }
+
+private:
+    std::vector<std::optional<T>> slots_;
+    std::vector<Index> freeList_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,142 @@
+#include "snapshot.hpp"
+
+#include <algorithm>
+
+namespace {
+template <typename Players>
+auto lowerBound(Players& players, PlayerId id)
+{
+    return std::lower_bound(players.begin(), players.end(), id,
+        [](const PlayerSnapshot& player, PlayerId value) { return player.id < value; });
+}
+
+template <typename Players>
+auto findPlayer(Players& players, PlayerId id) -> decltype(players.data())
+{
+    const auto it = lowerBound(players, id);
+    if (it == players.end() || it->id != id)
+        return nullptr;
+    return &*it;
+}
+
+using PlayerState = Message<MessageType::ServerPlayerStateUpdate>::PlayerState;
+
+// Returns 0 if nothing changed
+uint8_t getChangedFields(const PlayerSnapshot& state, const PlayerSnapshot* base)
+{
+    uint8_t fields = 0;
+    if (!base || base->position != state.position)
+        fields |= PlayerState::Position;
+    if (!base || base->orientation != state.orientation)
+        fields |= PlayerState::Orientation;
+    return fields;
+}
+}
+
+const PlayerSnapshot* Snapshot::find(PlayerId id) const
+{
+    return findPlayer(players, id);
+}
+
+PlayerSnapshot* Snapshot::find(PlayerId id)
+{
+    return findPlayer(players, id);
+}
+
+void SnapshotBuffer::add(Snapshot snapshot)
+{
+    assert(snapshot.frame != InvalidFrame);
+    assert(std::is_sorted(snapshot.players.begin(), snapshot.players.end(),
+        [](const PlayerSnapshot& a, const PlayerSnapshot& b) { return a.id < b.id; }));
+    auto& slot = snapshots_[snapshot.frame % snapshots_.size()];
+    slot = std::move(snapshot);
+}
+
+const Snapshot* SnapshotBuffer::find(uint32_t frame) const
+{
+    if (frame == InvalidFrame)
+        return nullptr;
+    const auto& slot = snapshots_[frame % snapshots_.size()];
+    return slot.frame == frame ? &slot : nullptr;
+}
+
+void SnapshotBuffer::clear()
+{
+    for (auto& snapshot : snapshots_)
+        snapshot = Snapshot {};
+}
+
+size_t getPlayerStateBits(const PlayerSnapshot& state, const PlayerSnapshot* base)
+{
+    const auto fields = getChangedFields(state, base);
+    if (fields == 0)
+        return 0; // elided
+    PlayerState playerState { state.id, fields, state.position, state.orientation };
+    MeasureStream stream;
+    stream.serialize(playerState);
+    return stream.getBits();
+}
+
+Message<MessageType::ServerPlayerStateUpdate> encodeDelta(
+    const Snapshot& snapshot, const Snapshot* baseline)
+{
+    Message<MessageType::ServerPlayerStateUpdate> message;
+    message.baselineAge = 0;
+    if (baseline) {
+        assert(snapshot.frame > baseline->frame);
+        assert(snapshot.frame - baseline->frame < snapshotBufferSize);
+        message.baselineAge = static_cast<uint8_t>(snapshot.frame - baseline->frame);
+    }
+
+    for (const auto& player : snapshot.players) {
+        const auto fields
+            = getChangedFields(player, baseline ? baseline->find(player.id) : nullptr);
+        if (fields != 0)
+            message.players.push_back(
+                PlayerState { player.id, fields, player.position, player.orientation });
+    }
+
+    if (baseline) {
+        for (const auto& player : baseline->players) {
+            if (!snapshot.find(player.id))
+                message.removedPlayers.push_back(player.id);
+        }
+    }
+    return message;
+}
+
+std::optional<Snapshot> applyDelta(uint32_t frame,
+    const Message<MessageType::ServerPlayerStateUpdate>& message, const SnapshotBuffer& snapshots)
+{
+    Snapshot snapshot { frame, {} };
+    if (message.baselineAge > 0) {
+        const auto baseline = snapshots.find(frame - message.baselineAge);
+        if (!baseline)
+            return std::nullopt;
+        snapshot.players = baseline->players;
+    }
+
+    for (const auto id : message.removedPlayers) {
+        const auto player = snapshot.find(id);
+        if (!player)
+            return std::nullopt;
+        snapshot.players.erase(snapshot.players.begin() + (player - snapshot.players.data()));
+    }
+
+    for (const auto& state : message.players) {
+        auto player = snapshot.find(state.id);
+        if (!player) {
+            // New players have to be sent in full
+            if (state.fields != PlayerState::All)
+                return std::nullopt;
+            snapshot.players.insert(lowerBound(snapshot.players, state.id),
+                PlayerSnapshot { state.id, state.position, state.orientation });
+            continue;
+        }
+        if (state.fields & PlayerState::Position)
+            player->position = state.position;
+        if (state.fields & PlayerState::Orientation)
+            player->orientation = state.orientation;
+    }
+    return snapshot;
+}
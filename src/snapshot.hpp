@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "net.hpp"
+
+struct PlayerSnapshot {
+    PlayerId id;
+    glm::vec3 position;
+    glm::quat orientation;
+};
+
+struct Snapshot {
+    uint32_t frame = InvalidFrame;
+    std::vector<PlayerSnapshot> players; // sorted by id
+
+    const PlayerSnapshot* find(PlayerId id) const;
+    PlayerSnapshot* find(PlayerId id);
+};
+
+// A ring buffer of the last snapshotBufferSize snapshots
+class SnapshotBuffer {
+public:
+    void add(Snapshot snapshot);
+
+    // Returns nullptr if the snapshot was never added or has been overwritten already
+    const Snapshot* find(uint32_t frame) const;
+
+    void clear();
+
+private:
+    std::array<Snapshot, snapshotBufferSize> snapshots_;
+};
+
+// How many bits the state of a player takes up in a delta against base (nullptr if there is none)
+size_t getPlayerStateBits(const PlayerSnapshot& state, const PlayerSnapshot* base);
+
+// If baseline is nullptr, a full snapshot is encoded
+Message<MessageType::ServerPlayerStateUpdate> encodeDelta(
+    const Snapshot& snapshot, const Snapshot* baseline);
+
+// Returns std::nullopt if the baseline is not available or the message is inconsistent with it
+std::optional<Snapshot> applyDelta(uint32_t frame,
+    const Message<MessageType::ServerPlayerStateUpdate>& message, const SnapshotBuffer& snapshots);
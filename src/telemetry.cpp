@@ -0,0 +1,88 @@
+#include "telemetry.hpp"
+
+#include <cassert>
+
+#include <fmt/format.h>
+
+namespace {
+// Returns how much was added since the last call, even if ENet reset the total in between
+size_t getDelta(uint32_t total, uint32_t& lastTotal)
+{
+    const auto delta = total >= lastTotal ? total - lastTotal : total;
+    lastTotal = total;
+    return delta;
+}
+}
+
+void PeerTelemetry::addSent(Channel channel, size_t bytes)
+{
+    auto& counter = current_.channels[static_cast<size_t>(channel)].out;
+    counter.messages++;
+    counter.bytes += bytes;
+}
+
+void PeerTelemetry::addReceived(Channel channel, size_t bytes)
+{
+    auto& counter = current_.channels[static_cast<size_t>(channel)].in;
+    counter.messages++;
+    counter.bytes += bytes;
+}
+
+bool PeerTelemetry::update(const ENetPeer& peer, double time)
+{
+    current_.enetBytesIn += getDelta(peer.incomingDataTotal, lastIncomingDataTotal_);
+    current_.enetBytesOut += getDelta(peer.outgoingDataTotal, lastOutgoingDataTotal_);
+
+    if (sampleStart_ < 0.0)
+        sampleStart_ = time;
+    if (time - sampleStart_ < sampleInterval)
+        return false;
+
+    current_.time = time;
+    current_.roundTripTime = static_cast<float>(peer.roundTripTime);
+    current_.roundTripTimeVariance = static_cast<float>(peer.roundTripTimeVariance);
+    current_.packetLoss = static_cast<float>(peer.packetLoss) / ENET_PEER_PACKET_LOSS_SCALE;
+    current_.packetThrottle
+        = static_cast<float>(peer.packetThrottle) / ENET_PEER_PACKET_THROTTLE_SCALE;
+    samples_.push_back(current_);
+    while (samples_.size() > maxSamples)
+        samples_.pop_front();
+    current_ = Sample {};
+    sampleStart_ = time;
+    return true;
+}
+
+bool PeerTelemetry::hasSamples() const
+{
+    return !samples_.empty();
+}
+
+const PeerTelemetry::Sample& PeerTelemetry::getLatest() const
+{
+    assert(!samples_.empty());
+    return samples_.back();
+}
+
+const std::deque<PeerTelemetry::Sample>& PeerTelemetry::getSamples() const
+{
+    return samples_;
+}
+
+std::string toJson(const PeerTelemetry::Sample& sample)
+{
+    std::string json = fmt::format(
+        R"({{"time": {:.3f}, "roundTripTime": {:.1f}, "roundTripTimeVariance": {:.1f}, )"
+        R"("packetLoss": {:.4f}, "packetThrottle": {:.3f}, "enetBytesIn": {}, )"
+        R"("enetBytesOut": {}, "channels": {{)",
+        sample.time, sample.roundTripTime, sample.roundTripTimeVariance, sample.packetLoss,
+        sample.packetThrottle, sample.enetBytesIn, sample.enetBytesOut);
+    for (size_t c = 0; c < sample.channels.size(); ++c) {
+        const auto& channel = sample.channels[c];
+        json += fmt::format(
+            R"({}"{}": {{"messagesIn": {}, "bytesIn": {}, "messagesOut": {}, "bytesOut": {}}})",
+            c > 0 ? ", " : "", asString(static_cast<Channel>(c)), channel.in.messages,
+            channel.in.bytes, channel.out.messages, channel.out.bytes);
+    }
+    json += "}}";
+    return json;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <string>
+
+#include "enet.hpp"
+#include "net.hpp"
+
+// Link quality and throughput of one peer, so complaints can be matched with the connection.
+// ENet's statistics are read every tick and a sample is taken every sampleInterval seconds. The
+// per-channel counters count our messages as they are passed to and from ENet (so maybe
+// compressed), ENet's counters include its own headers, acknowledgements and resends.
+class PeerTelemetry {
+public:
+    static constexpr double sampleInterval = 1.0; // seconds
+    static constexpr size_t maxSamples = 60;
+
+    struct Counter {
+        size_t messages = 0;
+        size_t bytes = 0;
+    };
+
+    struct ChannelSample {
+        Counter in;
+        Counter out;
+    };
+
+    // The counters are for the interval since the previous sample
+    struct Sample {
+        double time = 0.0; // end of the interval, in seconds
+        float roundTripTime = 0.0f; // milliseconds, smoothed by ENet
+        float roundTripTimeVariance = 0.0f; // milliseconds
+        float packetLoss = 0.0f; // [0, 1]
+        float packetThrottle = 0.0f; // [0, 1], how many unreliable packets ENet lets through
+        size_t enetBytesIn = 0;
+        size_t enetBytesOut = 0;
+        std::array<ChannelSample, static_cast<size_t>(Channel::Count)> channels {};
+    };
+
+    void addSent(Channel channel, size_t bytes);
+    void addReceived(Channel channel, size_t bytes);
+
+    // Call once per tick. Returns true if a new sample was taken.
+    bool update(const ENetPeer& peer, double time);
+
+    bool hasSamples() const;
+    // Only valid if hasSamples
+    const Sample& getLatest() const;
+    // Oldest first
+    const std::deque<Sample>& getSamples() const;
+
+private:
+    Sample current_; // still collecting
+    std::deque<Sample> samples_;
+    double sampleStart_ = -1.0;
+    // ENet resets these about every second, so they are accumulated every tick
+    uint32_t lastIncomingDataTotal_ = 0;
+    uint32_t lastOutgoingDataTotal_ = 0;
+};
+
+// A single line object, e.g. for a stats dump
+std::string toJson(const PeerTelemetry::Sample& sample);
@@ -0,0 +1,79 @@
+#include "timesync.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "net.hpp"
+
+namespace {
+// Until there are maxSamples samples, they are requested more often
+constexpr auto initialRequestInterval = 0.1;
+constexpr auto requestInterval = 1.0;
+constexpr auto roundTripTimeSmoothing = 0.1;
+// Small corrections are applied gradually, so the server frame does not jump around
+constexpr auto maxOffsetJump = 2.0; // frames
+constexpr auto maxOffsetSlew = 0.1; // frames per sample
+}
+
+void ClockSync::addSample(double requestTime, double responseTime, double serverFrame)
+{
+    const auto roundTripTime = std::max(responseTime - requestTime, 0.0);
+    // Assume the request and response took equally long
+    const auto offset = serverFrame - (requestTime + roundTripTime * 0.5) * tickRate;
+    samples_[nextSample_] = Sample { roundTripTime, offset };
+    nextSample_ = (nextSample_ + 1) % maxSamples;
+
+    const auto end = samples_.begin() + std::min(numSamples_ + 1, maxSamples);
+    const auto best = std::min_element(samples_.begin(), end,
+        [](const Sample& a, const Sample& b) { return a.roundTripTime < b.roundTripTime; });
+
+    if (numSamples_ == 0) {
+        roundTripTime_ = roundTripTime;
+        offset_ = best->offset;
+    } else {
+        roundTripTime_ += (roundTripTime - roundTripTime_) * roundTripTimeSmoothing;
+        const auto diff = best->offset - offset_;
+        if (std::abs(diff) > maxOffsetJump)
+            offset_ = best->offset;
+        else
+            offset_ += std::clamp(diff, -maxOffsetSlew, maxOffsetSlew);
+    }
+    numSamples_ = std::min(numSamples_ + 1, maxSamples);
+}
+
+bool ClockSync::isValid() const
+{
+    return numSamples_ > 0;
+}
+
+double ClockSync::getRoundTripTime() const
+{
+    return roundTripTime_;
+}
+
+double ClockSync::getServerFrame(double localTime) const
+{
+    return localTime * tickRate + offset_;
+}
+
+bool ClockSync::isRequestDue(double localTime) const
+{
+    return localTime >= nextRequest_;
+}
+
+void ClockSync::requestSent(double localTime)
+{
+    nextRequest_
+        = localTime + (numSamples_ < maxSamples ? initialRequestInterval : requestInterval);
+}
+
+uint32_t getTimeSyncStamp(double time)
+{
+    return static_cast<uint32_t>(static_cast<uint64_t>(time * 1e6));
+}
+
+double getTimeSyncStampAge(uint32_t stamp, double time)
+{
+    // Unsigned subtraction handles the wrap around
+    return static_cast<uint32_t>(getTimeSyncStamp(time) - stamp) * 1e-6;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// NTP-style clock synchronization. The client regularly sends its local time, the server answers
+// right away with its current (fractional) frame and the client derives the round trip time and
+// the offset between both clocks from that.
+// The delays of samples with a low round trip time are the least asymmetric, so the offset is
+// taken from the sample with the lowest round trip time among the recent ones.
+class ClockSync {
+public:
+    // Times in local seconds (getSteadyTime)
+    void addSample(double requestTime, double responseTime, double serverFrame);
+
+    bool isValid() const;
+
+    // Smoothed, in seconds
+    double getRoundTripTime() const;
+
+    double getServerFrame(double localTime) const;
+
+    bool isRequestDue(double localTime) const;
+    void requestSent(double localTime);
+
+private:
+    struct Sample {
+        double roundTripTime;
+        double offset;
+    };
+
+    static constexpr size_t maxSamples = 16;
+
+    std::array<Sample, maxSamples> samples_;
+    size_t numSamples_ = 0;
+    size_t nextSample_ = 0;
+    double offset_ = 0.0; // server frame - local time in frames
+    double roundTripTime_ = 0.0;
+    double nextRequest_ = 0.0;
+};
+
+// Wraps around every ~71 minutes, which is fine for measuring round trip times
+uint32_t getTimeSyncStamp(double time);
+double getTimeSyncStampAge(uint32_t stamp, double time);
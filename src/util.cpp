@@ -1,6 +1,10 @@
 #include "util.hpp"
 
 #include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <sstream>
 
 #include <fmt/format.h>
 
@@ -32,6 +36,14 @@ float approach(float current, float target, float delta)
     return current;
 }
 
+double getSteadyTime()
+{
+    using Seconds = std::chrono::duration<double>;
+    return std::chrono::duration_cast<Seconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
 std::optional<float> parseFloat(const std::string& str)
 {
     try {
@@ -64,6 +76,16 @@ std::string toLower(const std::string& str)
     return out;
 }
 
+std::optional<std::string> readFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return std::nullopt;
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
 std::vector<std::string> split(const std::string& str)
 {
     std::vector<std::string> parts;
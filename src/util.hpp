@@ -14,6 +14,9 @@ float rescale(float val, float fromA, float fromB, float toA, float toB);
 
 float approach(float current, float target, float delta);
 
+// Monotonic and high resolution, in seconds. Only differences are meaningful.
+double getSteadyTime();
+
 // I would use boost's lexical cast, if I had another reason to use boost
 template <typename T = long long>
 std::optional<T> parseInt(const std::string& str, int base = 10)
@@ -41,6 +44,8 @@ std::string toLower(const std::string& str);
 
 std::vector<std::string> split(const std::string& str);
 
+std::optional<std::string> readFile(const std::string& path);
+
 template <typename T>
 T safeNormalize(const T& vec)
 {
@@ -1,2 +1,2 @@
 #pragma once
-constexpr const uint8_t version = 2;
+constexpr const uint8_t version = 14;
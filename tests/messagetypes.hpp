@@ -0,0 +1,31 @@
+#pragma once
+
+#include <type_traits>
+
+#include "net.hpp"
+
+template <MessageType MsgType>
+using MessageTypeTag = std::integral_constant<MessageType, MsgType>;
+
+// Calls func with a MessageTypeTag of every message type, in the order of MessageType
+template <typename Func>
+void forEachMessageType(Func&& func)
+{
+    func(MessageTypeTag<MessageType::ServerHello> {});
+    func(MessageTypeTag<MessageType::ClientMoveUpdate> {});
+    func(MessageTypeTag<MessageType::ServerPlayerStateUpdate> {});
+    func(MessageTypeTag<MessageType::ClientInteractTerminal> {});
+    func(MessageTypeTag<MessageType::ServerInteractTerminal> {});
+    func(MessageTypeTag<MessageType::ClientUpdateTerminalInput> {});
+    func(MessageTypeTag<MessageType::ClientExecuteCommand> {});
+    func(MessageTypeTag<MessageType::ServerUpdateTerminalOutput> {});
+    func(MessageTypeTag<MessageType::ServerAddTerminalHistory> {});
+    func(MessageTypeTag<MessageType::ClientPlaySound> {});
+    func(MessageTypeTag<MessageType::ServerUpdateInputEnabled> {});
+    func(MessageTypeTag<MessageType::ServerUpdateShipState> {});
+    func(MessageTypeTag<MessageType::ClientInputCommand> {});
+    func(MessageTypeTag<MessageType::ClientTimeSync> {});
+    func(MessageTypeTag<MessageType::ServerTimeSync> {});
+}
+
+static constexpr size_t messageTypeCount = 15;
@@ -1,3 +1,7 @@
+#include <cmath>
+
+#include <fmt/format.h>
+
 #include "serialization.hpp"
 
 struct A {
@@ -55,7 +59,7 @@ struct ServerPlayerStateUpdate {
         SERIALIZE()
         {
             FIELD(guid);
-            FIELD(position);
+            FIELD_QUANTIZED(position, -256.0f, 256.0f, 1.0f / 128.0f);
             FIELD(orientation);
             SERIALIZE_END;
         }
@@ -70,13 +74,26 @@ struct ServerPlayerStateUpdate {
     }
 };
 
+// Lengths are varints, so this is neither limited to 255 elements nor to short strings
+struct Log {
+    std::vector<std::string> lines;
+
+    SERIALIZE()
+    {
+        FIELD_VEC(lines);
+        SERIALIZE_END;
+    }
+};
+
 int main(int, char**)
 {
     WriteBuffer wbuf(1024);
     B src { 69, 0x12345678, -589589, 89.484f, glm::vec3(3.0, 4.0f, 2.0), A { 12 },
         { A { 59 }, A { 68 }, A { 92 }, A { 39 } }, { 5, 753, 8493, 8, 482948, 999 } };
-    if (!serialize(wbuf, src))
+    if (!serialize(wbuf, src)) {
         fmt::print(stderr, "Error serializing\n");
+        return 1;
+    }
 
     fmt::print("data: ");
     for (size_t i = 0; i < wbuf.getSize(); ++i)
@@ -87,21 +104,77 @@ int main(int, char**)
     B dst;
     if (!deserialize(rbuf, dst)) {
         fmt::print(stderr, "Error deserializing\n");
-    } else {
-        fmt::print("B = {{c = {}, u = {:x}, x = {}, f = {}, v = {}, a = {{y = {}}} }}\n", dst.c,
-            dst.u, dst.x, dst.f, dst.v, dst.a.y);
-        for (size_t i = 0; i < dst.as.size(); ++i)
-            fmt::print("B.as[{}].y = {}\n", i, dst.as[i].y);
-        for (size_t i = 0; i < dst.is.size(); ++i)
-            fmt::print("B.is[{}].y = {}\n", i, dst.is[i]);
+        return 1;
     }
+    fmt::print("B = {{c = {}, u = {:x}, x = {}, f = {}, v = ({}, {}, {}), a = {{y = {}}} }}\n",
+        dst.c, dst.u, dst.x, dst.f, dst.v.x, dst.v.y, dst.v.z, dst.a.y);
+    for (size_t i = 0; i < dst.as.size(); ++i)
+        fmt::print("B.as[{}].y = {}\n", i, dst.as[i].y);
+    for (size_t i = 0; i < dst.is.size(); ++i)
+        fmt::print("B.is[{}].y = {}\n", i, dst.is[i]);
 
     ServerPlayerStateUpdate psu;
     wbuf.clear();
-    if (!serialize(wbuf, psu))
+    if (!serialize(wbuf, psu)) {
         fmt::print(stderr, "Error serializing psu\n");
+        return 1;
+    }
     ReadBuffer rbuf2(wbuf.getData(), wbuf.getSize());
-    if (!deserialize(rbuf2, psu))
+    if (!deserialize(rbuf2, psu)) {
         fmt::print(stderr, "Error deserializing\n");
+        return 1;
+    }
+
+    psu.players.push_back({ 7, glm::vec3(-16.0f, -10.0f, -44.3f),
+        glm::normalize(glm::quat(0.9f, 0.1f, -0.4f, 0.05f)) });
+    psu.players.push_back({ 8, glm::vec3(24.5f, 0.0f, 52.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f) });
+    wbuf.clear();
+    if (!serialize(wbuf, psu)) {
+        fmt::print(stderr, "Error serializing psu\n");
+        return 1;
+    }
+    const auto byteSize = wbuf.getSize();
+    wbuf.clear();
+    if (!serializeBits(wbuf, psu)) {
+        fmt::print(stderr, "Error bit-serializing psu\n");
+        return 1;
+    }
+    fmt::print("psu: {} bytes, bit-packed: {} bytes\n", byteSize, wbuf.getSize());
+
+    ReadBuffer rbuf3(wbuf.getData(), wbuf.getSize());
+    ServerPlayerStateUpdate bitPsu;
+    if (!deserializeBits(rbuf3, bitPsu) || bitPsu.players.size() != psu.players.size()) {
+        fmt::print(stderr, "Error bit-deserializing psu\n");
+        return 1;
+    }
+    for (size_t i = 0; i < psu.players.size(); ++i) {
+        const auto& a = psu.players[i];
+        const auto& b = bitPsu.players[i];
+        const auto posError = glm::length(a.position - b.position);
+        // q and -q are the same orientation
+        const auto quatError = 1.0f - std::abs(glm::dot(a.orientation, b.orientation));
+        fmt::print("psu.players[{}]: guid = {}, position error = {}, orientation error = {}\n", i,
+            b.guid, posError, quatError);
+        if (a.guid != b.guid || posError > 1.0f / 128.0f || quatError > 1e-4f) {
+            fmt::print(stderr, "Bit-packed round trip mismatch\n");
+            return 1;
+        }
+    }
+
+    Log log;
+    for (size_t i = 0; i < 300; ++i)
+        log.lines.push_back(std::string(i, 'x'));
+    wbuf.clear();
+    if (!serializeBits(wbuf, log)) {
+        fmt::print(stderr, "Error bit-serializing log\n");
+        return 1;
+    }
+    fmt::print("log: {} bytes\n", wbuf.getSize());
+    ReadBuffer rbuf4(wbuf.getData(), wbuf.getSize());
+    Log bitLog;
+    if (!deserializeBits(rbuf4, bitLog) || bitLog.lines != log.lines) {
+        fmt::print(stderr, "Log round trip mismatch\n");
+        return 1;
+    }
     return 0;
 }
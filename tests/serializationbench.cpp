@@ -0,0 +1,298 @@
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "messagetypes.hpp"
+
+// Measures how fast every message type is encoded and decoded (like the game does, with the
+// common header and the bit-packed body) and checks that the decoded messages encode to the
+// same bytes again and that getMessageSize is exact.
+// Usage: complexity_serialization_bench [--save=<file>] [--baseline=<file>] [--tolerance=<percent>]
+// --save writes the rates to a file, --baseline compares them with a saved file and fails if a
+// rate dropped by more than the tolerance (default 20%).
+
+namespace {
+constexpr double minDuration = 0.2; // seconds per type and direction
+constexpr size_t batchSize = 1000;
+constexpr uint32_t frameNumber = 123456;
+
+struct Result {
+    std::string type;
+    size_t size = 0; // bytes per message
+    double encodeRate = 0.0; // messages per second
+    double decodeRate = 0.0;
+};
+
+// Roughly what is sent during a game
+template <MessageType MsgType>
+Message<MsgType> getSample();
+
+const glm::quat sampleOrientation = glm::normalize(glm::quat(0.9f, 0.1f, -0.4f, 0.05f));
+
+template <>
+Message<MessageType::ServerHello> getSample()
+{
+    return { 3, glm::vec3(12.5f, 1.0f, -40.25f), sampleOrientation, true,
+        { "engine", "reactor", "navigation", "communications", "shields", "sensors", "airlock",
+            "lifesupport" },
+        { "beep", "error", "engine_start", "engine_stop", "alarm", "door", "typing" } };
+}
+
+template <>
+Message<MessageType::ClientMoveUpdate> getSample()
+{
+    return { glm::vec3(12.5f, 1.0f, -40.25f), sampleOrientation, frameNumber - 3 };
+}
+
+template <>
+Message<MessageType::ServerPlayerStateUpdate> getSample()
+{
+    using PlayerState = Message<MessageType::ServerPlayerStateUpdate>::PlayerState;
+    Message<MessageType::ServerPlayerStateUpdate> message;
+    message.baselineAge = 0;
+    for (PlayerId id = 0; id < 4; ++id)
+        message.players.push_back(PlayerState { id, PlayerState::All,
+            glm::vec3(2.0f * id, 1.0f, -3.5f * id), sampleOrientation });
+    message.inputAck = 4200;
+    message.velocity = glm::vec3(1.5f, 0.0f, -2.25f);
+    return message;
+}
+
+template <>
+Message<MessageType::ClientInteractTerminal> getSample()
+{
+    return { 2 };
+}
+
+template <>
+Message<MessageType::ServerInteractTerminal> getSample()
+{
+    return { 2, 3 };
+}
+
+template <>
+Message<MessageType::ClientUpdateTerminalInput> getSample()
+{
+    return { "reroute power eng" };
+}
+
+template <>
+Message<MessageType::ClientExecuteCommand> getSample()
+{
+    return { "reroute power engines 80" };
+}
+
+template <>
+Message<MessageType::ServerUpdateTerminalOutput> getSample()
+{
+    std::string text;
+    for (size_t i = 0; i < 32; ++i)
+        text += fmt::format("[{:04}] Reactor output nominal, core temperature {} K\n", i, 900 + i);
+    return { 1, text };
+}
+
+template <>
+Message<MessageType::ServerAddTerminalHistory> getSample()
+{
+    return { 1, std::vector<std::string>(16, "reroute power engines 80") };
+}
+
+template <>
+Message<MessageType::ClientPlaySound> getSample()
+{
+    return { 4, glm::vec3(12.5f, 1.0f, -40.25f) };
+}
+
+template <>
+Message<MessageType::ServerUpdateInputEnabled> getSample()
+{
+    return { 1, true };
+}
+
+template <>
+Message<MessageType::ServerUpdateShipState> getSample()
+{
+    return { 0.75f, 0.9f };
+}
+
+template <>
+Message<MessageType::ClientInputCommand> getSample()
+{
+    using Input = Message<MessageType::ClientInputCommand>::Input;
+    return { 4200, std::vector<Input>(maxRedundantInputs, Input { 0b101, sampleOrientation }),
+        frameNumber - 3 };
+}
+
+template <>
+Message<MessageType::ClientTimeSync> getSample()
+{
+    return { 987654 };
+}
+
+template <>
+Message<MessageType::ServerTimeSync> getSample()
+{
+    return { 987654, frameNumber, 0.25f };
+}
+
+template <MessageType MsgType>
+bool decode(const WriteBuffer& encoded, Message<MsgType>& message)
+{
+    ReadBuffer buffer(encoded.getData(), encoded.getSize());
+    CommonMessageHeader header;
+    return deserialize(buffer, header) && header.messageType == static_cast<uint8_t>(MsgType)
+        && deserializeMessage(buffer, message);
+}
+
+template <typename Func>
+double measure(Func&& func)
+{
+    const auto start = getSteadyTime();
+    size_t iterations = 0;
+    double elapsed = 0.0;
+    do {
+        for (size_t i = 0; i < batchSize; ++i)
+            func();
+        iterations += batchSize;
+        elapsed = getSteadyTime() - start;
+    } while (elapsed < minDuration);
+    return iterations / elapsed;
+}
+
+template <MessageType MsgType>
+std::optional<Result> benchmark()
+{
+    const auto sample = getSample<MsgType>();
+    const auto encoded = serializeMessage(frameNumber, sample);
+    if (getMessageSize(sample) != encoded.getSize()) {
+        printErr("{} is {} bytes, but measured {}", asString(MsgType), encoded.getSize(),
+            getMessageSize(sample));
+        return std::nullopt;
+    }
+
+    Message<MsgType> decoded;
+    if (!decode(encoded, decoded)) {
+        printErr("Could not decode {}", asString(MsgType));
+        return std::nullopt;
+    }
+    const auto reencoded = serializeMessage(frameNumber, decoded);
+    if (reencoded.getSize() != encoded.getSize()
+        || std::memcmp(reencoded.getData(), encoded.getData(), encoded.getSize()) != 0) {
+        printErr("{} does not encode to the same bytes after decoding", asString(MsgType));
+        return std::nullopt;
+    }
+
+    // Keeps the compiler from optimizing the work away
+    volatile size_t sink = 0;
+    Result result { asString(MsgType), encoded.getSize() };
+    result.encodeRate
+        = measure([&]() { sink = sink + serializeMessage(frameNumber, sample).getSize(); });
+    result.decodeRate = measure([&]() {
+        Message<MsgType> message;
+        sink = sink + decode(encoded, message);
+    });
+    return result;
+}
+
+std::optional<std::string> getArg(int argc, char** argv, const std::string& name)
+{
+    const auto prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind(prefix, 0) == 0)
+            return arg.substr(prefix.size());
+    }
+    return std::nullopt;
+}
+
+// type -> (encode rate, decode rate)
+std::optional<std::map<std::string, std::pair<double, double>>> loadBaseline(
+    const std::string& path)
+{
+    const auto data = readFile(path);
+    if (!data)
+        return std::nullopt;
+    std::map<std::string, std::pair<double, double>> baseline;
+    std::istringstream lines(*data);
+    std::string line;
+    while (std::getline(lines, line)) {
+        const auto parts = split(line);
+        if (parts.size() != 3)
+            continue;
+        const auto encodeRate = parseFloat(parts[1]);
+        const auto decodeRate = parseFloat(parts[2]);
+        if (encodeRate && decodeRate)
+            baseline[parts[0]] = { *encodeRate, *decodeRate };
+    }
+    return baseline;
+}
+}
+
+int main(int argc, char** argv)
+{
+    const auto tolerance = parseFloat(getArg(argc, argv, "tolerance").value_or("20"));
+    if (!tolerance || *tolerance < 0.0f) {
+        printErr("Tolerance must be a percentage");
+        return 1;
+    }
+
+    std::vector<Result> results;
+    bool ok = true;
+    forEachMessageType([&](auto tag) {
+        if (const auto result = benchmark<decltype(tag)::value>())
+            results.push_back(*result);
+        else
+            ok = false;
+    });
+    if (!ok)
+        return 1;
+
+    println("{:<28} {:>7} {:>14} {:>10} {:>14} {:>10}", "Message", "Bytes", "Encode msg/s",
+        "MB/s", "Decode msg/s", "MB/s");
+    for (const auto& result : results) {
+        const auto megabytes = result.size / (1024.0 * 1024.0);
+        println("{:<28} {:>7} {:>14.0f} {:>10.1f} {:>14.0f} {:>10.1f}", result.type, result.size,
+            result.encodeRate, result.encodeRate * megabytes, result.decodeRate,
+            result.decodeRate * megabytes);
+    }
+
+    if (const auto path = getArg(argc, argv, "save")) {
+        std::ofstream file(*path);
+        for (const auto& result : results)
+            file << fmt::format("{} {} {}\n", result.type, result.encodeRate, result.decodeRate);
+        if (!file) {
+            printErr("Could not write '{}'", *path);
+            return 1;
+        }
+    }
+
+    if (const auto path = getArg(argc, argv, "baseline")) {
+        const auto baseline = loadBaseline(*path);
+        if (!baseline) {
+            printErr("Could not read '{}'", *path);
+            return 1;
+        }
+        const auto minFactor = 1.0 - *tolerance / 100.0;
+        for (const auto& result : results) {
+            const auto it = baseline->find(result.type);
+            if (it == baseline->end())
+                continue;
+            const auto [encodeRate, decodeRate] = it->second;
+            if (result.encodeRate < encodeRate * minFactor) {
+                printErr("{} encodes {:.0f}% slower than the baseline", result.type,
+                    100.0 * (1.0 - result.encodeRate / encodeRate));
+                ok = false;
+            }
+            if (result.decodeRate < decodeRate * minFactor) {
+                printErr("{} decodes {:.0f}% slower than the baseline", result.type,
+                    100.0 * (1.0 - result.decodeRate / decodeRate));
+                ok = false;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
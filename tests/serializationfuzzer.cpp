@@ -0,0 +1,48 @@
+#include <cstdlib>
+
+#include "messagetypes.hpp"
+
+// A libFuzzer target for the message decoders. The first byte of the input picks the message
+// type, the rest is decoded as a message of that type with the byte streams and the bit-packed
+// streams (the ones the game uses). Build it with COMPLEXITY_BUILD_FUZZER, which also enables ASan,
+// so every read past the input is caught.
+
+namespace {
+template <MessageType MsgType>
+void fuzzMessage(const uint8_t* data, size_t size)
+{
+    {
+        // Floats from the byte streams can be anything (e.g. NaN), so this is not encoded again
+        ReadBuffer buffer(data, size);
+        Message<MsgType> message;
+        deserialize(buffer, message);
+    }
+
+    ReadBuffer buffer(data, size);
+    Message<MsgType> message;
+    if (!deserializeMessage(buffer, message))
+        return;
+    // Everything the bit-packed streams accept is in range, so it has to encode (the streams
+    // assert the ranges) to the measured size and decode again.
+    WriteBuffer encoded(size);
+    if (!serializeBits(encoded, message) || encoded.getSize() != getSerializedBitsSize(message))
+        std::abort();
+    ReadBuffer encodedBuffer(encoded.getData(), encoded.getSize());
+    Message<MsgType> decoded;
+    if (!deserializeMessage(encodedBuffer, decoded))
+        std::abort();
+}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+        return 0;
+    const auto index = data[0] % messageTypeCount;
+    size_t i = 0;
+    forEachMessageType([&](auto tag) {
+        if (i++ == index)
+            fuzzMessage<decltype(tag)::value>(data + 1, size - 1);
+    });
+    return 0;
+}
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Generates media/terminal.dict, the preset dictionary the terminal lanes are deflated with
+(see src/compression.hpp).
+
+Usage: tools/terminaldict.py [OUTPUT]   (default: media/terminal.dict, run from the repository root)
+
+The dictionary contains the strings of media/systems/*.lua (with the format specifiers filled in
+with typical values), the terminal text of src/shipsystem.cpp and the prompts and log line
+prefixes of every system. Deflate encodes matches close to the end of the dictionary with fewer
+bits, so the least frequent strings come first and the most frequent ones last.
+Server and client have to use the same dictionary, so bump the protocol version in
+src/version.hpp after regenerating it.
+"""
+
+import datetime
+import pathlib
+import re
+import sys
+from collections import Counter
+
+# zlib only uses the last 32 KB of a dictionary
+MAX_SIZE = 32 * 1024
+MIN_LENGTH = 4
+
+SYSTEMS_DIR = pathlib.Path("media/systems")
+SHIPSYSTEM_SOURCE = pathlib.Path("src/shipsystem.cpp")
+# Not a system, it is required by all of them
+SHARED_SCRIPTS = {"shared"}
+# From getLogLevelString in src/shipsystem.cpp, the most common last
+LOG_LEVELS = ["DEBUG", "ERROR", "WARNING", "INFO"]
+# Log lines are stamped with the local time 1000 years ahead (see ShipSystem::getLogText)
+LOG_TIMESTAMP = f"[{datetime.date.today().year + 1000}-01-01 00:00:00]"
+
+# Comments have to be matched too, so strings in them are skipped
+LUA_TOKEN = re.compile(
+    r"""--\[(?P<commentlevel>=*)\[.*?\](?P=commentlevel)\]"""
+    r"""|--[^\n]*"""
+    r"""|\[(?P<level>=*)\[\n?(?P<long>.*?)\](?P=level)\]"""
+    r"""|"(?P<double>(?:[^"\\\n]|\\.)*)\""""
+    r"""|'(?P<single>(?:[^'\\\n]|\\.)*)'""",
+    re.DOTALL,
+)
+LUA_ESCAPES = {"n": "\n", "t": "\t", "\\": "\\", '"': '"', "'": "'"}
+LUA_FORMAT = re.compile(r"%(?:\.(\d+))?([dfis%])")
+
+CPP_TERMINAL_OUTPUT = re.compile(
+    r"""terminalOutput\(\s*(?:fmt::format\(\s*)?"((?:[^"\\]|\\.)*)\""""
+)
+CPP_ESCAPES = {"n": "\n", "t": "\t", "\\": "\\", '"': '"', "'": "'"}
+
+
+def unescape(text, escapes):
+    return re.sub(r"\\(.)", lambda m: escapes.get(m.group(1), m.group(1)), text)
+
+
+def format_lua(text):
+    def sample(match):
+        precision, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        if conversion == "s":
+            return "reactor"
+        if conversion == "f":
+            return f"{0.5:.{int(precision) if precision else 6}f}"
+        return "42"
+
+    return LUA_FORMAT.sub(sample, text)
+
+
+def get_lua_strings(path):
+    strings = []
+    source = path.read_text()
+    for match in LUA_TOKEN.finditer(source):
+        if match.group("long") is not None:
+            strings.append(match.group("long"))
+        elif match.group("double") is not None:
+            strings.append(unescape(match.group("double"), LUA_ESCAPES))
+        elif match.group("single") is not None:
+            strings.append(unescape(match.group("single"), LUA_ESCAPES))
+    return [format_lua(s) for s in strings]
+
+
+def get_shipsystem_strings():
+    strings = []
+    for match in CPP_TERMINAL_OUTPUT.finditer(SHIPSYSTEM_SOURCE.read_text()):
+        # The arguments differ every time, only the text around them is worth keeping
+        strings.extend(unescape(match.group(1), CPP_ESCAPES).split("{}"))
+    return strings
+
+
+def main():
+    output = pathlib.Path(sys.argv[1] if len(sys.argv) > 1 else "media/terminal.dict")
+
+    scripts = sorted(SYSTEMS_DIR.glob("*.lua"))
+    systems = [p.stem for p in scripts if p.stem not in SHARED_SCRIPTS]
+
+    counts = Counter()
+    for script in scripts:
+        counts.update(get_lua_strings(script))
+    counts.update(get_shipsystem_strings())
+
+    # Least frequent first, ties in the order they were found (Counter keeps insertion order)
+    entries = [s for s, _ in sorted(counts.items(), key=lambda item: item[1])]
+    entries = [s.strip("\n") for s in entries if len(s.strip()) >= MIN_LENGTH]
+    # Every command is echoed with a prompt and every log line starts with a prefix
+    entries += [f"root@{system}:~# " for system in systems]
+    entries += [f"{LOG_TIMESTAMP} [{level}] " for level in LOG_LEVELS]
+
+    dictionary = ""
+    for entry in dict.fromkeys(entries):
+        dictionary += entry + "\n"
+    dictionary = dictionary.encode()[-MAX_SIZE:]
+
+    output.write_bytes(dictionary)
+    print(f"Wrote {len(dictionary)} bytes to '{output}'")
+
+
+if __name__ == "__main__":
+    main()